@@ -0,0 +1,499 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Time the stages of snapshot generation on a set of video files, in
+ * isolation and as a whole by running tn, and print the results as JSON.
+ */
+
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "histogram.h"
+#include "image.h"
+#include "video.h"
+
+/** number of positions used for the seek, scale and save stages */
+#define POSITIONS 16
+
+enum Stage
+{
+    STAGE_OPEN = 0,
+    STAGE_DECODE,
+    STAGE_SEEK,
+    STAGE_SEEK_FAST,
+    STAGE_SEEK_FASTEST,
+    STAGE_SWS_SCALE,
+    STAGE_HISTOGRAM,
+    STAGE_SAVE_PPM,
+#ifdef HAVE_JPEG
+    STAGE_SAVE_JPEG,
+#endif
+    STAGE_END_TO_END,
+    STAGE_COUNT
+};
+
+static const char* stage_names[] =
+{
+    "open",
+    "decode",
+    "seek",
+    "seek_fast",
+    "seek_fastest",
+    "sws_scale",
+    "histogram_rgb",
+    "save_ppm",
+#ifdef HAVE_JPEG
+    "save_jpeg",
+#endif
+    "end_to_end",
+};
+
+struct Timing
+{
+    int count;
+    double total;
+    double min;
+    double max;
+};
+
+struct FileResult
+{
+    const char* filename;
+    int width;
+    int height;
+    const char* codec;
+    struct Timing stages[STAGE_COUNT];
+};
+
+static double
+now(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec * 1000.0 + ts.tv_nsec / 1000000.0;
+}
+
+static void
+timing_add(struct Timing* timing, double start)
+{
+    double elapsed = now() - start;
+
+    if (timing->count == 0 || elapsed < timing->min)
+    {
+        timing->min = elapsed;
+    }
+    if (timing->count == 0 || elapsed > timing->max)
+    {
+        timing->max = elapsed;
+    }
+    timing->total += elapsed;
+    timing->count++;
+}
+
+static void
+bench_open(struct FileResult* result, int iterations)
+{
+    struct VideoFile* video_file;
+    double start;
+    int i;
+
+    for (i = 0; i < iterations; i++)
+    {
+        start = now();
+        video_file = video_file_open(result->filename);
+        if (video_file == NULL)
+        {
+            return;
+        }
+        video_file_close(video_file);
+        timing_add(&result->stages[STAGE_OPEN], start);
+    }
+}
+
+static void
+bench_decode(struct FileResult* result)
+{
+    struct VideoFile* video_file;
+    double start;
+
+    video_file = video_file_open(result->filename);
+    if (video_file == NULL)
+    {
+        return;
+    }
+
+    result->width = video_file->width;
+    result->height = video_file->height;
+    result->codec = video_file->codec->name;
+
+    do
+    {
+        start = now();
+        if (video_file_decode_frame(video_file) < 0)
+        {
+            break;
+        }
+        timing_add(&result->stages[STAGE_DECODE], start);
+    } while (1);
+
+    video_file_close(video_file);
+}
+
+static void
+time_save(struct Timing* timing, struct VideoFile* video_file,
+        const char* directory, int position, enum ImageFormat format)
+{
+    char filename[1024];
+    double start;
+
+    snprintf(filename, sizeof(filename), "%s/%02d.%s", directory, position,
+            image_get_suffix(format));
+    start = now();
+    if (image_save(filename, video_file->rgb_buffer,
+                video_file->output_width, video_file->output_height,
+                format) == 0)
+    {
+        timing_add(timing, start);
+    }
+    unlink(filename);
+}
+
+/*
+ * Seek to evenly spaced positions like tn does and run the per-snapshot
+ * stages on the frame found there.
+ */
+static void
+bench_positions(struct FileResult* result, const char* directory)
+{
+    struct VideoFile* video_file;
+    struct Histogram histogram;
+    int64_t step;
+    double start;
+    int i;
+
+    video_file = video_file_open(result->filename);
+    if (video_file == NULL)
+    {
+        return;
+    }
+
+    /* the first conversion sets up the scaler, keep that out of the
+     * numbers */
+    if (video_file_decode_frame(video_file) == 0)
+    {
+        video_file_materialize_frame(video_file);
+    }
+
+    step = video_file->video_stream->duration / POSITIONS;
+    for (i = 0; i < POSITIONS; i++)
+    {
+        start = now();
+        video_file_seek_frame(video_file, i * step, 0);
+        timing_add(&result->stages[STAGE_SEEK], start);
+
+        video_file->rgb_valid = 0;
+        start = now();
+        if (video_file_materialize_frame(video_file) != 0)
+        {
+            continue;
+        }
+        timing_add(&result->stages[STAGE_SWS_SCALE], start);
+
+        start = now();
+        histogram_create_from_rgb(video_file->rgb_buffer,
+                video_file->output_width, video_file->output_height,
+                &histogram);
+        timing_add(&result->stages[STAGE_HISTOGRAM], start);
+
+        time_save(&result->stages[STAGE_SAVE_PPM], video_file, directory, i,
+                IMAGE_FORMAT_PPM);
+#ifdef HAVE_JPEG
+        time_save(&result->stages[STAGE_SAVE_JPEG], video_file, directory, i,
+                IMAGE_FORMAT_JPEG);
+#endif
+    }
+
+    video_file_close(video_file);
+}
+
+/*
+ * Seek to the same positions as bench_positions with lower decoding
+ * quality for the frames on the way, see --seek-decode.
+ */
+static void
+bench_seek_decode(struct FileResult* result, enum SeekDecode seek_decode,
+        enum Stage stage)
+{
+    struct VideoFile* video_file;
+    int64_t step;
+    double start;
+    int i;
+
+    video_file = video_file_open(result->filename);
+    if (video_file == NULL)
+    {
+        return;
+    }
+    video_file_set_seek_decode(video_file, seek_decode);
+
+    step = video_file->video_stream->duration / POSITIONS;
+    for (i = 0; i < POSITIONS; i++)
+    {
+        start = now();
+        video_file_seek_frame(video_file, i * step, 0);
+        timing_add(&result->stages[stage], start);
+    }
+
+    video_file_close(video_file);
+}
+
+static void
+remove_snapshots(const char* directory)
+{
+    char filename[1024];
+    struct dirent* entry;
+    DIR* dir;
+
+    dir = opendir(directory);
+    if (dir == NULL)
+    {
+        return;
+    }
+    while ((entry = readdir(dir)) != NULL)
+    {
+        if (entry->d_name[0] == '.')
+        {
+            continue;
+        }
+        snprintf(filename, sizeof(filename), "%s/%s", directory,
+                entry->d_name);
+        unlink(filename);
+    }
+    closedir(dir);
+}
+
+/*
+ * Run the tn binary on the file with its output thrown away; this includes
+ * process start-up, which is part of what users see.
+ */
+static void
+bench_end_to_end(struct FileResult* result, const char* tn,
+        const char* directory, int iterations)
+{
+    char prefix[1024];
+    double start;
+    pid_t pid;
+    int status;
+    int null_fd;
+    int i;
+
+    snprintf(prefix, sizeof(prefix), "%s/", directory);
+    for (i = 0; i < iterations; i++)
+    {
+        start = now();
+        pid = fork();
+        if (pid < 0)
+        {
+            return;
+        }
+        if (pid == 0)
+        {
+            null_fd = open("/dev/null", O_WRONLY);
+            if (null_fd >= 0)
+            {
+                dup2(null_fd, STDOUT_FILENO);
+                dup2(null_fd, STDERR_FILENO);
+            }
+            execl(tn, tn, "-n", "16", "-i", "jpg", "-p", prefix,
+                    result->filename, (char*)NULL);
+            _exit(127);
+        }
+        if (waitpid(pid, &status, 0) < 0 ||
+            !WIFEXITED(status) || WEXITSTATUS(status) != 0)
+        {
+            fprintf(stderr, "tn-bench: %s failed on %s\n", tn,
+                    result->filename);
+            remove_snapshots(directory);
+            return;
+        }
+        timing_add(&result->stages[STAGE_END_TO_END], start);
+        remove_snapshots(directory);
+    }
+}
+
+static void
+write_json_string(FILE* out, const char* string)
+{
+    const unsigned char* c;
+
+    fputc('"', out);
+    for (c = (const unsigned char*)string; c != NULL && *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(out, "\\%c", *c);
+        }
+        else if (*c < 0x20)
+        {
+            fprintf(out, "\\u%04x", *c);
+        }
+        else
+        {
+            fputc(*c, out);
+        }
+    }
+    fputc('"', out);
+}
+
+static void
+write_json(FILE* out, struct FileResult* results, int count, int iterations)
+{
+    struct Timing* timing;
+    int i, j;
+
+    fprintf(out, "{\n  \"tn_version\": ");
+    write_json_string(out, VERSION);
+    fprintf(out, ",\n  \"iterations\": %d,\n  \"files\": [", iterations);
+    for (i = 0; i < count; i++)
+    {
+        fprintf(out, "%s\n    {\n      \"file\": ", i > 0 ? "," : "");
+        write_json_string(out, results[i].filename);
+        fprintf(out, ",\n      \"width\": %d,\n      \"height\": %d,\n"
+                "      \"codec\": ", results[i].width, results[i].height);
+        write_json_string(out, results[i].codec);
+        fprintf(out, ",\n      \"stages\": {");
+        for (j = 0; j < STAGE_COUNT; j++)
+        {
+            timing = &results[i].stages[j];
+            fprintf(out, "%s\n        \"%s\": {\"count\": %d, "
+                    "\"total_ms\": %.3f, \"mean_ms\": %.3f, "
+                    "\"min_ms\": %.3f, \"max_ms\": %.3f}",
+                    j > 0 ? "," : "", stage_names[j], timing->count,
+                    timing->total,
+                    timing->count > 0 ? timing->total / timing->count : 0.0,
+                    timing->min, timing->max);
+        }
+        fprintf(out, "\n      }\n    }");
+    }
+    fprintf(out, "\n  ]\n}\n");
+}
+
+static void
+usage(const char* name)
+{
+    fprintf(stderr,
+            "Usage: %s [-t TN] [-n ITERATIONS] [-o FILE] VIDEO...\n"
+            "  -t TN          tn binary for the end-to-end runs\n"
+            "  -n ITERATIONS  repetitions of the open and end-to-end runs\n"
+            "  -o FILE        write the JSON results to FILE instead of "
+            "stdout\n", name);
+}
+
+int main(int argc, char *argv[])
+{
+    struct FileResult* results;
+    const char* tn = NULL;
+    const char* output = NULL;
+    char directory[] = "/tmp/tn-bench-XXXXXX";
+    int iterations = 5;
+    int count;
+    int opt;
+    int i;
+    FILE* out = stdout;
+
+    while ((opt = getopt(argc, argv, "t:n:o:h")) != -1)
+    {
+        switch (opt)
+        {
+            case 't':
+                tn = optarg;
+                break;
+            case 'n':
+                iterations = atoi(optarg);
+                break;
+            case 'o':
+                output = optarg;
+                break;
+            default:
+                usage(argv[0]);
+                return EXIT_FAILURE;
+        }
+    }
+    if (optind >= argc || iterations < 1)
+    {
+        usage(argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    if (mkdtemp(directory) == NULL)
+    {
+        perror("tn-bench");
+        return EXIT_FAILURE;
+    }
+
+    av_register_all();
+
+    count = argc - optind;
+    results = calloc(count, sizeof(struct FileResult));
+    for (i = 0; i < count; i++)
+    {
+        results[i].filename = argv[optind + i];
+        fprintf(stderr, "tn-bench: %s\n", results[i].filename);
+
+        bench_open(&results[i], iterations);
+        bench_decode(&results[i]);
+        bench_positions(&results[i], directory);
+        bench_seek_decode(&results[i], SEEK_DECODE_FAST, STAGE_SEEK_FAST);
+        bench_seek_decode(&results[i], SEEK_DECODE_FASTEST,
+                STAGE_SEEK_FASTEST);
+        if (tn != NULL)
+        {
+            bench_end_to_end(&results[i], tn, directory, iterations);
+        }
+    }
+    rmdir(directory);
+
+    if (output != NULL)
+    {
+        out = fopen(output, "w");
+        if (out == NULL)
+        {
+            perror(output);
+            free(results);
+            return EXIT_FAILURE;
+        }
+    }
+    write_json(out, results, count, iterations);
+    if (out != stdout)
+    {
+        fclose(out);
+    }
+    free(results);
+
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,351 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+/*
+ * Generate the clips used by tn-bench. All content is computed from the
+ * frame number and the encoders run in bit exact mode, so the same libav
+ * build always produces the same files.
+ */
+
+#ifdef AVCODEC_NEW_INCLUDE
+#   include <libavcodec/avcodec.h>
+#   include <libavformat/avformat.h>
+#else
+#   include <avcodec.h>
+#   include <avformat.h>
+#endif
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/** frames between two scene changes */
+#define SCENE_LENGTH 75
+/** length of the black run at the start of every third scene */
+#define BLACK_LENGTH 10
+#define FRAME_RATE 25
+
+struct Fixture
+{
+    const char* filename;
+    enum CodecID codec_id;
+    enum PixelFormat pix_fmt;
+    int width;
+    int height;
+    int gop_size;
+    int max_b_frames;
+    int frames;
+};
+
+static const struct Fixture fixtures[] =
+{
+    { "mpeg4-320x240-gop12.avi", CODEC_ID_MPEG4, PIX_FMT_YUV420P,
+        320, 240, 12, 0, 750 },
+    { "mpeg4-1280x720-gop250.mp4", CODEC_ID_MPEG4, PIX_FMT_YUV420P,
+        1280, 720, 250, 2, 750 },
+    { "mpeg2-720x576-gop15.mpg", CODEC_ID_MPEG2VIDEO, PIX_FMT_YUV420P,
+        720, 576, 15, 2, 750 },
+    { "mjpeg-640x480.avi", CODEC_ID_MJPEG, PIX_FMT_YUVJ420P,
+        640, 480, 1, 0, 375 },
+    { "h264-1920x1080-gop50.mp4", CODEC_ID_H264, PIX_FMT_YUV420P,
+        1920, 1080, 50, 2, 375 },
+};
+
+static int
+is_full_range(enum PixelFormat pix_fmt)
+{
+    return pix_fmt == PIX_FMT_YUVJ420P;
+}
+
+/*
+ * Every scene has its own tint, gradient direction and a box moving across
+ * the picture. The first frames of every third scene are black so black
+ * frame skipping has something to do.
+ */
+static void
+fill_frame(AVFrame* frame, const struct Fixture* fixture, int number)
+{
+    int scene = number / SCENE_LENGTH;
+    int offset = number % SCENE_LENGTH;
+    int black = (scene % 3 == 0) && offset < BLACK_LENGTH;
+    int low = is_full_range(fixture->pix_fmt) ? 0 : 16;
+    int range = is_full_range(fixture->pix_fmt) ? 255 : 219;
+    int box_size = fixture->height / 4;
+    int box_x = (fixture->width - box_size) * offset / SCENE_LENGTH;
+    int box_y = (fixture->height - box_size) / 2;
+    int x, y;
+
+    for (y = 0; y < fixture->height; y++)
+    {
+        uint8_t* line = frame->data[0] + y * frame->linesize[0];
+
+        for (x = 0; x < fixture->width; x++)
+        {
+            int value;
+
+            if (black)
+            {
+                value = 0;
+            }
+            else if (x >= box_x && x < box_x + box_size &&
+                     y >= box_y && y < box_y + box_size)
+            {
+                value = 255 - (scene * 37) % 128;
+            }
+            else if (scene % 2 == 0)
+            {
+                value = (x * 255 / fixture->width + number) & 0xff;
+            }
+            else
+            {
+                value = (y * 255 / fixture->height + 2 * number) & 0xff;
+            }
+            line[x] = low + value * range / 255;
+        }
+    }
+
+    for (y = 0; y < (fixture->height + 1) / 2; y++)
+    {
+        uint8_t* cb = frame->data[1] + y * frame->linesize[1];
+        uint8_t* cr = frame->data[2] + y * frame->linesize[2];
+
+        for (x = 0; x < (fixture->width + 1) / 2; x++)
+        {
+            cb[x] = black ? 128 : 128 + ((scene * 53) % 96) - 48;
+            cr[x] = black ? 128 : 128 + ((scene * 29 + x / 16) % 96) - 48;
+        }
+    }
+}
+
+static int
+write_packet(AVFormatContext* format_ctx, AVStream* stream, AVPacket* packet)
+{
+    AVCodecContext* codec_ctx = stream->codec;
+
+    if (packet->pts != AV_NOPTS_VALUE)
+    {
+        packet->pts = av_rescale_q(packet->pts, codec_ctx->time_base,
+                stream->time_base);
+    }
+    if (packet->dts != AV_NOPTS_VALUE)
+    {
+        packet->dts = av_rescale_q(packet->dts, codec_ctx->time_base,
+                stream->time_base);
+    }
+    packet->stream_index = stream->index;
+
+    return av_interleaved_write_frame(format_ctx, packet);
+}
+
+static int
+encode_frames(AVFormatContext* format_ctx, AVStream* stream,
+        const struct Fixture* fixture)
+{
+    AVCodecContext* codec_ctx = stream->codec;
+    AVFrame* frame;
+    AVPicture picture;
+    AVPacket packet;
+    int got_packet;
+    int failed = 0;
+    int i;
+
+    frame = avcodec_alloc_frame();
+    if (frame == NULL ||
+        avpicture_alloc(&picture, fixture->pix_fmt, fixture->width,
+            fixture->height) < 0)
+    {
+        av_free(frame);
+        return -1;
+    }
+    for (i = 0; i < 4; i++)
+    {
+        frame->data[i] = picture.data[i];
+        frame->linesize[i] = picture.linesize[i];
+    }
+
+    for (i = 0; i < fixture->frames && !failed; i++)
+    {
+        fill_frame(frame, fixture, i);
+        frame->pts = i;
+
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        if (avcodec_encode_video2(codec_ctx, &packet, frame, &got_packet) < 0)
+        {
+            failed = 1;
+        }
+        else if (got_packet)
+        {
+            failed = write_packet(format_ctx, stream, &packet) < 0;
+        }
+    }
+
+    /* drain frames held back for B-frame reordering or lookahead */
+    got_packet = 1;
+    while (!failed && got_packet &&
+           (codec_ctx->codec->capabilities & CODEC_CAP_DELAY))
+    {
+        av_init_packet(&packet);
+        packet.data = NULL;
+        packet.size = 0;
+        if (avcodec_encode_video2(codec_ctx, &packet, NULL, &got_packet) < 0)
+        {
+            failed = 1;
+        }
+        else if (got_packet)
+        {
+            failed = write_packet(format_ctx, stream, &packet) < 0;
+        }
+    }
+
+    avpicture_free(&picture);
+    av_free(frame);
+
+    return failed ? -1 : 0;
+}
+
+/*
+ * @return 0 on success, 1 if the encoder is not available, -1 on error
+ */
+static int
+write_fixture(const char* directory, const struct Fixture* fixture)
+{
+    AVFormatContext* format_ctx;
+    AVStream* stream;
+    AVCodec* codec;
+    AVCodecContext* codec_ctx;
+    AVDictionary* codec_options = NULL;
+    int header_written = 0;
+    int failed = 1;
+
+    codec = avcodec_find_encoder(fixture->codec_id);
+    if (codec == NULL)
+    {
+        fprintf(stderr, "tn-fixture: no encoder for %s, skipping\n",
+                fixture->filename);
+        return 1;
+    }
+
+    format_ctx = avformat_alloc_context();
+    if (format_ctx == NULL)
+    {
+        return -1;
+    }
+    snprintf(format_ctx->filename, sizeof(format_ctx->filename), "%s/%s",
+            directory, fixture->filename);
+    format_ctx->oformat = av_guess_format(NULL, format_ctx->filename, NULL);
+    format_ctx->flags |= AVFMT_FLAG_BITEXACT;
+
+    stream = avformat_new_stream(format_ctx, codec);
+    if (format_ctx->oformat == NULL || stream == NULL)
+    {
+        goto out;
+    }
+
+    codec_ctx = stream->codec;
+    codec_ctx->codec_id = fixture->codec_id;
+    codec_ctx->codec_type = AVMEDIA_TYPE_VIDEO;
+    codec_ctx->width = fixture->width;
+    codec_ctx->height = fixture->height;
+    codec_ctx->pix_fmt = fixture->pix_fmt;
+    codec_ctx->time_base.num = 1;
+    codec_ctx->time_base.den = FRAME_RATE;
+    codec_ctx->gop_size = fixture->gop_size;
+    codec_ctx->max_b_frames = fixture->max_b_frames;
+    codec_ctx->bit_rate = fixture->width * fixture->height * 4;
+    codec_ctx->thread_count = 1;
+    codec_ctx->flags |= CODEC_FLAG_BITEXACT;
+    if (format_ctx->oformat->flags & AVFMT_GLOBALHEADER)
+    {
+        codec_ctx->flags |= CODEC_FLAG_GLOBAL_HEADER;
+    }
+    stream->time_base = codec_ctx->time_base;
+
+    if (fixture->codec_id == CODEC_ID_H264)
+    {
+        av_dict_set(&codec_options, "preset", "veryfast", 0);
+    }
+
+    if (avcodec_open2(codec_ctx, codec, &codec_options) < 0)
+    {
+        fprintf(stderr, "tn-fixture: could not open encoder for %s\n",
+                fixture->filename);
+        goto out;
+    }
+
+    if (avio_open(&format_ctx->pb, format_ctx->filename, AVIO_FLAG_WRITE) < 0)
+    {
+        fprintf(stderr, "tn-fixture: could not create %s\n",
+                format_ctx->filename);
+        goto close_codec;
+    }
+
+    if (avformat_write_header(format_ctx, NULL) < 0)
+    {
+        goto close_file;
+    }
+    header_written = 1;
+
+    failed = encode_frames(format_ctx, stream, fixture) < 0;
+
+close_file:
+    if (header_written)
+    {
+        failed |= av_write_trailer(format_ctx) < 0;
+    }
+    avio_close(format_ctx->pb);
+close_codec:
+    avcodec_close(codec_ctx);
+out:
+    av_dict_free(&codec_options);
+    avformat_free_context(format_ctx);
+
+    if (failed)
+    {
+        fprintf(stderr, "tn-fixture: failed to write %s\n", fixture->filename);
+        return -1;
+    }
+    printf("%s/%s\n", directory, fixture->filename);
+
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    int failed = 0;
+    size_t i;
+
+    if (argc != 2)
+    {
+        fprintf(stderr, "Usage: %s OUTPUT_DIRECTORY\n", argv[0]);
+        return EXIT_FAILURE;
+    }
+
+    av_register_all();
+
+    for (i = 0; i < sizeof(fixtures) / sizeof(fixtures[0]); i++)
+    {
+        if (write_fixture(argv[1], &fixtures[i]) < 0)
+        {
+            failed = 1;
+        }
+    }
+
+    return failed ? EXIT_FAILURE : EXIT_SUCCESS;
+}
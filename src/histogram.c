@@ -17,6 +17,8 @@
 */
 
 #include <errno.h>
+#include <math.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 
@@ -27,42 +29,521 @@
 #include "histogram.h"
 #include "util.h"
 
+/* ITU-R BT.601 luma weights in 1.15 fixed point, summing up to 1 << 15 */
+#define LUMA_R 9798
+#define LUMA_G 19235
+#define LUMA_B 3735
+#define LUMA_SHIFT 15
+#define LUMA_ROUND (1 << (LUMA_SHIFT - 1))
+
+/** Number of histogram copies used while binning; neighbouring pixels
+ * usually share a luma value, so counting them into different copies keeps
+ * the increments independent of each other */
+#define SUB_HISTOGRAMS 4
+
+/** Largest number of pixels a #LumaKernel converts at once */
+#define LUMA_BLOCK_MAX 64
+
+/** Grid a dHash is computed on; neighbours in a row give one bit each */
+#define DHASH_COLUMNS 9
+#define DHASH_ROWS 8
+
+/** Luma samples averaged per grid cell in either direction, so that
+ * HISTOGRAM_DHASH_WIDTH x HISTOGRAM_DHASH_HEIGHT pixels are read */
+#define DHASH_SAMPLES 4
+
+/**
+ * Convert a block of RGB pixels to luma. The luma values may be written in
+ * any order, as they are only binned afterwards.
+ */
+typedef void (*LumaKernel)(const uint8_t* rgb, uint8_t* luma);
+
+static inline uint8_t
+rgb_to_luma(uint8_t r, uint8_t g, uint8_t b)
+{
+    return (uint8_t)((LUMA_R * r + LUMA_G * g + LUMA_B * b + LUMA_ROUND)
+            >> LUMA_SHIFT);
+}
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+
+#define HAVE_X86_KERNELS 1
+
+/*
+ * Both kernels split 96 bytes of packed RGB into 32 R, G and B values by
+ * five rounds of byte interleaving, then compute
+ * (r * LUMA_R + g * LUMA_G + b * LUMA_B + LUMA_ROUND) >> LUMA_SHIFT
+ * in 32 bit, exactly like rgb_to_luma. The AVX2 version does the same in
+ * both 128 bit lanes, the second lane working on the next 96 bytes.
+ */
+#define DEINTERLEAVE_ROUND(type, unpacklo, unpackhi, v) \
+    do { \
+        type t0 = unpacklo(v[0], v[3]); \
+        type t1 = unpackhi(v[0], v[3]); \
+        type t2 = unpacklo(v[1], v[4]); \
+        type t3 = unpackhi(v[1], v[4]); \
+        type t4 = unpacklo(v[2], v[5]); \
+        type t5 = unpackhi(v[2], v[5]); \
+        v[0] = t0; v[1] = t1; v[2] = t2; \
+        v[3] = t3; v[4] = t4; v[5] = t5; \
+    } while (0)
+
+__attribute__((target("sse2")))
+static inline __m128i
+luma_sse2_half(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i coeff_rg = _mm_set1_epi32((LUMA_G << 16) | LUMA_R);
+    const __m128i coeff_b = _mm_set1_epi32((LUMA_ROUND << 16) | LUMA_B);
+    const __m128i one = _mm_set1_epi16(1);
+    __m128i lo, hi;
+
+    lo = _mm_add_epi32(
+            _mm_madd_epi16(_mm_unpacklo_epi16(r, g), coeff_rg),
+            _mm_madd_epi16(_mm_unpacklo_epi16(b, one), coeff_b));
+    hi = _mm_add_epi32(
+            _mm_madd_epi16(_mm_unpackhi_epi16(r, g), coeff_rg),
+            _mm_madd_epi16(_mm_unpackhi_epi16(b, one), coeff_b));
+
+    return _mm_packs_epi32(_mm_srli_epi32(lo, LUMA_SHIFT),
+            _mm_srli_epi32(hi, LUMA_SHIFT));
+}
+
+__attribute__((target("sse2")))
+static inline __m128i
+luma_sse2(__m128i r, __m128i g, __m128i b)
+{
+    const __m128i zero = _mm_setzero_si128();
+
+    return _mm_packus_epi16(
+            luma_sse2_half(_mm_unpacklo_epi8(r, zero),
+                _mm_unpacklo_epi8(g, zero),
+                _mm_unpacklo_epi8(b, zero)),
+            luma_sse2_half(_mm_unpackhi_epi8(r, zero),
+                _mm_unpackhi_epi8(g, zero),
+                _mm_unpackhi_epi8(b, zero)));
+}
+
+/** Converts 32 pixels */
+__attribute__((target("sse2")))
+static void
+luma_kernel_sse2(const uint8_t* rgb, uint8_t* luma)
+{
+    __m128i v[6];
+    int i;
+
+    for (i = 0; i < 6; ++i)
+    {
+        v[i] = _mm_loadu_si128((const __m128i *)(rgb + 16 * i));
+    }
+    for (i = 0; i < 5; ++i)
+    {
+        DEINTERLEAVE_ROUND(__m128i, _mm_unpacklo_epi8, _mm_unpackhi_epi8, v);
+    }
+
+    /* v now holds r0-r15, r16-r31, g0-g15, g16-g31, b0-b15, b16-b31 */
+    _mm_storeu_si128((__m128i *)luma, luma_sse2(v[0], v[2], v[4]));
+    _mm_storeu_si128((__m128i *)(luma + 16), luma_sse2(v[1], v[3], v[5]));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+luma_avx2_half(__m256i r, __m256i g, __m256i b)
+{
+    const __m256i coeff_rg = _mm256_set1_epi32((LUMA_G << 16) | LUMA_R);
+    const __m256i coeff_b = _mm256_set1_epi32((LUMA_ROUND << 16) | LUMA_B);
+    const __m256i one = _mm256_set1_epi16(1);
+    __m256i lo, hi;
+
+    lo = _mm256_add_epi32(
+            _mm256_madd_epi16(_mm256_unpacklo_epi16(r, g), coeff_rg),
+            _mm256_madd_epi16(_mm256_unpacklo_epi16(b, one), coeff_b));
+    hi = _mm256_add_epi32(
+            _mm256_madd_epi16(_mm256_unpackhi_epi16(r, g), coeff_rg),
+            _mm256_madd_epi16(_mm256_unpackhi_epi16(b, one), coeff_b));
+
+    return _mm256_packs_epi32(_mm256_srli_epi32(lo, LUMA_SHIFT),
+            _mm256_srli_epi32(hi, LUMA_SHIFT));
+}
+
+__attribute__((target("avx2")))
+static inline __m256i
+luma_avx2(__m256i r, __m256i g, __m256i b)
+{
+    const __m256i zero = _mm256_setzero_si256();
+
+    return _mm256_packus_epi16(
+            luma_avx2_half(_mm256_unpacklo_epi8(r, zero),
+                _mm256_unpacklo_epi8(g, zero),
+                _mm256_unpacklo_epi8(b, zero)),
+            luma_avx2_half(_mm256_unpackhi_epi8(r, zero),
+                _mm256_unpackhi_epi8(g, zero),
+                _mm256_unpackhi_epi8(b, zero)));
+}
+
+/** Converts 64 pixels */
+__attribute__((target("avx2")))
+static void
+luma_kernel_avx2(const uint8_t* rgb, uint8_t* luma)
+{
+    __m256i v[6];
+    int i;
+
+    for (i = 0; i < 6; ++i)
+    {
+        v[i] = _mm256_inserti128_si256(
+                _mm256_castsi128_si256(
+                    _mm_loadu_si128((const __m128i *)(rgb + 16 * i))),
+                _mm_loadu_si128((const __m128i *)(rgb + 96 + 16 * i)),
+                1);
+    }
+    for (i = 0; i < 5; ++i)
+    {
+        DEINTERLEAVE_ROUND(__m256i, _mm256_unpacklo_epi8,
+                _mm256_unpackhi_epi8, v);
+    }
+
+    _mm256_storeu_si256((__m256i *)luma, luma_avx2(v[0], v[2], v[4]));
+    _mm256_storeu_si256((__m256i *)(luma + 32), luma_avx2(v[1], v[3], v[5]));
+}
+#endif
+
+/**
+ * Pick the fastest luma kernel supported by the CPU.
+ *
+ * @param block_size set to the number of pixels converted per call
+ * @return a #LumaKernel or NULL if only the scalar code is usable
+ */
+static LumaKernel
+select_luma_kernel(int* block_size)
+{
+#ifdef HAVE_X86_KERNELS
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2"))
+    {
+        *block_size = 64;
+        return luma_kernel_avx2;
+    }
+    if (__builtin_cpu_supports("sse2"))
+    {
+        *block_size = 32;
+        return luma_kernel_sse2;
+    }
+#endif
+    *block_size = 0;
+    return NULL;
+}
+
+static inline void
+bin_luma(const uint8_t* luma, int count, uint32_t sub[SUB_HISTOGRAMS][256])
+{
+    int i;
+
+    for (i = 0; i + 4 <= count; i += 4)
+    {
+        sub[0][luma[i]]++;
+        sub[1][luma[i + 1]]++;
+        sub[2][luma[i + 2]]++;
+        sub[3][luma[i + 3]]++;
+    }
+    for (; i < count; ++i)
+    {
+        sub[0][luma[i]]++;
+    }
+}
+
 int
 histogram_create_from_rgb(uint8_t* buffer, int width, int height, struct Histogram* histogram)
 {
+    return_if(histogram == NULL, -1);
+    return_if(buffer == NULL, -1);
+
+    memset(histogram, 0, sizeof(struct Histogram));
+
+    return histogram_add_rgb(histogram, buffer, width, height);
+}
+
+int
+histogram_add_rgb(struct Histogram* histogram, const uint8_t* buffer,
+        int width, int lines)
+{
+    uint32_t sub[SUB_HISTOGRAMS][256];
+    uint8_t luma[LUMA_BLOCK_MAX];
+    LumaKernel kernel;
+    int block_size;
     int line; 
     int column;
-    uint8_t r,g,b,y;
-    int offset;
+    int i;
 
     return_if(histogram == NULL, -1);
+    return_if(buffer == NULL, -1);
 
-    memset(histogram, 0, sizeof(struct Histogram));
+    memset(sub, 0, sizeof(sub));
+
+    histogram->total_pixel += width * lines;
 
-    histogram->total_pixel = width * height;
+    kernel = select_luma_kernel(&block_size);
 
-    for (line = 0; line < height; line++)
+    for (line = 0; line < lines; line++)
     {
-        for (column = 0; column < width * 3; column += 3)
+        const uint8_t* row = buffer + (size_t)width * 3 * line;
+
+        column = 0;
+        if (kernel)
+        {
+            for (; column + block_size <= width; column += block_size)
+            {
+                kernel(row + column * 3, luma);
+                bin_luma(luma, block_size, sub);
+            }
+        }
+
+        for (i = 0; column < width; ++column, ++i)
         {
-            offset = width * 3 * line;
-            r = buffer[offset + column];
-            g = buffer[offset + column + 1];
-            b = buffer[offset + column + 2];
+            const uint8_t* pixel = row + column * 3;
 
-            /* calculating luma value from RGB data */
-            y = (uint8_t)(0.299 * r + 0.587 * g + 0.144 * b);
-            histogram->data[y]++;
-            if (histogram->data[y] > histogram->max)
+            luma[i] = rgb_to_luma(pixel[0], pixel[1], pixel[2]);
+            if (i == LUMA_BLOCK_MAX - 1)
             {
-                histogram->max = histogram->data[y];
+                bin_luma(luma, LUMA_BLOCK_MAX, sub);
+                i = -1;
             }
         }
+        bin_luma(luma, i, sub);
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        histogram->data[i] += sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+        if (histogram->data[i] > histogram->max)
+        {
+            histogram->max = histogram->data[i];
+        }
     }
 
     return 0;
 }
 
+/** Number of lowest luma values considered dark */
+#define DARK_LUMA_LEVELS 15
+
+/**
+ * Fill a table mapping the stored luma values to full range
+ */
+static void
+make_luma_table(uint8_t table[256], int full_range)
+{
+    int i;
+
+    for (i = 0; i < 256; i++)
+    {
+        if (full_range)
+        {
+            table[i] = i;
+        }
+        else if (i <= 16)
+        {
+            table[i] = 0;
+        }
+        else if (i >= 235)
+        {
+            table[i] = 255;
+        }
+        else
+        {
+            table[i] = ((i - 16) * 255 + 109) / 219;
+        }
+    }
+}
+
+int
+histogram_create_from_luma(const uint8_t* plane, int linesize, int width,
+        int height, int full_range, int sample_step,
+        struct Histogram* histogram)
+{
+    uint32_t sub[SUB_HISTOGRAMS][256];
+    uint8_t table[256];
+    int line;
+    int column;
+    int i;
+
+    return_if(histogram == NULL, -1);
+    return_if(plane == NULL, -1);
+    return_if(sample_step < 1, -1);
+
+    memset(histogram, 0, sizeof(struct Histogram));
+    memset(sub, 0, sizeof(sub));
+
+    make_luma_table(table, full_range);
+
+    for (line = 0; line < height; line += sample_step)
+    {
+        const uint8_t* row = plane + (ptrdiff_t)linesize * line;
+
+        column = 0;
+        if (sample_step == 1)
+        {
+            for (; column + 4 <= width; column += 4)
+            {
+                sub[0][row[column]]++;
+                sub[1][row[column + 1]]++;
+                sub[2][row[column + 2]]++;
+                sub[3][row[column + 3]]++;
+            }
+        }
+        for (; column < width; column += sample_step)
+        {
+            sub[0][row[column]]++;
+        }
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        histogram->data[table[i]] +=
+            sub[0][i] + sub[1][i] + sub[2][i] + sub[3][i];
+    }
+
+    for (i = 0; i < 256; i++)
+    {
+        histogram->total_pixel += histogram->data[i];
+        if (histogram->data[i] > histogram->max)
+        {
+            histogram->max = histogram->data[i];
+        }
+    }
+
+    return 0;
+}
+
+int
+histogram_luma_heuristically_black(const uint8_t* plane, int linesize,
+        int width, int height, int full_range, int sample_step)
+{
+    uint8_t table[256];
+    uint8_t dark_below = 0;
+    uint32_t columns;
+    uint32_t remaining;
+    uint32_t needed;
+    uint32_t dark_pixel_count = 0;
+    int line;
+    int column;
+
+    return_if(plane == NULL, 0);
+    return_if(sample_step < 1, 0);
+    return_if(width <= 0 || height <= 0, 0);
+
+    /* first stored value that does not count as dark */
+    make_luma_table(table, full_range);
+    while (dark_below < 255 && table[dark_below] < DARK_LUMA_LEVELS)
+    {
+        dark_below++;
+    }
+
+    columns = (width + sample_step - 1) / sample_step;
+    remaining = columns * ((height + sample_step - 1) / sample_step);
+    needed = remaining / 2;
+
+    for (line = 0; line < height; line += sample_step)
+    {
+        const uint8_t* row = plane + (ptrdiff_t)linesize * line;
+
+        for (column = 0; column < width; column += sample_step)
+        {
+            dark_pixel_count += row[column] < dark_below;
+        }
+        remaining -= columns;
+
+        if (dark_pixel_count >= needed)
+        {
+            return 1;
+        }
+        if (dark_pixel_count + remaining < needed)
+        {
+            return 0;
+        }
+    }
+
+    return dark_pixel_count >= needed;
+}
+
+/**
+ * Position of the center of sub-cell index out of count in a line of size
+ * pixels
+ */
+static inline int
+dhash_sample_position(int index, int count, int size)
+{
+    return (int)(((int64_t)index * 2 + 1) * size / (2 * count));
+}
+
+/**
+ * Compute a dHash from a few hundred samples of a picture, with three bytes
+ * per pixel for RGB or one byte for luma
+ */
+static uint64_t
+dhash(const uint8_t* data, int linesize, int bytes_per_pixel, int width,
+        int height)
+{
+    uint32_t grid[DHASH_ROWS][DHASH_COLUMNS];
+    uint64_t hash = 0;
+    int x, y;
+    int sx, sy;
+
+    memset(grid, 0, sizeof(grid));
+    for (y = 0; y < DHASH_ROWS * DHASH_SAMPLES; y++)
+    {
+        const uint8_t* row = data + (ptrdiff_t)linesize *
+            dhash_sample_position(y, DHASH_ROWS * DHASH_SAMPLES, height);
+        uint32_t* cells = grid[y / DHASH_SAMPLES];
+
+        for (x = 0; x < DHASH_COLUMNS * DHASH_SAMPLES; x++)
+        {
+            const uint8_t* pixel = row + bytes_per_pixel *
+                dhash_sample_position(x, DHASH_COLUMNS * DHASH_SAMPLES,
+                        width);
+
+            cells[x / DHASH_SAMPLES] += bytes_per_pixel == 3 ?
+                rgb_to_luma(pixel[0], pixel[1], pixel[2]) : pixel[0];
+        }
+    }
+
+    /* one bit per horizontal gradient */
+    for (sy = 0; sy < DHASH_ROWS; sy++)
+    {
+        for (sx = 0; sx < DHASH_COLUMNS - 1; sx++)
+        {
+            hash = (hash << 1) | (grid[sy][sx] < grid[sy][sx + 1]);
+        }
+    }
+
+    return hash;
+}
+
+uint64_t
+histogram_dhash_from_luma(const uint8_t* plane, int linesize, int width,
+        int height)
+{
+    return_if(plane == NULL, 0);
+    return_if(width <= 0 || height <= 0, 0);
+
+    return dhash(plane, linesize, 1, width, height);
+}
+
+uint64_t
+histogram_dhash_from_rgb(const uint8_t* buffer, int width, int height)
+{
+    return_if(buffer == NULL, 0);
+    return_if(width <= 0 || height <= 0, 0);
+
+    return dhash(buffer, width * 3, 3, width, height);
+}
+
+int
+histogram_dhash_distance(uint64_t a, uint64_t b)
+{
+    return __builtin_popcountll(a ^ b);
+}
+
 int
 histogram_save(struct Histogram* histogram, const char* file_name)
 {
@@ -97,7 +578,7 @@ histogram_heuristically_black(struct Histogram* histogram)
 
     return_if (histogram == NULL, 0);
 
-    for (i = 0; i < 15; i++)
+    for (i = 0; i < DARK_LUMA_LEVELS; i++)
     {
         dark_pixel_count += histogram->data[i];
     }
@@ -105,6 +586,125 @@ histogram_heuristically_black(struct Histogram* histogram)
     return dark_pixel_count >= histogram->total_pixel / 2;
 }
 
+double
+histogram_get_entropy(const struct Histogram* histogram)
+{
+    double entropy = 0.0;
+    int i;
+
+    return_if(histogram == NULL, 0.0);
+    return_if(histogram->total_pixel == 0, 0.0);
+
+    for (i = 0; i < 256; i++)
+    {
+        if (histogram->data[i])
+        {
+            double p = (double)histogram->data[i] / histogram->total_pixel;
+
+            entropy -= p * log2(p);
+        }
+    }
+
+    return entropy;
+}
+
+int
+histogram_get_spread(const struct Histogram* histogram)
+{
+    uint32_t cutoff;
+    uint32_t count;
+    int low;
+    int high;
+
+    return_if(histogram == NULL, 0);
+
+    cutoff = histogram->total_pixel / 20;
+
+    count = 0;
+    for (low = 0; low < 255; low++)
+    {
+        count += histogram->data[low];
+        if (count > cutoff)
+        {
+            break;
+        }
+    }
+
+    count = 0;
+    for (high = 255; high > low; high--)
+    {
+        count += histogram->data[high];
+        if (count > cutoff)
+        {
+            break;
+        }
+    }
+
+    return high - low;
+}
+
+double
+histogram_get_distance(const struct Histogram* a, const struct Histogram* b)
+{
+    double distance = 0.0;
+    int i;
+
+    return_if(a == NULL || b == NULL, 0.0);
+    return_if(a->total_pixel == 0 || b->total_pixel == 0, 0.0);
+
+    for (i = 0; i < 256; i++)
+    {
+        distance += fabs((double)a->data[i] / a->total_pixel -
+                (double)b->data[i] / b->total_pixel);
+    }
+
+    return distance / 2.0;
+}
+
+double
+histogram_get_chi_square(const struct Histogram* a,
+        const struct Histogram* b)
+{
+    double distance = 0.0;
+    int i;
+
+    return_if(a == NULL || b == NULL, 0.0);
+    return_if(a->total_pixel == 0 || b->total_pixel == 0, 0.0);
+
+    for (i = 0; i < 256; i++)
+    {
+        double p = (double)a->data[i] / a->total_pixel;
+        double q = (double)b->data[i] / b->total_pixel;
+
+        if (p + q > 0.0)
+        {
+            distance += (p - q) * (p - q) / (p + q);
+        }
+    }
+
+    return distance;
+}
+
+double
+histogram_score(const struct Histogram* histogram,
+        const struct Histogram* previous)
+{
+    double score;
+
+    return_if(histogram == NULL, 0.0);
+
+    /* both terms are scaled to 0..1 */
+    score = histogram_get_entropy(histogram) / 8.0 +
+        histogram_get_spread(histogram) / 255.0;
+
+    if (previous)
+    {
+        score -= histogram_get_distance(histogram, previous);
+    }
+
+    return score;
+}
+
 int
 histogram_render(struct Histogram* histogram, const char* filename)
 {
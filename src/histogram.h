@@ -22,6 +22,11 @@
 
 #include <stdint.h>
 
+/** Size of a picture #histogram_dhash_from_luma reads every pixel of, for
+ * scaling a frame down before hashing it */
+#define HISTOGRAM_DHASH_WIDTH 36
+#define HISTOGRAM_DHASH_HEIGHT 32
+
 /**
  * Struct which represents a histogram of a video frame.
  */
@@ -39,8 +44,9 @@ struct Histogram
 
 /**
  * Create a histogram from an RGB buffer. The buffer is assumed to contain
- * width * height * 3 elements in order RGB. The data is converted to Luma and
- * categorized afterwards.
+ * width * height * 3 elements in order RGB. The data is converted to Luma using
+ * fixed-point BT.601 weights and categorized afterwards. SSE2 or AVX2 code is
+ * used if the CPU supports it; the result is identical to the plain C path.
  *
  * @param buffer input buffer
  * @param width of picture
@@ -52,6 +58,103 @@ struct Histogram
 int
 histogram_create_from_rgb(uint8_t* buffer, int width, int height, struct Histogram* histogram);
 
+/**
+ * Add lines of an RGB buffer to a histogram, e.g. while a picture is
+ * converted a band at a time. Adding all lines of a picture to a cleared
+ * histogram gives the result of #histogram_create_from_rgb.
+ *
+ * @param histogram the histogram to add to
+ * @param buffer lines * width * 3 bytes of RGB data
+ * @param width of picture
+ * @param lines number of lines in buffer
+ * @return 0 on success
+ * \ingroup analysis
+ */
+int
+histogram_add_rgb(struct Histogram* histogram, const uint8_t* buffer,
+        int width, int lines);
+
+/**
+ * Create a histogram from a luma plane as produced by the decoder for YUV
+ * formats. Limited range ("TV") luma is expanded to full range, so the
+ * result is comparable to #histogram_create_from_rgb.
+ *
+ * @param plane first byte of the luma plane
+ * @param linesize distance between two lines of plane in bytes
+ * @param width of picture
+ * @param height of picture
+ * @param full_range 0 if luma is in the range of 16-235, 1 for 0-255
+ * @param sample_step only every sample_step-th line and column is counted
+ * @param histogram pointer to a #Histogram. Any old data will be erased.
+ * @return 0 on success
+ * \ingroup analysis
+ */
+int
+histogram_create_from_luma(const uint8_t* plane, int linesize, int width,
+        int height, int full_range, int sample_step,
+        struct Histogram* histogram);
+
+/**
+ * Same heuristics as #histogram_heuristically_black, working directly on a
+ * luma plane without creating a histogram. Only every sample_step-th line
+ * and column is looked at, and the scan stops as soon as the result cannot
+ * change anymore.
+ *
+ * @param plane first byte of the luma plane
+ * @param linesize distance between two lines of plane in bytes
+ * @param width of picture
+ * @param height of picture
+ * @param full_range 0 if luma is in the range of 16-235, 1 for 0-255
+ * @param sample_step only every sample_step-th line and column is checked
+ * @return 1, if the picture is (near-)black, 0 otherwise
+ * \ingroup analysis
+ */
+int
+histogram_luma_heuristically_black(const uint8_t* plane, int linesize,
+        int width, int height, int full_range, int sample_step);
+
+/**
+ * Compute a perceptual difference hash of a luma plane: the picture is
+ * reduced to 9x8 cells, each the mean of 16 samples, and every bit tells
+ * whether a cell is darker than its right neighbour. Similar pictures get
+ * hashes with a small Hamming distance, regardless of size, compression or
+ * luma range. Only 1152 pixels are read.
+ *
+ * @param plane first byte of the luma plane
+ * @param linesize distance between two lines of plane in bytes
+ * @param width of picture
+ * @param height of picture
+ * @return the 64 bit hash
+ * \ingroup analysis
+ */
+uint64_t
+histogram_dhash_from_luma(const uint8_t* plane, int linesize, int width,
+        int height);
+
+/**
+ * Compute the hash of #histogram_dhash_from_luma from an RGB buffer of
+ * width * height * 3 bytes.
+ *
+ * @param buffer input buffer
+ * @param width of picture
+ * @param height of picture
+ * @return the 64 bit hash
+ * \ingroup analysis
+ */
+uint64_t
+histogram_dhash_from_rgb(const uint8_t* buffer, int width, int height);
+
+/**
+ * Count the bits two hashes differ in.
+ *
+ * @param a hash from #histogram_dhash_from_luma or #histogram_dhash_from_rgb
+ * @param b another hash
+ * @return Hamming distance between 0 and 64
+ * \ingroup analysis
+ */
+int
+histogram_dhash_distance(uint64_t a, uint64_t b);
+
 /**
  * Write histogram distribution to disk. This is a raw ascii file allowing
  * processing in other tools such as gnuplot. If the file already exists, it
@@ -77,6 +180,69 @@ histogram_save(struct Histogram* histogram, const char* file_name);
 int
 histogram_heuristically_black(struct Histogram* histogram);
 
+/**
+ * Get the Shannon entropy of the luma distribution. Flat pictures such as
+ * fades or title cards have a low entropy.
+ *
+ * @param histogram pointer to a #Histogram containing the data
+ * @return entropy in bits per pixel, between 0 and 8
+ * \ingroup analysis
+ */
+double
+histogram_get_entropy(const struct Histogram* histogram);
+
+/**
+ * Get the contrast spread, the distance between the darkest and the
+ * brightest luma values after ignoring 5% of the pixels at either end.
+ *
+ * @param histogram pointer to a #Histogram containing the data
+ * @return spread in luma levels, between 0 and 255
+ * \ingroup analysis
+ */
+int
+histogram_get_spread(const struct Histogram* histogram);
+
+/**
+ * Compare two luma distributions independent of the picture sizes.
+ *
+ * @param a pointer to a #Histogram containing the data
+ * @param b pointer to a #Histogram containing the data
+ * @return share of pixels that would have to change their luma value to
+ * turn one distribution into the other, between 0 and 1
+ * \ingroup analysis
+ */
+double
+histogram_get_distance(const struct Histogram* a, const struct Histogram* b);
+
+/**
+ * Chi-square distance of two luma distributions, independent of the
+ * picture sizes. It reacts strongly to luma levels that appear or vanish,
+ * as they do at a cut.
+ *
+ * @param a pointer to a #Histogram containing the data
+ * @param b pointer to a #Histogram containing the data
+ * @return distance between 0 and 2
+ * \ingroup analysis
+ */
+double
+histogram_get_chi_square(const struct Histogram* a,
+        const struct Histogram* b);
+
+/**
+ * Rate how well a frame represents its surroundings. Detailed, contrasty
+ * pictures score high, while flat frames, fades and frames that differ a
+ * lot from the previous one (cuts, motion blurred transitions) score low.
+ *
+ * @param histogram pointer to a #Histogram of the frame
+ * @param previous pointer to a #Histogram of the frame decoded before or
+ * NULL if unknown
+ * @return score, higher is better
+ * \ingroup analysis
+ */
+double
+histogram_score(const struct Histogram* histogram,
+        const struct Histogram* previous);
+
 /**
  * Write a distribution image to disk. This is a plot of the histogram. In
  * order to have this working, the 
@@ -17,6 +17,7 @@
 */
 
 #include <stdio.h>
+#include <stdlib.h>
 #include <string.h>
 
 #ifdef HAVE_JPEG
@@ -24,96 +25,483 @@
 #endif
 
 #include "image.h"
+#include "stats.h"
 #include "util.h"
 
+/** Alignment of lines in #image_yuv420_layout */
+#define YUV_ALIGN 32
+
+/** Lines per call of jpeg_write_raw_data, one row of 16x16 MCUs */
+#define YUV_ROWS IMAGE_BAND_LINES
+
+#define ALIGN(x, a) (((x) + (a) - 1) / (a) * (a))
+
+/**
+ * Pixels to write, either RGB24 or YCbCr 4:2:0, as a whole or in bands
+ */
+struct ImageSource
+{
+    uint8_t* rgb_buffer;
+    const struct YuvImage* yuv;
+    int width;
+    int height;
+    const struct ImageBands* bands;
+};
+
+static int
+source_is_yuv420(const struct ImageSource* source)
+{
+    return source->yuv != NULL || (source->bands && source->bands->yuv420);
+}
+
+/**
+ * Point lines at line first of a source and, for YCbCr 4:2:0, at chroma
+ * line first / 2
+ */
+static int
+source_lines(const struct ImageSource* source, int first, int count,
+        struct YuvImage* lines)
+{
+    int i;
+
+    if (source->bands)
+    {
+        return source->bands->read(source->bands->data, first, count, lines);
+    }
+
+    if (source->yuv)
+    {
+        for (i = 0; i < 3; i++)
+        {
+            lines->planes[i] = source->yuv->planes[i] +
+                (size_t)(i ? first / 2 : first) * source->yuv->linesizes[i];
+            lines->linesizes[i] = source->yuv->linesizes[i];
+        }
+        return 0;
+    }
+
+    lines->planes[0] = source->rgb_buffer + (size_t)first * source->width * 3;
+    lines->linesizes[0] = source->width * 3;
+
+    return 0;
+}
+
 #ifdef HAVE_JPEG
+static void
+setup_jpeg(struct jpeg_compress_struct* cinfo, FILE* outfile,
+        int width, int height, J_COLOR_SPACE color_space)
+{
+    jpeg_create_compress(cinfo);
+    cinfo->image_width = width;
+    cinfo->image_height = height;
+    cinfo->input_components = 3;
+    cinfo->in_color_space = color_space;
+    jpeg_set_defaults(cinfo);
+    jpeg_set_quality(cinfo, 75, TRUE);
+
+    /* set output file */
+    jpeg_stdio_dest(cinfo, outfile);
+}
+
 static int 
-save_image_jpeg(const char* filename, uint8_t* rgb_buffer, int width, int height)
+write_image_jpeg(FILE* outfile, const struct ImageSource* source)
 {
     struct jpeg_compress_struct cinfo;
     struct jpeg_error_mgr jerr;
-    FILE* outfile;
-    JSAMPROW row_pointer[1];
-    int row_stride = width * 3;
-
-    outfile = fopen (filename, "wb");
-    return_if(NULL == outfile, -1);
+    JSAMPROW rows[IMAGE_BAND_LINES];
 
     /* use default error handle */
     cinfo.err = jpeg_std_error(&jerr);
 
     /* set jpeg parameters */
-    jpeg_create_compress(&cinfo);
-    cinfo.image_width = width;
-    cinfo.image_height = height;
-    cinfo.input_components = 3;
-    cinfo.in_color_space = JCS_RGB;
-    jpeg_set_defaults(&cinfo);
-    jpeg_set_quality(&cinfo, 75, TRUE);
-
-    /* set output file */
-    jpeg_stdio_dest(&cinfo, outfile);
+    setup_jpeg(&cinfo, outfile, source->width, source->height, JCS_RGB);
 
     /* start encoding & writing to disk */
     jpeg_start_compress(&cinfo, TRUE);
     while (cinfo.next_scanline < cinfo.image_height)
     {
-        row_pointer[0] = &rgb_buffer[cinfo.next_scanline * row_stride];
-        (void)jpeg_write_scanlines(&cinfo, row_pointer, 1);
+        int line = cinfo.next_scanline;
+        int count = MIN(IMAGE_BAND_LINES, source->height - line);
+        struct YuvImage lines;
+        int i;
+
+        if (source_lines(source, line, count, &lines) < 0)
+        {
+            jpeg_destroy_compress(&cinfo);
+            return -1;
+        }
+        for (i = 0; i < count; i++)
+        {
+            rows[i] = lines.planes[0] + (size_t)i * lines.linesizes[0];
+        }
+        (void)jpeg_write_scanlines(&cinfo, rows, count);
     }
     jpeg_finish_compress(&cinfo);
-    fclose(outfile);
 
     jpeg_destroy_compress(&cinfo);
 
     return 0;
 }
+
+/**
+ * Point rows at the lines of a plane from line first on, repeating the last
+ * line below the picture. Lines not ending on a block boundary are copied
+ * into scratch and padded with their last sample, like libjpeg does for RGB
+ * input.
+ *
+ * @param plane line first of the plane
+ */
+static void
+setup_plane_rows(JSAMPROW* rows, int count, const uint8_t* plane,
+        int linesize, int first, int width, int height, int padded_width,
+        uint8_t* scratch)
+{
+    int i;
+
+    for (i = 0; i < count; i++)
+    {
+        const uint8_t* line = plane +
+            (ptrdiff_t)(MIN(first + i, height - 1) - first) * linesize;
+
+        if (padded_width > width)
+        {
+            uint8_t* copy = scratch + (size_t)i * padded_width;
+
+            memcpy(copy, line, width);
+            memset(copy + width, line[width - 1], padded_width - width);
+            line = copy;
+        }
+        rows[i] = (JSAMPROW)line;
+    }
+}
+
+/**
+ * Hand the planes to libjpeg's raw data interface, which takes them as
+ * they are instead of converting from RGB and subsampling again
+ */
+static int
+write_image_jpeg_yuv420(FILE* outfile, const struct ImageSource* source)
+{
+    struct jpeg_compress_struct cinfo;
+    struct jpeg_error_mgr jerr;
+    JSAMPROW rows[3][YUV_ROWS];
+    JSAMPARRAY planes[3] = { rows[0], rows[1], rows[2] };
+    int chroma_width = (source->width + 1) / 2;
+    int chroma_height = (source->height + 1) / 2;
+    int padded_width[3];
+    uint8_t* scratch = NULL;
+    int i;
+
+    /* libjpeg reads complete 8x8 blocks of every plane */
+    padded_width[0] = ALIGN(source->width, 8);
+    padded_width[1] = padded_width[2] = ALIGN(chroma_width, 8);
+    for (i = 0; i < 3; i++)
+    {
+        if (padded_width[i] > (i ? chroma_width : source->width) && !scratch)
+        {
+            scratch = (uint8_t *)malloc(
+                    (size_t)YUV_ROWS * (padded_width[0] + padded_width[1] * 2));
+            return_if(scratch == NULL, -1);
+        }
+    }
+
+    cinfo.err = jpeg_std_error(&jerr);
+    setup_jpeg(&cinfo, outfile, source->width, source->height, JCS_YCbCr);
+    jpeg_set_colorspace(&cinfo, JCS_YCbCr);
+    cinfo.raw_data_in = TRUE;
+#if JPEG_LIB_VERSION >= 70
+    cinfo.do_fancy_downsampling = FALSE;
+#endif
+    cinfo.comp_info[0].h_samp_factor = 2;
+    cinfo.comp_info[0].v_samp_factor = 2;
+    for (i = 1; i < 3; i++)
+    {
+        cinfo.comp_info[i].h_samp_factor = 1;
+        cinfo.comp_info[i].v_samp_factor = 1;
+    }
+
+    jpeg_start_compress(&cinfo, TRUE);
+    while (cinfo.next_scanline < cinfo.image_height)
+    {
+        int line = cinfo.next_scanline;
+        struct YuvImage lines;
+
+        if (source_lines(source, line,
+                    MIN(YUV_ROWS, source->height - line), &lines) < 0)
+        {
+            jpeg_destroy_compress(&cinfo);
+            free(scratch);
+            return -1;
+        }
+
+        setup_plane_rows(rows[0], YUV_ROWS, lines.planes[0],
+                lines.linesizes[0], line, source->width, source->height,
+                padded_width[0], scratch);
+        for (i = 1; i < 3; i++)
+        {
+            setup_plane_rows(rows[i], YUV_ROWS / 2, lines.planes[i],
+                    lines.linesizes[i], line / 2, chroma_width,
+                    chroma_height, padded_width[i],
+                    scratch ? scratch + (size_t)YUV_ROWS *
+                    (padded_width[0] + (i - 1) * padded_width[1]) : NULL);
+        }
+        (void)jpeg_write_raw_data(&cinfo, planes, YUV_ROWS);
+    }
+    jpeg_finish_compress(&cinfo);
+
+    jpeg_destroy_compress(&cinfo);
+    free(scratch);
+
+    return 0;
+}
 #endif
 
 static int
-save_image_ppm(const char* filename, uint8_t* rgb_buffer, int width, int height)
+write_image_ppm(FILE* file, const struct ImageSource* source)
 {
-    FILE* file;
     int line;
-    
-    file = fopen(filename, "wb");
-    return_if(NULL == file, -1);
+    int count;
 
     /* write file header */
-    fprintf(file, "P6\n%d %d\n255\n", width, height);
+    fprintf(file, "P6\n%d %d\n255\n", source->width, source->height);
 
     /* dump rgb data */
-    for (line = 0; line < height; ++line)
+    for (line = 0; line < source->height; line += count)
     {
-        fwrite(rgb_buffer + line * width * 3, 1, width * 3, file);
+        struct YuvImage lines;
+        int i;
+
+        count = MIN(IMAGE_BAND_LINES, source->height - line);
+        return_if(source_lines(source, line, count, &lines) < 0, -1);
+        for (i = 0; i < count; i++)
+        {
+            fwrite(lines.planes[0] + (size_t)i * lines.linesizes[0], 1,
+                    source->width * 3, file);
+        }
     }
 
-    fclose(file);
     return 0;
 }
 
-int
-image_save(const char* filename, uint8_t* rgb_buffer, int width, int height, enum ImageFormat format)
+static int
+write_image(FILE* file, const struct ImageSource* source,
+        enum ImageFormat format)
 {
-    return_if(NULL == rgb_buffer, -1);
-    return_if(NULL == filename, -1);
-
     switch (format)
     {
         case IMAGE_FORMAT_PPM:
-            return save_image_ppm(filename, rgb_buffer, width, height);
+            return_if(source_is_yuv420(source), -1);
+            return write_image_ppm(file, source);
 #ifdef HAVE_JPEG
         case IMAGE_FORMAT_JPEG:
-            return save_image_jpeg(filename, rgb_buffer, width, height);
+            if (source_is_yuv420(source))
+            {
+                return write_image_jpeg_yuv420(file, source);
+            }
+            return write_image_jpeg(file, source);
 #endif
         default:
             fprintf(stderr, "Unsupported image format %d\n", format);
             return -1;
     }
+}
+
+static int
+encode_source(const struct ImageSource* source, enum ImageFormat format,
+        uint8_t** data, size_t* size)
+{
+    FILE* stream;
+    char* buffer = NULL;
+    size_t length = 0;
+    uint64_t start = STATS_START();
+    int result;
+
+    return_if(NULL == data || NULL == size, -1);
+    return_if(format < 0 || format >= IMAGE_FORMAT_COUNT, -1);
+
+    stream = open_memstream(&buffer, &length);
+    return_if(NULL == stream, -1);
+
+    result = write_image(stream, source, format);
+    if (fclose(stream) != 0)
+    {
+        result = -1;
+    }
+    STATS_STOP(STATS_PHASE_ENCODE, start);
+
+    if (result < 0)
+    {
+        free(buffer);
+        return -1;
+    }
+
+    *data = (uint8_t *)buffer;
+    *size = length;
 
     return 0;
 }
 
+static int
+save_source(const char* filename, const struct ImageSource* source,
+        enum ImageFormat format)
+{
+    FILE* file;
+    uint8_t* data = NULL;
+    size_t size = 0;
+    uint64_t start;
+    int result;
+
+    return_if(NULL == filename, -1);
+    return_if(format < 0 || format >= IMAGE_FORMAT_COUNT, -1);
+
+    /* while statistics are collected, encode into memory first so encoding
+     * and disk time can be told apart */
+    if (stats_current)
+    {
+        return_if(encode_source(source, format, &data, &size) < 0, -1);
+    }
+
+    start = STATS_START();
+    file = fopen(filename, "wb");
+    if (NULL == file)
+    {
+        free(data);
+        return -1;
+    }
+
+    if (data)
+    {
+        result = fwrite(data, size, 1, file) == 1 ? 0 : -1;
+    }
+    else
+    {
+        result = write_image(file, source, format);
+    }
+    if (fclose(file) != 0)
+    {
+        result = -1;
+    }
+    STATS_STOP(STATS_PHASE_WRITE, start);
+    STATS_COUNT(STATS_BYTES_WRITTEN, size);
+    free(data);
+
+    return result;
+}
+
+int
+image_save(const char* filename, uint8_t* rgb_buffer, int width, int height, enum ImageFormat format)
+{
+    struct ImageSource source = { rgb_buffer, NULL, width, height, NULL };
+
+    return_if(NULL == rgb_buffer, -1);
+
+    return save_source(filename, &source, format);
+}
+
+int
+image_encode(uint8_t* rgb_buffer, int width, int height, enum ImageFormat format,
+        uint8_t** data, size_t* size)
+{
+    struct ImageSource source = { rgb_buffer, NULL, width, height, NULL };
+
+    return_if(NULL == rgb_buffer, -1);
+
+    return encode_source(&source, format, data, size);
+}
+
+int
+image_save_yuv420(const char* filename, const struct YuvImage* image,
+        enum ImageFormat format)
+{
+    struct ImageSource source = { NULL, image, 0, 0, NULL };
+
+    return_if(NULL == image, -1);
+    return_if(!image_supports_yuv420(format), -1);
+
+    source.width = image->width;
+    source.height = image->height;
+
+    return save_source(filename, &source, format);
+}
+
+int
+image_encode_yuv420(const struct YuvImage* image, enum ImageFormat format,
+        uint8_t** data, size_t* size)
+{
+    struct ImageSource source = { NULL, image, 0, 0, NULL };
+
+    return_if(NULL == image, -1);
+    return_if(!image_supports_yuv420(format), -1);
+
+    source.width = image->width;
+    source.height = image->height;
+
+    return encode_source(&source, format, data, size);
+}
+
+int
+image_save_bands(const char* filename, const struct ImageBands* bands,
+        enum ImageFormat format)
+{
+    struct ImageSource source = { NULL, NULL, 0, 0, bands };
+
+    return_if(NULL == bands, -1);
+    return_if(bands->yuv420 && !image_supports_yuv420(format), -1);
+
+    source.width = bands->width;
+    source.height = bands->height;
+
+    return save_source(filename, &source, format);
+}
+
+int
+image_encode_bands(const struct ImageBands* bands, enum ImageFormat format,
+        uint8_t** data, size_t* size)
+{
+    struct ImageSource source = { NULL, NULL, 0, 0, bands };
+
+    return_if(NULL == bands, -1);
+    return_if(bands->yuv420 && !image_supports_yuv420(format), -1);
+
+    source.width = bands->width;
+    source.height = bands->height;
+
+    return encode_source(&source, format, data, size);
+}
+
+int
+image_supports_yuv420(enum ImageFormat format)
+{
+#ifdef HAVE_JPEG
+    return format == IMAGE_FORMAT_JPEG;
+#else
+    return 0;
+#endif
+}
+
+size_t
+image_yuv420_layout(struct YuvImage* image, uint8_t* buffer,
+        int width, int height)
+{
+    size_t luma_size;
+    size_t chroma_size;
+
+    image->width = width;
+    image->height = height;
+    image->linesizes[0] = ALIGN(width, YUV_ALIGN);
+    image->linesizes[1] = image->linesizes[2] =
+        ALIGN((width + 1) / 2, YUV_ALIGN);
+
+    luma_size = (size_t)image->linesizes[0] * height;
+    chroma_size = (size_t)image->linesizes[1] * ((height + 1) / 2);
+
+    image->planes[0] = buffer;
+    image->planes[1] = buffer ? buffer + luma_size : NULL;
+    image->planes[2] = buffer ? buffer + luma_size + chroma_size : NULL;
+
+    return luma_size + 2 * chroma_size;
+}
+
 char *
 image_get_suffix(enum ImageFormat image_format)
 {
@@ -130,6 +518,22 @@ image_get_suffix(enum ImageFormat image_format)
     }
 }
 
+char *
+image_get_mime_type(enum ImageFormat image_format)
+{
+    switch (image_format)
+    {
+        case IMAGE_FORMAT_PPM:
+            return "image/x-portable-pixmap";
+#ifdef HAVE_JPEG
+        case IMAGE_FORMAT_JPEG:
+            return "image/jpeg";
+#endif
+        default:
+            return "application/octet-stream";
+    }
+}
+
 enum ImageFormat
 image_get_format(const char* format)
 {
@@ -19,6 +19,7 @@
 #ifndef __IMAGE_H
 #define __IMAGE_H
 
+#include <stddef.h>
 #include <stdint.h>
 
 enum ImageFormat
@@ -43,9 +44,157 @@ enum ImageFormat
     IMAGE_FORMAT_COUNT
 };
 
+/**
+ * A picture in planar, full range (JPEG) YCbCr 4:2:0 as produced by the
+ * decoder for most video codecs. Chroma planes are (width + 1) / 2 x
+ * (height + 1) / 2 samples.
+ */
+struct YuvImage
+{
+    /** Y, Cb and Cr plane */
+    uint8_t* planes[3];
+    /** distance between two lines of each plane in bytes */
+    int linesizes[3];
+    int width;
+    int height;
+};
+
+/** Most lines #ImageBandsFunc is asked for at once, one row of MCUs */
+#define IMAGE_BAND_LINES 16
+
+/**
+ * Provide the lines first to first + count - 1 of a picture. Lines are
+ * asked for from top to bottom and lines before first are never asked for
+ * again, so they may be dropped.
+ *
+ * @param data ImageBands::data
+ * @param first first line wanted; even for YCbCr 4:2:0
+ * @param count number of lines, at most #IMAGE_BAND_LINES
+ * @param lines planes pointing at line first, for YCbCr 4:2:0 with chroma
+ * planes at line first / 2 up to the chroma line of the last line. RGB
+ * uses the first plane only.
+ * @return 0 on success
+ */
+typedef int (*ImageBandsFunc)(void* data, int first, int count,
+        struct YuvImage* lines);
+
+/**
+ * A picture that is produced a band of lines at a time while it is
+ * encoded, so it never has to be held in memory as a whole
+ */
+struct ImageBands
+{
+    int width;
+    int height;
+    /** 1 for YCbCr 4:2:0 lines as in #YuvImage, 0 for RGB24 */
+    int yuv420;
+    ImageBandsFunc read;
+    void* data;
+};
+
 int
 image_save(const char* filename, uint8_t* rgb_buffer, int width, int height, enum ImageFormat format);
 
+/**
+ * Encode an RGB buffer into memory instead of a file.
+ *
+ * @param rgb_buffer width * height * 3 bytes of RGB data
+ * @param width of picture
+ * @param height of picture
+ * @param format a member of #ImageFormat
+ * @param data set to the encoded image; release it with free()
+ * @param size set to the number of bytes in data
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+image_encode(uint8_t* rgb_buffer, int width, int height, enum ImageFormat format,
+        uint8_t** data, size_t* size);
+
+/**
+ * Write a YCbCr 4:2:0 picture without converting it to RGB. Only formats
+ * for which #image_supports_yuv420 is true can be written this way.
+ *
+ * @param filename name of the image file
+ * @param image the picture
+ * @param format a member of #ImageFormat
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+image_save_yuv420(const char* filename, const struct YuvImage* image,
+        enum ImageFormat format);
+
+/**
+ * Same as #image_save_yuv420, encoding into memory like #image_encode.
+ *
+ * @param image the picture
+ * @param format a member of #ImageFormat
+ * @param data set to the encoded image; release it with free()
+ * @param size set to the number of bytes in data
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+image_encode_yuv420(const struct YuvImage* image, enum ImageFormat format,
+        uint8_t** data, size_t* size);
+
+/**
+ * Check whether a format can be written from YCbCr 4:2:0 directly. This is
+ * the case for JPEG, which stores the planes as they are.
+ *
+ * @param format a member of #ImageFormat
+ * @return 1 if #image_save_yuv420 supports format, 0 otherwise
+ * \ingroup image
+ */
+int
+image_supports_yuv420(enum ImageFormat format);
+
+/**
+ * Write a picture whose lines are produced while it is encoded. The result
+ * is the same as writing the whole picture with #image_save or
+ * #image_save_yuv420.
+ *
+ * @param filename name of the image file
+ * @param bands source of the lines, read once from top to bottom
+ * @param format a member of #ImageFormat; YCbCr 4:2:0 sources need one for
+ * which #image_supports_yuv420 is true
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+image_save_bands(const char* filename, const struct ImageBands* bands,
+        enum ImageFormat format);
+
+/**
+ * Same as #image_save_bands, encoding into memory like #image_encode.
+ *
+ * @param bands source of the lines, read once from top to bottom
+ * @param format a member of #ImageFormat
+ * @param data set to the encoded image; release it with free()
+ * @param size set to the number of bytes in data
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+image_encode_bands(const struct ImageBands* bands, enum ImageFormat format,
+        uint8_t** data, size_t* size);
+
+/**
+ * Lay out the planes of a YCbCr 4:2:0 picture in one buffer with aligned
+ * lines.
+ *
+ * @param image set up to point into buffer
+ * @param buffer memory for the planes or NULL to compute the size only
+ * @param width of picture
+ * @param height of picture
+ * @return number of bytes needed for buffer
+ * \ingroup image
+ */
+size_t
+image_yuv420_layout(struct YuvImage* image, uint8_t* buffer,
+        int width, int height);
+
 /**
  * Map a member of #ImageFormat to a file suffix
  * 
@@ -56,6 +205,16 @@ image_save(const char* filename, uint8_t* rgb_buffer, int width, int height, enu
 char *
 image_get_suffix(enum ImageFormat image_format);
 
+/**
+ * Map a member of #ImageFormat to a MIME type
+ *
+ * @param image_format a member of #ImageFormat
+ * @return MIME type of the format
+ * \ingroup image
+ */
+char *
+image_get_mime_type(enum ImageFormat image_format);
+
 /**
  * Translate a textual image format representation to an
  * member of #ImageFormat
@@ -0,0 +1,382 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "index.h"
+#include "util.h"
+
+#define INDEX_MAGIC "TNIX"
+#define INDEX_VERSION 2
+
+/** Number of bytes at the start of a file that are hashed */
+#define HEAD_SIZE (64 * 1024)
+
+#define FNV_OFFSET 14695981039346656037ULL
+#define FNV_PRIME 1099511628211ULL
+
+/** Numbers the temporary files of #seek_index_save, which several threads
+ * may call for the same index at once */
+static unsigned int save_sequence;
+
+static uint64_t
+fnv1a(uint64_t hash, const uint8_t* data, size_t size)
+{
+    size_t i;
+
+    for (i = 0; i < size; i++)
+    {
+        hash ^= data[i];
+        hash *= FNV_PRIME;
+    }
+
+    return hash;
+}
+
+/**
+ * Fill in size, modification time and head hash of a file
+ */
+static int
+get_identity(const char* filename, struct IndexHeader* header)
+{
+    struct stat st;
+    uint8_t* head;
+    ssize_t bytes;
+    int fd;
+
+    fd = open(filename, O_RDONLY);
+    return_if(fd < 0, -1);
+
+    if (fstat(fd, &st) < 0 || !S_ISREG(st.st_mode))
+    {
+        close(fd);
+        return -1;
+    }
+
+    head = (uint8_t *)malloc(HEAD_SIZE);
+    if (!head)
+    {
+        close(fd);
+        return -1;
+    }
+
+    bytes = read(fd, head, HEAD_SIZE);
+    close(fd);
+
+    header->file_size = st.st_size;
+    header->mtime = st.st_mtime;
+    header->head_hash = fnv1a(FNV_OFFSET, head, bytes > 0 ? bytes : 0);
+    free(head);
+
+    return bytes < 0 ? -1 : 0;
+}
+
+struct SeekIndex*
+seek_index_new(const char* filename)
+{
+    struct SeekIndex* index;
+
+    return_if(filename == NULL, NULL);
+
+    index = (struct SeekIndex *)calloc(1, sizeof(struct SeekIndex));
+    return_if(index == NULL, NULL);
+    index->refs = 1;
+
+    memcpy(index->header.magic, INDEX_MAGIC, 4);
+    index->header.version = INDEX_VERSION;
+
+    if (get_identity(filename, &(index->header)) < 0)
+    {
+        free(index);
+        return NULL;
+    }
+
+    return index;
+}
+
+int
+seek_index_add(struct SeekIndex* index, int64_t pts, int64_t pos)
+{
+    struct IndexEntry* entry;
+    int64_t time = pts;
+
+    return_if(index == NULL, -1);
+    return_if(index->map != NULL, -1);
+
+    if ((int)index->header.count == index->capacity)
+    {
+        int capacity = index->capacity ? index->capacity * 2 : 256;
+        struct IndexEntry* entries = (struct IndexEntry *)realloc(
+                index->entries, capacity * sizeof(struct IndexEntry));
+
+        return_if(entries == NULL, -1);
+        index->entries = entries;
+        index->capacity = capacity;
+    }
+
+    if (index->header.count > 0)
+    {
+        const struct IndexEntry* last =
+            &(index->entries[index->header.count - 1]);
+
+        return_if(pos <= last->pos, 0);
+
+        if (pts > last->pts)
+        {
+            time = last->time + (pts - last->pts);
+        }
+        else if (index->header.count > 1)
+        {
+            /* a wrap or discontinuity, guess the length of the last GOP */
+            time = last->time + MAX(last->time - last[-1].time, 1);
+        }
+        else
+        {
+            time = last->time + 1;
+        }
+    }
+
+    entry = &(index->entries[index->header.count]);
+    entry->pts = pts;
+    entry->pos = pos;
+    entry->time = time;
+    index->header.count++;
+
+    return 0;
+}
+
+int
+seek_index_get_path(const char* filename, const char* cache_dir,
+        char* path, size_t size)
+{
+    struct IndexHeader header;
+    uint64_t key;
+    int written;
+
+    return_if(filename == NULL, -1);
+    return_if(path == NULL, -1);
+
+    if (cache_dir == NULL)
+    {
+        written = snprintf(path, size, "%s.tnidx", filename);
+    }
+    else
+    {
+        return_if(get_identity(filename, &header) < 0, -1);
+
+        key = fnv1a(header.head_hash, (const uint8_t *)&(header.file_size),
+                sizeof(header.file_size));
+        key = fnv1a(key, (const uint8_t *)&(header.mtime),
+                sizeof(header.mtime));
+        written = snprintf(path, size, "%s/%016llx.tnidx", cache_dir,
+                (unsigned long long)key);
+    }
+
+    return written < 0 || (size_t)written >= size ? -1 : 0;
+}
+
+struct SeekIndex*
+seek_index_load(const char* path, const char* filename)
+{
+    struct SeekIndex* index;
+    struct IndexHeader identity;
+    struct IndexHeader* header;
+    struct stat st;
+    void* map;
+    int fd;
+
+    return_if(path == NULL, NULL);
+    return_if(filename == NULL, NULL);
+
+    fd = open(path, O_RDONLY);
+    return_if(fd < 0, NULL);
+
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(struct IndexHeader))
+    {
+        close(fd);
+        return NULL;
+    }
+
+    map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return_if(map == MAP_FAILED, NULL);
+
+    header = (struct IndexHeader *)map;
+    if (memcmp(header->magic, INDEX_MAGIC, 4) != 0 ||
+        header->version != INDEX_VERSION ||
+        sizeof(struct IndexHeader) + (size_t)header->count *
+            sizeof(struct IndexEntry) != (size_t)st.st_size ||
+        get_identity(filename, &identity) < 0 ||
+        identity.file_size != header->file_size ||
+        identity.mtime != header->mtime ||
+        identity.head_hash != header->head_hash)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    index = (struct SeekIndex *)calloc(1, sizeof(struct SeekIndex));
+    if (!index)
+    {
+        munmap(map, st.st_size);
+        return NULL;
+    }
+
+    index->header = *header;
+    index->entries = (struct IndexEntry *)(header + 1);
+    index->map = map;
+    index->map_size = st.st_size;
+    index->refs = 1;
+
+    return index;
+}
+
+int
+seek_index_save(struct SeekIndex* index, const char* path)
+{
+    char tmp_path[1024];
+    FILE* f;
+    int ok;
+
+    return_if(index == NULL, -1);
+    return_if(path == NULL, -1);
+
+    return_if(make_prefix_directories(path) < 0, -1);
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.%u", path, (int)getpid(),
+            __atomic_fetch_add(&save_sequence, 1, __ATOMIC_RELAXED));
+
+    f = fopen(tmp_path, "wb");
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open file %s:%d\n", tmp_path, errno);
+        return -1;
+    }
+
+    ok = fwrite(&(index->header), sizeof(struct IndexHeader), 1, f) == 1 &&
+        fwrite(index->entries, sizeof(struct IndexEntry),
+                index->header.count, f) == index->header.count;
+    ok = (fclose(f) == 0) && ok;
+
+    if (!ok || rename(tmp_path, path) < 0)
+    {
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+const struct IndexEntry*
+seek_index_find(const struct SeekIndex* index, int64_t time)
+{
+    uint32_t low = 0;
+    uint32_t high;
+
+    return_if(index == NULL, NULL);
+    return_if(index->header.count == 0, NULL);
+
+    /* last entry with entry.time <= time */
+    high = index->header.count;
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+
+        if (index->entries[middle].time <= time)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+
+    return &(index->entries[low]);
+}
+
+int64_t
+seek_index_time(const struct SeekIndex* index, int64_t pts, int64_t pos)
+{
+    const struct IndexEntry* entry;
+    uint32_t low = 0;
+    uint32_t high;
+
+    return_if(index == NULL, pts);
+    return_if(index->header.count == 0, pts);
+
+    /* last entry with entry.pos <= pos */
+    high = index->header.count;
+    while (high - low > 1)
+    {
+        uint32_t middle = low + (high - low) / 2;
+
+        if (index->entries[middle].pos <= pos)
+        {
+            low = middle;
+        }
+        else
+        {
+            high = middle;
+        }
+    }
+    entry = &(index->entries[low]);
+
+    /* with frame reordering, the last frames of a GOP are only complete
+     * after the next keyframe has been read; they belong to the keyframe
+     * closer in pts, which makes a difference at a discontinuity */
+    if (low > 0 && llabs(pts - entry[-1].pts) < llabs(pts - entry->pts))
+    {
+        entry--;
+    }
+
+    return entry->time + (pts - entry->pts);
+}
+
+struct SeekIndex*
+seek_index_ref(struct SeekIndex* index)
+{
+    return_if(index == NULL, NULL);
+
+    __atomic_add_fetch(&(index->refs), 1, __ATOMIC_RELAXED);
+
+    return index;
+}
+
+void
+seek_index_free(struct SeekIndex* index)
+{
+    return_if(index == NULL,);
+    return_if(__atomic_sub_fetch(&(index->refs), 1, __ATOMIC_ACQ_REL) > 0,);
+
+    if (index->map)
+    {
+        munmap(index->map, index->map_size);
+    }
+    else
+    {
+        free(index->entries);
+    }
+    free(index);
+}
@@ -0,0 +1,187 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __INDEX_H
+#define __INDEX_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * Position of a keyframe in the video stream
+ */
+struct IndexEntry
+{
+    /** presentation time stamp in stream time base units */
+    int64_t pts;
+
+    /** byte offset of the packet in the file */
+    int64_t pos;
+
+    /** pts on a timeline that never goes backwards, which differs from pts
+     * after a timestamp wrap or discontinuity, see #seek_index_add */
+    int64_t time;
+};
+
+/**
+ * Header of an index file. The file consists of this header followed by
+ * IndexHeader::count #IndexEntry records in file order, in host byte order.
+ */
+struct IndexHeader
+{
+    char magic[4];
+    uint32_t version;
+
+    /* identity of the indexed file */
+    uint64_t file_size;
+    int64_t mtime;
+    uint64_t head_hash;
+
+    /* video stream parameters */
+    int32_t stream_index;
+    int32_t codec_id;
+    int32_t width;
+    int32_t height;
+    int32_t time_base_num;
+    int32_t time_base_den;
+    int64_t duration;
+
+    uint32_t count;
+    uint32_t reserved;
+};
+
+/**
+ * Keyframe index of a video file, either memory-mapped from disk or built in
+ * memory
+ */
+struct SeekIndex
+{
+    struct IndexHeader header;
+    struct IndexEntry* entries;
+
+    /* private */
+    void* map;
+    size_t map_size;
+    int capacity;
+    int refs;
+};
+
+/**
+ * Create an empty index for a file; the identity of the file is filled in.
+ *
+ * @param filename name of the indexed video file
+ * @return a new #SeekIndex or NULL on error
+ * \ingroup video
+ */
+struct SeekIndex*
+seek_index_new(const char* filename);
+
+/**
+ * Append a keyframe. Entries have to be added in file order. Where the pts
+ * repeats or goes backwards, e.g. at a timestamp wrap of an MPEG transport
+ * stream, the timeline of IndexEntry::time continues one GOP after the last
+ * keyframe, so the index still covers the whole file.
+ *
+ * @param index a #SeekIndex created with #seek_index_new
+ * @param pts presentation time stamp of the keyframe
+ * @param pos byte offset of the keyframe packet
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+seek_index_add(struct SeekIndex* index, int64_t pts, int64_t pos);
+
+/**
+ * Find the index file of a video file. Index files are named after the
+ * identity of the video file (size, modification time and a hash of its
+ * first bytes), so a changed file never matches a stale index.
+ *
+ * @param filename name of the video file
+ * @param cache_dir directory holding index files or NULL to use a sidecar
+ * file next to the video
+ * @param path buffer receiving the name of the index file
+ * @param size size of path
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+seek_index_get_path(const char* filename, const char* cache_dir,
+        char* path, size_t size);
+
+/**
+ * Memory-map an index file, checking that it still matches the video file.
+ *
+ * @param path name of the index file
+ * @param filename name of the video file
+ * @return a #SeekIndex or NULL if there is no valid index
+ * \ingroup video
+ */
+struct SeekIndex*
+seek_index_load(const char* path, const char* filename);
+
+/**
+ * Write an index to disk. The file is written under a temporary name and
+ * renamed, so concurrent readers never see a partial index.
+ *
+ * @param index a #SeekIndex
+ * @param path name of the index file
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+seek_index_save(struct SeekIndex* index, const char* path);
+
+/**
+ * Find the last keyframe at or before a position.
+ *
+ * @param index a #SeekIndex
+ * @param time target position on the timeline of IndexEntry::time
+ * @return the keyframe entry, the first keyframe if time lies before it or
+ * NULL if the index is empty
+ * \ingroup video
+ */
+const struct IndexEntry*
+seek_index_find(const struct SeekIndex* index, int64_t time);
+
+/**
+ * Map the pts of a frame onto the timeline of IndexEntry::time.
+ *
+ * @param index a #SeekIndex
+ * @param pts presentation time stamp of the frame
+ * @param pos byte offset of the packet completing the frame
+ * @return the position of the frame on the timeline, pts if the index is
+ * empty
+ * \ingroup video
+ */
+int64_t
+seek_index_time(const struct SeekIndex* index, int64_t pts, int64_t pos);
+
+/**
+ * Take another reference to an index, e.g. for a second decoder of the
+ * same file. Every reference is given up with #seek_index_free.
+ *
+ * @param index a #SeekIndex
+ * @return index
+ * \ingroup video
+ */
+struct SeekIndex*
+seek_index_ref(struct SeekIndex* index);
+
+void
+seek_index_free(struct SeekIndex* index);
+#endif /* __INDEX_H */
@@ -0,0 +1,248 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef AVCODEC_NEW_INCLUDE
+#   include <libavutil/avutil.h>
+#else
+#   include <avutil.h>
+#endif
+
+#include "input.h"
+#include "util.h"
+
+/** Size of a read in buffered mode */
+#define INPUT_BUFFER_SIZE (1024 * 1024)
+
+/** Size of the I/O context buffer for mapped files, which only copies */
+#define INPUT_MAP_BUFFER_SIZE (64 * 1024)
+
+struct FileInput
+{
+    int fd;
+    int64_t size;
+    int64_t position;
+    /** the whole file, NULL in buffered mode */
+    uint8_t* map;
+    AVIOContext* context;
+};
+
+static int
+read_packet(void* opaque, uint8_t* buffer, int size)
+{
+    struct FileInput* input = (struct FileInput *)opaque;
+    int64_t left = input->size - input->position;
+    ssize_t count;
+
+    return_if(left <= 0, AVERROR_EOF);
+
+    if (input->map)
+    {
+        count = MIN(left, size);
+        memcpy(buffer, input->map + input->position, count);
+    }
+    else
+    {
+        do
+        {
+            count = pread(input->fd, buffer, size, input->position);
+        } while (count < 0 && errno == EINTR);
+        return_if(count < 0, AVERROR(errno));
+        return_if(count == 0, AVERROR_EOF);
+    }
+    input->position += count;
+
+    return count;
+}
+
+static int64_t
+seek(void* opaque, int64_t offset, int whence)
+{
+    struct FileInput* input = (struct FileInput *)opaque;
+
+    switch (whence & ~AVSEEK_FORCE)
+    {
+        case AVSEEK_SIZE:
+            return input->size;
+        case SEEK_SET:
+            break;
+        case SEEK_CUR:
+            offset += input->position;
+            break;
+        case SEEK_END:
+            offset += input->size;
+            break;
+        default:
+            return AVERROR(EINVAL);
+    }
+    return_if(offset < 0, AVERROR(EINVAL));
+
+    input->position = offset;
+
+    return offset;
+}
+
+struct FileInput*
+file_input_open(const char* filename, enum InputMode mode)
+{
+    struct FileInput* input;
+    struct stat info;
+    uint8_t* buffer;
+    int buffer_size = INPUT_BUFFER_SIZE;
+
+    return_if(filename == NULL, NULL);
+    return_if(mode != INPUT_MODE_BUFFERED && mode != INPUT_MODE_MMAP, NULL);
+
+    input = (struct FileInput *)calloc(1, sizeof(struct FileInput));
+    return_if(input == NULL, NULL);
+
+    input->fd = open(filename, O_RDONLY);
+    if (input->fd < 0 || fstat(input->fd, &info) < 0)
+    {
+        file_input_close(input);
+        return NULL;
+    }
+    input->size = info.st_size;
+
+    if (mode == INPUT_MODE_MMAP && input->size > 0 &&
+            (uint64_t)input->size <= SIZE_MAX)
+    {
+        void* map = mmap(NULL, input->size, PROT_READ, MAP_SHARED,
+                input->fd, 0);
+
+        if (map != MAP_FAILED)
+        {
+            input->map = (uint8_t *)map;
+            buffer_size = INPUT_MAP_BUFFER_SIZE;
+        }
+        else
+        {
+            LOG(WARNING, "Cannot map %s, reading it instead", filename);
+        }
+    }
+
+    /* libav may replace the buffer, so it has to come from av_malloc */
+    buffer = (uint8_t *)av_malloc(buffer_size);
+    if (buffer)
+    {
+        input->context = avio_alloc_context(buffer, buffer_size, 0, input,
+                read_packet, NULL, seek);
+        if (!input->context)
+        {
+            av_free(buffer);
+        }
+    }
+
+    if (!input->context)
+    {
+        file_input_close(input);
+        return NULL;
+    }
+
+    return input;
+}
+
+AVIOContext*
+file_input_get_context(struct FileInput* input)
+{
+    return_if(input == NULL, NULL);
+
+    return input->context;
+}
+
+int64_t
+file_input_get_size(struct FileInput* input)
+{
+    return_if(input == NULL, -1);
+
+    return input->size;
+}
+
+void
+file_input_prefetch(struct FileInput* input, int64_t offset, int64_t length)
+{
+    if (!input)
+    {
+        return;
+    }
+
+    offset = MAX(offset, 0);
+    length = MIN(length, input->size - offset);
+    if (length > 0)
+    {
+        /* asynchronous; works for mapped files as well, as both go through
+         * the page cache */
+        posix_fadvise(input->fd, offset, length, POSIX_FADV_WILLNEED);
+    }
+}
+
+void
+file_input_close(struct FileInput* input)
+{
+    if (!input)
+    {
+        return;
+    }
+
+    if (input->context)
+    {
+        av_free(input->context->buffer);
+        av_free(input->context);
+    }
+
+    if (input->map)
+    {
+        munmap(input->map, input->size);
+    }
+
+    if (input->fd >= 0)
+    {
+        close(input->fd);
+    }
+
+    free(input);
+}
+
+int
+input_mode_from_string(const char* name)
+{
+    return_if(name == NULL, -1);
+
+    if (!strcmp(name, "default"))
+    {
+        return INPUT_MODE_DEFAULT;
+    }
+    else if (!strcmp(name, "buffered"))
+    {
+        return INPUT_MODE_BUFFERED;
+    }
+    else if (!strcmp(name, "mmap"))
+    {
+        return INPUT_MODE_MMAP;
+    }
+
+    return -1;
+}
@@ -0,0 +1,110 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __INPUT_H
+#define __INPUT_H
+
+#include <stdint.h>
+
+#ifdef AVCODEC_NEW_INCLUDE
+#   include <libavformat/avio.h>
+#else
+#   include <avio.h>
+#endif
+
+enum InputMode
+{
+    /** libav's own file protocol; text representation is <tt>default</tt> */
+    INPUT_MODE_DEFAULT = 0,
+    /**
+     * Reads of 1 MiB, so every seek costs one large read instead of many
+     * small ones; text representation is <tt>buffered</tt>
+     */
+    INPUT_MODE_BUFFERED,
+    /** The file is memory-mapped; text representation is <tt>mmap</tt> */
+    INPUT_MODE_MMAP
+};
+
+struct FileInput;
+
+/**
+ * Open a file for reading through a custom AVIOContext. If the file cannot
+ * be mapped, it is read in buffered mode instead.
+ *
+ * @param filename name of the file
+ * @param mode #INPUT_MODE_BUFFERED or #INPUT_MODE_MMAP
+ * @return a new #FileInput or NULL on error
+ * \ingroup video
+ */
+struct FileInput*
+file_input_open(const char* filename, enum InputMode mode);
+
+/**
+ * Get the I/O context to put into AVFormatContext::pb before opening the
+ * file with avformat_open_input.
+ *
+ * @param input a #FileInput
+ * @return the I/O context owned by input
+ * \ingroup video
+ */
+AVIOContext*
+file_input_get_context(struct FileInput* input);
+
+/**
+ * Get the size of the file.
+ *
+ * @param input a #FileInput
+ * @return size in bytes
+ * \ingroup video
+ */
+int64_t
+file_input_get_size(struct FileInput* input);
+
+/**
+ * Ask the kernel to start reading a byte range into the page cache in the
+ * background, so a later seek into it does not wait for the disk.
+ *
+ * @param input a #FileInput
+ * @param offset first byte of the range
+ * @param length number of bytes
+ * \ingroup video
+ */
+void
+file_input_prefetch(struct FileInput* input, int64_t offset, int64_t length);
+
+/**
+ * Close the file and free the I/O context. The AVFormatContext using it
+ * has to be closed before.
+ *
+ * @param input a #FileInput
+ * \ingroup video
+ */
+void
+file_input_close(struct FileInput* input);
+
+/**
+ * Translate a textual input mode representation to a member of
+ * #InputMode
+ *
+ * @param name textual representation, @see #InputMode
+ * @return a member of #InputMode or -1 if the name is unknown
+ * \ingroup video
+ */
+int
+input_mode_from_string(const char* name);
+#endif /* __INPUT_H */
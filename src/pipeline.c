@@ -0,0 +1,428 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "pipeline.h"
+#include "stats.h"
+#include "util.h"
+
+/** Queued behind the pending pictures to tell an encoder to stop */
+static struct EncodeBuffer stop_marker;
+
+struct QueueCell
+{
+    size_t sequence;
+    struct EncodeBuffer* buffer;
+};
+
+/**
+ * Bounded multi-producer multi-consumer queue. Every cell carries a
+ * sequence number telling producers and consumers whose turn it is, so
+ * neither side takes a lock.
+ */
+struct BufferQueue
+{
+    struct QueueCell* cells;
+    size_t mask;
+    size_t enqueue_pos;
+    size_t dequeue_pos;
+};
+
+struct EncodePipeline
+{
+    struct EncodeBuffer* buffers;
+    int num_buffers;
+
+    /** buffers waiting for an encoder */
+    struct BufferQueue pending;
+    sem_t pending_count;
+
+    /** buffers ready to be filled */
+    struct BufferQueue free;
+    sem_t free_count;
+
+    pthread_t* encoders;
+    int num_encoders;
+};
+
+static int
+buffer_queue_init(struct BufferQueue* queue, int min_size)
+{
+    size_t size = 2;
+    size_t i;
+
+    while (size < (size_t)min_size)
+    {
+        size *= 2;
+    }
+
+    queue->cells = (struct QueueCell *)calloc(size, sizeof(struct QueueCell));
+    return_if(queue->cells == NULL, -1);
+
+    for (i = 0; i < size; i++)
+    {
+        queue->cells[i].sequence = i;
+    }
+    queue->mask = size - 1;
+    queue->enqueue_pos = 0;
+    queue->dequeue_pos = 0;
+
+    return 0;
+}
+
+static int
+buffer_queue_push(struct BufferQueue* queue, struct EncodeBuffer* buffer)
+{
+    struct QueueCell* cell;
+    size_t pos = __atomic_load_n(&(queue->enqueue_pos), __ATOMIC_RELAXED);
+
+    while (1)
+    {
+        intptr_t diff;
+
+        cell = &(queue->cells[pos & queue->mask]);
+        diff = (intptr_t)__atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE) -
+            (intptr_t)pos;
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&(queue->enqueue_pos), &pos,
+                        pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /* full */
+            return -1;
+        }
+        else
+        {
+            pos = __atomic_load_n(&(queue->enqueue_pos), __ATOMIC_RELAXED);
+        }
+    }
+
+    cell->buffer = buffer;
+    __atomic_store_n(&(cell->sequence), pos + 1, __ATOMIC_RELEASE);
+
+    return 0;
+}
+
+/**
+ * Take the oldest entry. The caller has taken the semaphore counting the
+ * entries, so there is one, but its producer may have claimed the cell
+ * without having filled it yet; then this waits for it.
+ */
+static struct EncodeBuffer*
+buffer_queue_pop(struct BufferQueue* queue)
+{
+    struct QueueCell* cell;
+    struct EncodeBuffer* buffer;
+    size_t pos = __atomic_load_n(&(queue->dequeue_pos), __ATOMIC_RELAXED);
+
+    while (1)
+    {
+        intptr_t diff;
+
+        cell = &(queue->cells[pos & queue->mask]);
+        diff = (intptr_t)__atomic_load_n(&(cell->sequence), __ATOMIC_ACQUIRE) -
+            (intptr_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (__atomic_compare_exchange_n(&(queue->dequeue_pos), &pos,
+                        pos + 1, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED))
+            {
+                break;
+            }
+        }
+        else if (diff < 0)
+        {
+            /* not published yet */
+            sched_yield();
+            pos = __atomic_load_n(&(queue->dequeue_pos), __ATOMIC_RELAXED);
+        }
+        else
+        {
+            pos = __atomic_load_n(&(queue->dequeue_pos), __ATOMIC_RELAXED);
+        }
+    }
+
+    buffer = cell->buffer;
+    __atomic_store_n(&(cell->sequence), pos + queue->mask + 1,
+            __ATOMIC_RELEASE);
+
+    return buffer;
+}
+
+static void
+semaphore_wait(sem_t* semaphore)
+{
+    while (sem_wait(semaphore) < 0 && errno == EINTR)
+    {
+    }
+}
+
+static void*
+encoder_run(void* data)
+{
+    struct EncodePipeline* pipeline = (struct EncodePipeline *)data;
+    struct EncodeBuffer* buffer;
+
+    while (1)
+    {
+        int result;
+
+        semaphore_wait(&(pipeline->pending_count));
+        buffer = buffer_queue_pop(&(pipeline->pending));
+
+        if (buffer == &stop_marker)
+        {
+            break;
+        }
+
+        stats_set_current(buffer->stats);
+        if (buffer->yuv.planes[0] && buffer->sink)
+        {
+            result = output_sink_write_yuv420(buffer->sink, buffer->filename,
+                    &(buffer->yuv), buffer->format);
+        }
+        else if (buffer->yuv.planes[0])
+        {
+            result = image_save_yuv420(buffer->filename, &(buffer->yuv),
+                    buffer->format);
+        }
+        else if (buffer->sink)
+        {
+            result = output_sink_write_image(buffer->sink, buffer->filename,
+                    buffer->data, buffer->width, buffer->height,
+                    buffer->format);
+        }
+        else
+        {
+            result = image_save(buffer->filename, buffer->data,
+                    buffer->width, buffer->height, buffer->format);
+        }
+        stats_set_current(NULL);
+        if (result < 0)
+        {
+            LOG(ERROR, "Failed to write %s", buffer->filename);
+        }
+        if (buffer->done)
+        {
+            buffer->done(buffer->done_data, result);
+        }
+
+        encode_pipeline_release(pipeline, buffer);
+    }
+
+    return NULL;
+}
+
+struct EncodePipeline*
+encode_pipeline_new(int num_encoders, int num_buffers)
+{
+    struct EncodePipeline* pipeline;
+    int i;
+
+    return_if(num_encoders < 1, NULL);
+    return_if(num_buffers < 1, NULL);
+
+    pipeline = (struct EncodePipeline *)calloc(1,
+            sizeof(struct EncodePipeline));
+    return_if(pipeline == NULL, NULL);
+
+    pipeline->buffers = (struct EncodeBuffer *)calloc(num_buffers,
+            sizeof(struct EncodeBuffer));
+    pipeline->encoders = (pthread_t *)calloc(num_encoders, sizeof(pthread_t));
+    if (!pipeline->buffers || !pipeline->encoders ||
+        buffer_queue_init(&(pipeline->free), num_buffers) < 0 ||
+        buffer_queue_init(&(pipeline->pending),
+            num_buffers + num_encoders) < 0)
+    {
+        free(pipeline->free.cells);
+        free(pipeline->encoders);
+        free(pipeline->buffers);
+        free(pipeline);
+        return NULL;
+    }
+
+    pipeline->num_buffers = num_buffers;
+    sem_init(&(pipeline->pending_count), 0, 0);
+    sem_init(&(pipeline->free_count), 0, num_buffers);
+    for (i = 0; i < num_buffers; i++)
+    {
+        buffer_queue_push(&(pipeline->free), &(pipeline->buffers[i]));
+    }
+
+    for (i = 0; i < num_encoders; i++)
+    {
+        if (pthread_create(&(pipeline->encoders[i]), NULL, encoder_run,
+                    pipeline) != 0)
+        {
+            break;
+        }
+        pipeline->num_encoders++;
+    }
+
+    if (pipeline->num_encoders == 0)
+    {
+        encode_pipeline_free(pipeline);
+        return NULL;
+    }
+
+    return pipeline;
+}
+
+/**
+ * Take a free buffer holding at least size bytes
+ */
+static struct EncodeBuffer*
+acquire_buffer(struct EncodePipeline* pipeline, size_t size)
+{
+    struct EncodeBuffer* buffer;
+
+    semaphore_wait(&(pipeline->free_count));
+    buffer = buffer_queue_pop(&(pipeline->free));
+
+    if (buffer->size < size)
+    {
+        uint8_t* data = (uint8_t *)realloc(buffer->data, size);
+
+        if (!data)
+        {
+            encode_pipeline_release(pipeline, buffer);
+            return NULL;
+        }
+        buffer->data = data;
+        buffer->size = size;
+    }
+
+    return buffer;
+}
+
+struct EncodeBuffer*
+encode_pipeline_acquire(struct EncodePipeline* pipeline, int width, int height)
+{
+    struct EncodeBuffer* buffer;
+
+    return_if(pipeline == NULL, NULL);
+
+    buffer = acquire_buffer(pipeline, (size_t)width * height * 3);
+    return_if(buffer == NULL, NULL);
+
+    buffer->width = width;
+    buffer->height = height;
+    buffer->yuv.planes[0] = NULL;
+
+    return buffer;
+}
+
+struct EncodeBuffer*
+encode_pipeline_acquire_yuv420(struct EncodePipeline* pipeline,
+        int width, int height)
+{
+    struct EncodeBuffer* buffer;
+    struct YuvImage layout;
+
+    return_if(pipeline == NULL, NULL);
+
+    buffer = acquire_buffer(pipeline,
+            image_yuv420_layout(&layout, NULL, width, height));
+    return_if(buffer == NULL, NULL);
+
+    buffer->width = width;
+    buffer->height = height;
+    image_yuv420_layout(&(buffer->yuv), buffer->data, width, height);
+
+    return buffer;
+}
+
+int
+encode_pipeline_submit(struct EncodePipeline* pipeline,
+        struct EncodeBuffer* buffer, const char* filename,
+        enum ImageFormat format, struct OutputSink* sink, EncodeDoneFunc done,
+        void* done_data)
+{
+    return_if(pipeline == NULL, -1);
+    return_if(buffer == NULL, -1);
+    return_if(filename == NULL, -1);
+
+    strncpy(buffer->filename, filename, sizeof(buffer->filename) - 1);
+    buffer->filename[sizeof(buffer->filename) - 1] = '\0';
+    buffer->format = format;
+    buffer->sink = sink;
+    buffer->done = done;
+    buffer->done_data = done_data;
+    buffer->stats = stats_current;
+
+    /* cannot fail, there are never more buffers than cells */
+    buffer_queue_push(&(pipeline->pending), buffer);
+    sem_post(&(pipeline->pending_count));
+
+    return 0;
+}
+
+void
+encode_pipeline_release(struct EncodePipeline* pipeline,
+        struct EncodeBuffer* buffer)
+{
+    return_if(pipeline == NULL,);
+    return_if(buffer == NULL,);
+
+    buffer->done = NULL;
+    buffer->done_data = NULL;
+    buffer_queue_push(&(pipeline->free), buffer);
+    sem_post(&(pipeline->free_count));
+}
+
+void
+encode_pipeline_free(struct EncodePipeline* pipeline)
+{
+    int i;
+
+    return_if(pipeline == NULL,);
+
+    /* the stop markers queue up behind the pending pictures */
+    for (i = 0; i < pipeline->num_encoders; i++)
+    {
+        buffer_queue_push(&(pipeline->pending), &stop_marker);
+        sem_post(&(pipeline->pending_count));
+    }
+    for (i = 0; i < pipeline->num_encoders; i++)
+    {
+        pthread_join(pipeline->encoders[i], NULL);
+    }
+
+    for (i = 0; i < pipeline->num_buffers; i++)
+    {
+        free(pipeline->buffers[i].data);
+    }
+    sem_destroy(&(pipeline->free_count));
+    sem_destroy(&(pipeline->pending_count));
+    free(pipeline->pending.cells);
+    free(pipeline->free.cells);
+    free(pipeline->encoders);
+    free(pipeline->buffers);
+    free(pipeline);
+}
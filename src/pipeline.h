@@ -0,0 +1,145 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __PIPELINE_H
+#define __PIPELINE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+#include "sink.h"
+#include "stats.h"
+
+/**
+ * Called by an encoder thread once a buffer has been written
+ *
+ * @param data pointer given to #encode_pipeline_submit
+ * @param result 0 if the image has been written, -1 otherwise
+ */
+typedef void (*EncodeDoneFunc)(void* data, int result);
+
+/**
+ * An RGB or YCbCr 4:2:0 picture waiting to be encoded. Buffers are owned by the
+ * #EncodePipeline and recycled after encoding.
+ */
+struct EncodeBuffer
+{
+    /** RGB24 pixels, width * 3 bytes per line */
+    uint8_t* data;
+    size_t size;
+    int width;
+    int height;
+    /** planes inside data for buffers taken by
+     * #encode_pipeline_acquire_yuv420, planes[0] is NULL for RGB buffers */
+    struct YuvImage yuv;
+    enum ImageFormat format;
+    char filename[1024];
+    /** stream taking the image, NULL to write a file of its own */
+    struct OutputSink* sink;
+    EncodeDoneFunc done;
+    void* done_data;
+    /** statistics record of the submitting thread, may be NULL */
+    struct Stats* stats;
+};
+
+struct EncodePipeline;
+
+/**
+ * Start encoder threads writing images in the background. At most
+ * num_buffers pictures are in flight; #encode_pipeline_acquire blocks when
+ * all of them are in use, which bounds the memory of the pipeline.
+ *
+ * @param num_encoders number of encoder threads
+ * @param num_buffers number of RGB buffers
+ * @return a new #EncodePipeline or NULL on error
+ * \ingroup image
+ */
+struct EncodePipeline*
+encode_pipeline_new(int num_encoders, int num_buffers);
+
+/**
+ * Take a free buffer, waiting for an encoder to return one if necessary.
+ *
+ * @param pipeline an #EncodePipeline
+ * @param width width of the picture
+ * @param height height of the picture
+ * @return an #EncodeBuffer of at least width * height * 3 bytes or NULL on
+ * error
+ * \ingroup image
+ */
+struct EncodeBuffer*
+encode_pipeline_acquire(struct EncodePipeline* pipeline, int width, int height);
+
+/**
+ * Take a free buffer for a YCbCr 4:2:0 picture, see
+ * #encode_pipeline_acquire. The format given to #encode_pipeline_submit
+ * has to support #image_save_yuv420.
+ *
+ * @param pipeline an #EncodePipeline
+ * @param width width of the picture
+ * @param height height of the picture
+ * @return an #EncodeBuffer with EncodeBuffer::yuv set up or NULL on error
+ * \ingroup image
+ */
+struct EncodeBuffer*
+encode_pipeline_acquire_yuv420(struct EncodePipeline* pipeline,
+        int width, int height);
+
+/**
+ * Hand a filled buffer to the encoder threads. The buffer must not be used
+ * by the caller afterwards. Encoding and writing are accounted to the
+ * statistics record of the calling thread.
+ *
+ * @param pipeline an #EncodePipeline
+ * @param buffer a buffer taken by #encode_pipeline_acquire
+ * @param filename name of the image file
+ * @param format a member of #ImageFormat
+ * @param sink stream to append the image to, NULL to write filename
+ * @param done function called after the image has been written, may be NULL
+ * @param done_data argument for done
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+encode_pipeline_submit(struct EncodePipeline* pipeline,
+        struct EncodeBuffer* buffer, const char* filename,
+        enum ImageFormat format, struct OutputSink* sink, EncodeDoneFunc done,
+        void* done_data);
+
+/**
+ * Give an unused buffer back without encoding it.
+ *
+ * @param pipeline an #EncodePipeline
+ * @param buffer a buffer taken by #encode_pipeline_acquire
+ * \ingroup image
+ */
+void
+encode_pipeline_release(struct EncodePipeline* pipeline,
+        struct EncodeBuffer* buffer);
+
+/**
+ * Encode all pending pictures, stop the encoder threads and free the
+ * pipeline.
+ *
+ * @param pipeline an #EncodePipeline
+ * \ingroup image
+ */
+void
+encode_pipeline_free(struct EncodePipeline* pipeline);
+#endif /* __PIPELINE_H */
@@ -0,0 +1,291 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "recycle.h"
+#include "stats.h"
+#include "util.h"
+
+/** Limits of what is kept for reuse; the oldest entries go first */
+#define MAX_BUFFER_BYTES (128 * 1024 * 1024)
+#define MAX_FRAMES 64
+#define MAX_SCALERS 32
+
+enum EntryKind
+{
+    ENTRY_BUFFER = 0,
+    ENTRY_FRAME,
+    ENTRY_SCALER,
+    ENTRY_KIND_COUNT
+};
+
+struct Entry
+{
+    struct Entry* next;
+    void* data;
+    size_t size;
+    struct ScalerKey key;
+};
+
+struct EntryList
+{
+    /** most recently given back first */
+    struct Entry* head;
+    int count;
+    size_t bytes;
+};
+
+static pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+static struct EntryList lists[ENTRY_KIND_COUNT];
+
+static void
+data_free(enum EntryKind kind, void* data)
+{
+    if (kind == ENTRY_SCALER)
+    {
+        sws_freeContext((struct SwsContext *)data);
+    }
+    else
+    {
+        av_free(data);
+    }
+}
+
+static void
+entry_free(enum EntryKind kind, struct Entry* entry)
+{
+    data_free(kind, entry->data);
+    free(entry);
+}
+
+static int
+is_full(enum EntryKind kind)
+{
+    struct EntryList* list = &(lists[kind]);
+
+    switch (kind)
+    {
+        case ENTRY_BUFFER:
+            return list->bytes > MAX_BUFFER_BYTES;
+        case ENTRY_FRAME:
+            return list->count > MAX_FRAMES;
+        case ENTRY_SCALER:
+            return list->count > MAX_SCALERS;
+        default:
+            return 0;
+    }
+}
+
+/**
+ * Take the most recent entry of size and key out of a list
+ *
+ * @return the data of the entry or NULL if there is none
+ */
+static void*
+take(enum EntryKind kind, size_t size, const struct ScalerKey* key)
+{
+    struct EntryList* list = &(lists[kind]);
+    struct Entry** link;
+    struct Entry* entry = NULL;
+    void* data = NULL;
+
+    pthread_mutex_lock(&lock);
+    for (link = &(list->head); *link; link = &((*link)->next))
+    {
+        if ((*link)->size == size &&
+            (!key || !memcmp(&((*link)->key), key, sizeof(*key))))
+        {
+            entry = *link;
+            *link = entry->next;
+            list->count--;
+            list->bytes -= entry->size;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&lock);
+
+    if (entry)
+    {
+        data = entry->data;
+        free(entry);
+    }
+
+    return data;
+}
+
+/**
+ * Put data at the front of a list, dropping the oldest entries if the list
+ * has grown too large
+ */
+static void
+give(enum EntryKind kind, void* data, size_t size,
+        const struct ScalerKey* key)
+{
+    struct EntryList* list = &(lists[kind]);
+    struct Entry* entry;
+    struct Entry* dropped = NULL;
+
+    entry = (struct Entry *)calloc(1, sizeof(struct Entry));
+    if (!entry)
+    {
+        data_free(kind, data);
+        return;
+    }
+    entry->data = data;
+    entry->size = size;
+    if (key)
+    {
+        entry->key = *key;
+    }
+
+    pthread_mutex_lock(&lock);
+    entry->next = list->head;
+    list->head = entry;
+    list->count++;
+    list->bytes += size;
+    while (is_full(kind))
+    {
+        struct Entry** last = &(list->head);
+
+        while ((*last)->next)
+        {
+            last = &((*last)->next);
+        }
+        list->count--;
+        list->bytes -= (*last)->size;
+        (*last)->next = dropped;
+        dropped = *last;
+        *last = NULL;
+    }
+    pthread_mutex_unlock(&lock);
+
+    while (dropped)
+    {
+        entry = dropped;
+        dropped = dropped->next;
+        entry_free(kind, entry);
+    }
+}
+
+uint8_t*
+recycle_buffer_get(size_t size)
+{
+    uint8_t* buffer;
+
+    return_if(size == 0, NULL);
+
+    buffer = (uint8_t *)take(ENTRY_BUFFER, size, NULL);
+    if (!buffer)
+    {
+        STATS_COUNT(STATS_ALLOCATIONS, 1);
+        buffer = (uint8_t *)av_malloc(size);
+    }
+
+    return buffer;
+}
+
+void
+recycle_buffer_put(uint8_t* buffer, size_t size)
+{
+    return_if(buffer == NULL,);
+
+    give(ENTRY_BUFFER, buffer, size, NULL);
+}
+
+AVFrame*
+recycle_frame_get(void)
+{
+    AVFrame* frame;
+
+    frame = (AVFrame *)take(ENTRY_FRAME, 0, NULL);
+    if (frame)
+    {
+        avcodec_get_frame_defaults(frame);
+        return frame;
+    }
+
+    STATS_COUNT(STATS_ALLOCATIONS, 1);
+
+    return avcodec_alloc_frame();
+}
+
+void
+recycle_frame_put(AVFrame* frame)
+{
+    return_if(frame == NULL,);
+
+    give(ENTRY_FRAME, frame, 0, NULL);
+}
+
+struct SwsContext*
+recycle_scaler_get(const struct ScalerKey* key)
+{
+    struct SwsContext* ctx;
+
+    return_if(key == NULL, NULL);
+
+    ctx = (struct SwsContext *)take(ENTRY_SCALER, 0, key);
+    if (!ctx)
+    {
+        STATS_COUNT(STATS_ALLOCATIONS, 1);
+        ctx = sws_getContext(
+                key->src_width, key->src_height, key->src_format,
+                key->dst_width, key->dst_height, key->dst_format,
+                key->flags, NULL, NULL, NULL);
+    }
+
+    return ctx;
+}
+
+void
+recycle_scaler_put(struct SwsContext* ctx, const struct ScalerKey* key)
+{
+    return_if(ctx == NULL,);
+    return_if(key == NULL,);
+
+    give(ENTRY_SCALER, ctx, 0, key);
+}
+
+void
+recycle_clear(void)
+{
+    struct Entry* entries[ENTRY_KIND_COUNT];
+    int kind;
+
+    pthread_mutex_lock(&lock);
+    for (kind = 0; kind < ENTRY_KIND_COUNT; kind++)
+    {
+        entries[kind] = lists[kind].head;
+        memset(&(lists[kind]), 0, sizeof(struct EntryList));
+    }
+    pthread_mutex_unlock(&lock);
+
+    for (kind = 0; kind < ENTRY_KIND_COUNT; kind++)
+    {
+        while (entries[kind])
+        {
+            struct Entry* entry = entries[kind];
+
+            entries[kind] = entry->next;
+            entry_free((enum EntryKind)kind, entry);
+        }
+    }
+}
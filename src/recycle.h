@@ -0,0 +1,121 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RECYCLE_H
+#define __RECYCLE_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#ifdef AVCODEC_NEW_INCLUDE
+#   include <libavcodec/avcodec.h>
+#   include <libswscale/swscale.h>
+#else
+#   include <avcodec.h>
+#   include <swscale.h>
+#endif
+
+/**
+ * Parameters a scaler context was created with. Only a context with the
+ * same parameters can be reused.
+ */
+struct ScalerKey
+{
+    int src_width;
+    int src_height;
+    enum PixelFormat src_format;
+    int dst_width;
+    int dst_height;
+    enum PixelFormat dst_format;
+    int flags;
+};
+
+/**
+ * Get a picture buffer of exactly size bytes. Buffers given back with
+ * #recycle_buffer_put are handed out again before a new one is allocated,
+ * so batches of same-sized videos settle on a fixed set of buffers. The
+ * pool is shared by all threads.
+ *
+ * @param size size of the buffer in bytes
+ * @return a buffer to be released with #recycle_buffer_put or av_free, NULL
+ * on error. The contents are undefined.
+ * \ingroup util
+ */
+uint8_t*
+recycle_buffer_get(size_t size);
+
+/**
+ * Give a buffer back to the pool. The oldest buffers are freed once the
+ * pool holds more than a fixed amount of memory.
+ *
+ * @param buffer a buffer from #recycle_buffer_get or NULL
+ * @param size size the buffer was requested with
+ * \ingroup util
+ */
+void
+recycle_buffer_put(uint8_t* buffer, size_t size);
+
+/**
+ * Get a frame with default values, reusing one given back with
+ * #recycle_frame_put if possible.
+ *
+ * @return a frame without picture data or NULL on error
+ * \ingroup util
+ */
+AVFrame*
+recycle_frame_get(void);
+
+/**
+ * Give a frame back to the pool. Picture buffers set with avpicture_fill
+ * are not touched.
+ *
+ * @param frame a frame from #recycle_frame_get or NULL
+ * \ingroup util
+ */
+void
+recycle_frame_put(AVFrame* frame);
+
+/**
+ * Get a scaler context, reusing one with the same parameters if possible.
+ * Setting up a context computes the filter coefficients, which is not free
+ * for large pictures.
+ *
+ * @param key parameters of the context
+ * @return a context or NULL on error
+ * \ingroup util
+ */
+struct SwsContext*
+recycle_scaler_get(const struct ScalerKey* key);
+
+/**
+ * Give a scaler context back to the pool.
+ *
+ * @param ctx a context from #recycle_scaler_get or NULL
+ * @param key parameters ctx was requested with
+ * \ingroup util
+ */
+void
+recycle_scaler_put(struct SwsContext* ctx, const struct ScalerKey* key);
+
+/**
+ * Free everything held by the pool.
+ * \ingroup util
+ */
+void
+recycle_clear(void);
+#endif /* __RECYCLE_H */
@@ -0,0 +1,141 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <stdlib.h>
+#include <string.h>
+
+#include "recycle.h"
+#include "reservoir.h"
+#include "util.h"
+
+int
+reservoir_init(struct Reservoir* reservoir, int num_pics, size_t picture_size)
+{
+    return_if(reservoir == NULL, -1);
+    return_if(num_pics < 1 || picture_size == 0, -1);
+
+    memset(reservoir, 0, sizeof(struct Reservoir));
+    reservoir->capacity = 2 * num_pics;
+    reservoir->samples = (struct ReservoirSample *)calloc(
+            reservoir->capacity, sizeof(struct ReservoirSample));
+    return_if(reservoir->samples == NULL, -1);
+    reservoir->picture_size = picture_size;
+    reservoir->interval = 1;
+
+    return 0;
+}
+
+int
+reservoir_wants(const struct Reservoir* reservoir, int64_t frame)
+{
+    return_if(reservoir == NULL, 0);
+
+    return frame >= reservoir->next;
+}
+
+/**
+ * Keep every other sample and double the interval. The pictures of the
+ * dropped samples move to the free slots for reuse.
+ */
+static void
+thin(struct Reservoir* reservoir)
+{
+    int i;
+
+    for (i = 2; i < reservoir->count; i += 2)
+    {
+        struct ReservoirSample sample = reservoir->samples[i / 2];
+
+        reservoir->samples[i / 2] = reservoir->samples[i];
+        reservoir->samples[i] = sample;
+    }
+    reservoir->count = (reservoir->count + 1) / 2;
+    reservoir->interval *= 2;
+}
+
+struct ReservoirSample*
+reservoir_add(struct Reservoir* reservoir, int64_t frame, int64_t pts,
+        double time)
+{
+    struct ReservoirSample* sample;
+
+    return_if(reservoir == NULL, NULL);
+
+    if (reservoir->count == reservoir->capacity)
+    {
+        /* a due frame stays due: it lies one new interval after the last
+         * sample kept */
+        thin(reservoir);
+    }
+
+    sample = &(reservoir->samples[reservoir->count]);
+    if (!sample->picture)
+    {
+        sample->picture = recycle_buffer_get(reservoir->picture_size);
+        return_if(sample->picture == NULL, NULL);
+    }
+    sample->frame = frame;
+    sample->pts = pts;
+    sample->time = time;
+    reservoir->count++;
+    reservoir->next = frame + reservoir->interval;
+
+    return sample;
+}
+
+void
+reservoir_drop_last(struct Reservoir* reservoir)
+{
+    return_if(reservoir == NULL || reservoir->count == 0,);
+
+    reservoir->count--;
+    /* the next frame replaces it */
+    reservoir->next = reservoir->samples[reservoir->count].frame;
+}
+
+const struct ReservoirSample*
+reservoir_select(const struct Reservoir* reservoir, int num_pics, int index)
+{
+    return_if(reservoir == NULL, NULL);
+    return_if(index < 0 || index >= num_pics, NULL);
+
+    if (reservoir->count <= num_pics)
+    {
+        return_if(index >= reservoir->count, NULL);
+        return &(reservoir->samples[index]);
+    }
+
+    return &(reservoir->samples[(int64_t)index * reservoir->count /
+            num_pics]);
+}
+
+void
+reservoir_free(struct Reservoir* reservoir)
+{
+    int i;
+
+    return_if(reservoir == NULL || reservoir->samples == NULL,);
+
+    for (i = 0; i < reservoir->capacity; i++)
+    {
+        recycle_buffer_put(reservoir->samples[i].picture,
+                reservoir->picture_size);
+    }
+    free(reservoir->samples);
+    memset(reservoir, 0, sizeof(struct Reservoir));
+}
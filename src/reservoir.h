@@ -0,0 +1,129 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __RESERVOIR_H
+#define __RESERVOIR_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/**
+ * A picture kept by a #Reservoir
+ */
+struct ReservoirSample
+{
+    /** picture of Reservoir::picture_size bytes */
+    uint8_t* picture;
+    /** number of the frame in the stream */
+    int64_t frame;
+    int64_t pts;
+    double time;
+    /** perceptual hash of the picture, see #histogram_dhash_from_luma */
+    uint64_t hash;
+};
+
+/**
+ * Evenly spaced pictures of a stream of unknown length. Every interval-th
+ * frame is kept; when all slots are taken, every other sample is dropped
+ * and the interval doubles. The samples thus always cover the whole stream
+ * seen so far with at least half of the slots in use, and memory stays
+ * constant however long the stream is.
+ */
+struct Reservoir
+{
+    struct ReservoirSample* samples;
+    int capacity;
+    int count;
+    size_t picture_size;
+    /** distance between samples in frames */
+    int64_t interval;
+    /** number of the next frame to keep */
+    int64_t next;
+};
+
+/**
+ * Set up a reservoir.
+ *
+ * @param reservoir a #Reservoir
+ * @param num_pics number of pictures wanted in the end; twice as many are
+ * kept
+ * @param picture_size size of a picture in bytes
+ * @return 0 on success
+ * \ingroup analysis
+ */
+int
+reservoir_init(struct Reservoir* reservoir, int num_pics, size_t picture_size);
+
+/**
+ * Check whether a frame should be kept.
+ *
+ * @param reservoir a #Reservoir
+ * @param frame number of the frame in the stream
+ * @return 1 if the frame is due
+ * \ingroup analysis
+ */
+int
+reservoir_wants(const struct Reservoir* reservoir, int64_t frame);
+
+/**
+ * Keep a frame. If a frame is skipped although it is due, e.g. because it
+ * is black, a later frame can be added instead.
+ *
+ * @param reservoir a #Reservoir
+ * @param frame number of the frame in the stream
+ * @param pts presentation time stamp of the frame
+ * @param time position of the frame in seconds
+ * @return the sample, whose picture the caller has to fill, or NULL on
+ * error
+ * \ingroup analysis
+ */
+struct ReservoirSample*
+reservoir_add(struct Reservoir* reservoir, int64_t frame, int64_t pts,
+        double time);
+
+/**
+ * Drop the last sample added, e.g. because its picture could not be
+ * filled.
+ *
+ * @param reservoir a #Reservoir
+ * \ingroup analysis
+ */
+void
+reservoir_drop_last(struct Reservoir* reservoir);
+
+/**
+ * Pick evenly spaced samples.
+ *
+ * @param reservoir a #Reservoir
+ * @param num_pics number of samples wanted
+ * @param index position among the num_pics samples
+ * @return the sample or NULL if there are fewer than index + 1 samples
+ * \ingroup analysis
+ */
+const struct ReservoirSample*
+reservoir_select(const struct Reservoir* reservoir, int num_pics, int index);
+
+/**
+ * Free all pictures of a reservoir.
+ *
+ * @param reservoir a #Reservoir
+ * \ingroup analysis
+ */
+void
+reservoir_free(struct Reservoir* reservoir);
+#endif /* __RESERVOIR_H */
@@ -0,0 +1,509 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+#include "util.h"
+
+/** Number of connections waiting to be accepted */
+#define BACKLOG 16
+
+struct Server
+{
+    struct ThreadPool* pool;
+    struct EncodePipeline* pipeline;
+    const struct ThumbnailOptions* defaults;
+    const char* output_prefix;
+};
+
+/**
+ * A client sending requests. It is released once the client has closed its
+ * side and all of its requests are done.
+ */
+struct Connection
+{
+    struct Server* server;
+    int in_fd;
+    int out_fd;
+    /** serializes the completion records */
+    pthread_mutex_t lock;
+    int refs;
+    unsigned int next_id;
+};
+
+struct Request
+{
+    struct ThumbnailJob job;
+    struct ThumbnailOptions options;
+    struct Connection* connection;
+    char id[64];
+    char* filename;
+    char* output_prefix;
+};
+
+static void
+connection_release(struct Connection* connection)
+{
+    int refs;
+
+    pthread_mutex_lock(&(connection->lock));
+    refs = --connection->refs;
+    pthread_mutex_unlock(&(connection->lock));
+
+    if (refs == 0)
+    {
+        if (connection->out_fd != connection->in_fd)
+        {
+            close(connection->out_fd);
+        }
+        close(connection->in_fd);
+        pthread_mutex_destroy(&(connection->lock));
+        free(connection);
+    }
+}
+
+/**
+ * Send one record; a client that has gone away is ignored
+ */
+static void
+connection_send(struct Connection* connection, const char* format, ...)
+{
+    va_list ap;
+    FILE* f;
+    char* line = NULL;
+    size_t length = 0;
+    size_t written = 0;
+
+    f = open_memstream(&line, &length);
+    return_if(f == NULL,);
+    va_start(ap, format);
+    vfprintf(f, format, ap);
+    va_end(ap);
+    if (fclose(f) != 0)
+    {
+        free(line);
+        return;
+    }
+
+    pthread_mutex_lock(&(connection->lock));
+    while (written < length)
+    {
+        ssize_t result = write(connection->out_fd, line + written,
+                length - written);
+
+        if (result < 0 && errno == EINTR)
+        {
+            continue;
+        }
+        if (result <= 0)
+        {
+            break;
+        }
+        written += result;
+    }
+    pthread_mutex_unlock(&(connection->lock));
+
+    free(line);
+}
+
+static void
+request_free(struct Request* request)
+{
+    free(request->filename);
+    free(request->output_prefix);
+    free(request->job.snapshot_stats);
+    free(request);
+}
+
+static void
+request_done(struct ThumbnailJob* job, void* data)
+{
+    struct Request* request = (struct Request *)data;
+    struct Connection* connection = request->connection;
+
+    connection_send(connection, "%s\t%s\t%s\t%s\n",
+            job->result < 0 ? "FAILED" : "OK", request->id,
+            request->filename, request->output_prefix);
+
+    request_free(request);
+    connection_release(connection);
+}
+
+/**
+ * Apply one key=value field to a request
+ *
+ * @return NULL on success, otherwise the error message
+ */
+static const char*
+request_set(struct Request* request, const char* key, const char* value)
+{
+    struct ThumbnailOptions* options = &(request->options);
+
+    if (!strcmp(key, "file"))
+    {
+        free(request->filename);
+        request->filename = strdup(value);
+    }
+    else if (!strcmp(key, "prefix"))
+    {
+        free(request->output_prefix);
+        request->output_prefix = strdup(value);
+    }
+    else if (!strcmp(key, "id"))
+    {
+        snprintf(request->id, sizeof(request->id), "%s", value);
+    }
+    else if (!strcmp(key, "n"))
+    {
+        int num_pics = atoi(value);
+
+        return_if(num_pics < 1 || num_pics > UINT8_MAX,
+                "invalid number of snapshots");
+        /* a contact sheet has one snapshot per tile */
+        if (options->columns == 0)
+        {
+            options->num_pics = num_pics;
+        }
+    }
+    else if (!strcmp(key, "width"))
+    {
+        /* a single size instead of the server's list */
+        options->num_sizes = 0;
+        options->width = atoi(value);
+        return_if(options->width < 0, "invalid width");
+    }
+    else if (!strcmp(key, "height"))
+    {
+        options->num_sizes = 0;
+        options->height = atoi(value);
+        return_if(options->height < 0, "invalid height");
+    }
+    else if (!strcmp(key, "format"))
+    {
+        options->image_format = image_get_format(value);
+        return_if((int)options->image_format < 0, "unknown image format");
+    }
+    else
+    {
+        return "unknown field";
+    }
+
+    return NULL;
+}
+
+/**
+ * Fill a request from a line, which is modified in the process
+ *
+ * @return NULL on success, otherwise the error message
+ */
+static const char*
+request_parse(struct Request* request, char* line)
+{
+    char* field;
+    char* next;
+    int position = 0;
+
+    for (field = line; field; field = next, ++position)
+    {
+        char* value;
+        const char* error;
+
+        next = strchr(field, '\t');
+        if (next)
+        {
+            *next++ = '\0';
+        }
+
+        value = strchr(field, '=');
+        if (value)
+        {
+            *value++ = '\0';
+            error = request_set(request, field, value);
+        }
+        else
+        {
+            /* manifest style: file name, then prefix */
+            error = request_set(request,
+                    position == 0 ? "file" : "prefix", field);
+        }
+        return_if(error != NULL, error);
+    }
+
+    return_if(request->filename == NULL || request->filename[0] == '\0',
+            "no file given");
+
+    return NULL;
+}
+
+static void
+handle_line(struct Connection* connection, char* line)
+{
+    struct Server* server = connection->server;
+    struct Request* request;
+    const char* error;
+    char prefix[1024];
+
+    request = (struct Request *)calloc(1, sizeof(struct Request));
+    if (!request)
+    {
+        connection_send(connection, "%s", "ERROR\t-\tout of memory\n");
+        return;
+    }
+    request->options = *(server->defaults);
+    snprintf(request->id, sizeof(request->id), "%u",
+            connection->next_id++);
+
+    error = request_parse(request, line);
+    if (!error && !request->output_prefix)
+    {
+        make_file_prefix(prefix, sizeof(prefix), server->output_prefix,
+                request->filename);
+        request->output_prefix = strdup(prefix);
+    }
+    if (!error && !request->output_prefix)
+    {
+        error = "out of memory";
+    }
+    if (error)
+    {
+        connection_send(connection, "ERROR\t%s\t%s\n", request->id, error);
+        request_free(request);
+        return;
+    }
+
+    request->connection = connection;
+    request->job.filename = request->filename;
+    request->job.output_prefix = request->output_prefix;
+    request->job.options = &(request->options);
+    request->job.pipeline = server->pipeline;
+    request->job.done = request_done;
+    request->job.done_data = request;
+
+    pthread_mutex_lock(&(connection->lock));
+    connection->refs++;
+    pthread_mutex_unlock(&(connection->lock));
+
+    if (thumbnailer_submit(server->pool, &(request->job)) < 0)
+    {
+        connection_send(connection, "FAILED\t%s\t%s\t%s\n", request->id,
+                request->filename, request->output_prefix);
+        request_free(request);
+        connection_release(connection);
+    }
+}
+
+/**
+ * Read requests until the client closes its side
+ */
+static void*
+connection_run(void* data)
+{
+    struct Connection* connection = (struct Connection *)data;
+    FILE* in;
+    char* line = NULL;
+    size_t size = 0;
+    int fd;
+
+    /* the stream gets a descriptor of its own, the connection closes
+     * in_fd once the last request is done */
+    fd = dup(connection->in_fd);
+    in = fd >= 0 ? fdopen(fd, "r") : NULL;
+    if (!in)
+    {
+        LOG(ERROR, "%s", "Failed to read from client");
+        if (fd >= 0)
+        {
+            close(fd);
+        }
+        connection_release(connection);
+        return NULL;
+    }
+
+    while (getline(&line, &size, in) >= 0)
+    {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+        handle_line(connection, line);
+    }
+
+    free(line);
+    fclose(in);
+    connection_release(connection);
+
+    return NULL;
+}
+
+static struct Connection*
+connection_new(struct Server* server, int in_fd, int out_fd)
+{
+    struct Connection* connection;
+
+    connection = (struct Connection *)calloc(1, sizeof(struct Connection));
+    return_if(connection == NULL, NULL);
+
+    connection->server = server;
+    connection->in_fd = in_fd;
+    connection->out_fd = out_fd;
+    /* held by the reader until the client is done sending */
+    connection->refs = 1;
+    pthread_mutex_init(&(connection->lock), NULL);
+
+    return connection;
+}
+
+static int
+serve_stdio(struct Server* server)
+{
+    struct Connection* connection;
+    int out_fd;
+
+    /* keep stdout for the records, the rest of tn prints to stderr */
+    fflush(stdout);
+    out_fd = dup(STDOUT_FILENO);
+    return_if(out_fd < 0, -1);
+    if (dup2(STDERR_FILENO, STDOUT_FILENO) < 0)
+    {
+        close(out_fd);
+        return -1;
+    }
+
+    connection = connection_new(server, STDIN_FILENO, out_fd);
+    if (!connection)
+    {
+        close(out_fd);
+        return -1;
+    }
+    connection_run(connection);
+
+    return 0;
+}
+
+static int
+serve_socket(struct Server* server, const char* path)
+{
+    struct sockaddr_un address;
+    struct stat st;
+    int fd;
+
+    return_if(strlen(path) >= sizeof(address.sun_path), -1);
+
+    /* only a socket left behind by an earlier instance is replaced */
+    if (lstat(path, &st) == 0)
+    {
+        if (!S_ISSOCK(st.st_mode))
+        {
+            LOG(ERROR, "%s exists and is not a socket", path);
+            return -1;
+        }
+        unlink(path);
+    }
+
+    fd = socket(AF_UNIX, SOCK_STREAM, 0);
+    return_if(fd < 0, -1);
+
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strcpy(address.sun_path, path);
+
+    if (bind(fd, (struct sockaddr *)&address, sizeof(address)) < 0 ||
+            listen(fd, BACKLOG) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+    LOG(INFO, "Listening on %s", path);
+
+    while (1)
+    {
+        struct Connection* connection;
+        pthread_attr_t attr;
+        pthread_t thread;
+        int client;
+
+        client = accept(fd, NULL, NULL);
+        if (client < 0)
+        {
+            if (errno == EINTR || errno == ECONNABORTED)
+            {
+                continue;
+            }
+            break;
+        }
+
+        connection = connection_new(server, client, client);
+        if (!connection)
+        {
+            close(client);
+            continue;
+        }
+
+        pthread_attr_init(&attr);
+        pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&thread, &attr, connection_run, connection) != 0)
+        {
+            connection_release(connection);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+    close(fd);
+
+    return -1;
+}
+
+int
+server_run(const char* address, struct ThreadPool* pool,
+        struct EncodePipeline* pipeline,
+        const struct ThumbnailOptions* defaults, const char* output_prefix)
+{
+    /* requests may still be running when this returns */
+    static struct Server server;
+
+    return_if(address == NULL, -1);
+    return_if(pool == NULL, -1);
+    return_if(defaults == NULL, -1);
+
+    server.pool = pool;
+    server.pipeline = pipeline;
+    server.defaults = defaults;
+    server.output_prefix = output_prefix ? output_prefix : "";
+
+    /* a client going away must not kill the server */
+    signal(SIGPIPE, SIG_IGN);
+
+    if (!strcmp(address, "-"))
+    {
+        return serve_stdio(&server);
+    }
+
+    return serve_socket(&server, address);
+}
@@ -0,0 +1,57 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SERVER_H
+#define __SERVER_H
+
+#include "pipeline.h"
+#include "threadpool.h"
+#include "thumbnailer.h"
+
+/**
+ * Serve snapshot requests until the input ends. Every request is one line
+ * of tab-separated <tt>key=value</tt> fields:
+ * \li <tt>file</tt> video file, required
+ * \li <tt>id</tt> echoed in the completion record, defaults to a sequence
+ * number
+ * \li <tt>prefix</tt> output prefix, defaults to a directory named after
+ * the file below the server's prefix
+ * \li <tt>n</tt>, <tt>width</tt>, <tt>height</tt> and <tt>format</tt>
+ * override the number, maximum size and format of the snapshots
+ *
+ * A line without "=" is read like a manifest line, the file name optionally
+ * followed by the prefix. Requests run in parallel; when one is done, the
+ * line <tt>OK|FAILED TAB id TAB file TAB prefix</tt> is sent back. Invalid
+ * requests are answered with <tt>ERROR TAB id TAB message</tt>.
+ *
+ * @param address path of a Unix domain socket to listen on, or "-" to read
+ * requests from stdin and answer on stdout. In that case, everything else
+ * written to stdout goes to stderr instead.
+ * @param pool runs the requests; it stays busy until all requests are done
+ * @param pipeline encoder threads shared by all requests, may be NULL
+ * @param defaults settings of requests not overriding them
+ * @param output_prefix base of the default output prefixes
+ * @return 0 when the input has ended, -1 on error. A socket is served until
+ * the process is terminated.
+ * \ingroup util
+ */
+int
+server_run(const char* address, struct ThreadPool* pool,
+        struct EncodePipeline* pipeline,
+        const struct ThumbnailOptions* defaults, const char* output_prefix);
+#endif /* __SERVER_H */
@@ -0,0 +1,168 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "recycle.h"
+#include "sheet.h"
+#include "util.h"
+
+struct ContactSheet*
+contact_sheet_new(int columns, int rows, int tile_width, int tile_height)
+{
+    struct ContactSheet* sheet;
+
+    return_if(columns < 1 || rows < 1, NULL);
+    return_if(tile_width < 1 || tile_height < 1, NULL);
+
+    sheet = (struct ContactSheet *)calloc(1, sizeof(struct ContactSheet));
+    return_if(sheet == NULL, NULL);
+
+    sheet->columns = columns;
+    sheet->rows = rows;
+    sheet->tile_width = tile_width;
+    sheet->tile_height = tile_height;
+    sheet->linesize = columns * tile_width * 3;
+    sheet->rgb_buffer = recycle_buffer_get(
+            (size_t)sheet->linesize * rows * tile_height);
+    sheet->times = (double *)calloc(columns * rows, sizeof(double));
+
+    if (!sheet->rgb_buffer || !sheet->times)
+    {
+        contact_sheet_free(sheet);
+        return NULL;
+    }
+    /* empty tiles stay black */
+    memset(sheet->rgb_buffer, 0, (size_t)sheet->linesize * rows * tile_height);
+
+    return sheet;
+}
+
+uint8_t*
+contact_sheet_get_tile(struct ContactSheet* sheet, int index, double time)
+{
+    int x;
+    int y;
+
+    return_if(sheet == NULL, NULL);
+    return_if(index < 0 || index >= sheet->columns * sheet->rows, NULL);
+
+    sheet->times[index] = time;
+
+    x = (index % sheet->columns) * sheet->tile_width;
+    y = (index / sheet->columns) * sheet->tile_height;
+
+    return sheet->rgb_buffer + (size_t)y * sheet->linesize + x * 3;
+}
+
+int
+contact_sheet_save(struct ContactSheet* sheet, const char* filename,
+        enum ImageFormat format)
+{
+    return_if(sheet == NULL, -1);
+
+    return image_save(filename, sheet->rgb_buffer,
+            sheet->columns * sheet->tile_width,
+            sheet->rows * sheet->tile_height,
+            format);
+}
+
+static void
+write_vtt_time(FILE* f, double time)
+{
+    int64_t ms = (int64_t)(time * 1000.0 + 0.5);
+
+    fprintf(f, "%02d:%02d:%02d.%03d",
+            (int)(ms / 3600000),
+            (int)(ms / 60000 % 60),
+            (int)(ms / 1000 % 60),
+            (int)(ms % 1000));
+}
+
+int
+contact_sheet_write_vtt(struct ContactSheet* sheet, FILE* f,
+        const char* image_uri)
+{
+    int count;
+    int i;
+
+    return_if(sheet == NULL, -1);
+    return_if(f == NULL, -1);
+    return_if(image_uri == NULL, -1);
+
+    fprintf(f, "WEBVTT\n");
+
+    count = sheet->columns * sheet->rows;
+    for (i = 0; i < count; i++)
+    {
+        double end = i + 1 < count ? sheet->times[i + 1] : sheet->duration;
+
+        fprintf(f, "\n");
+        write_vtt_time(f, sheet->times[i]);
+        fprintf(f, " --> ");
+        write_vtt_time(f, MAX(end, sheet->times[i]));
+        fprintf(f, "\n%s#xywh=%d,%d,%d,%d\n", image_uri,
+                (i % sheet->columns) * sheet->tile_width,
+                (i / sheet->columns) * sheet->tile_height,
+                sheet->tile_width,
+                sheet->tile_height);
+    }
+
+    return ferror(f) ? -1 : 0;
+}
+
+int
+contact_sheet_save_vtt(struct ContactSheet* sheet, const char* filename,
+        const char* image_uri)
+{
+    FILE* f;
+    int result;
+
+    return_if(sheet == NULL, -1);
+    return_if(filename == NULL, -1);
+    return_if(image_uri == NULL, -1);
+
+    f = fopen(filename, "w");
+    if (!f)
+    {
+        fprintf(stderr, "Failed to open file %s:%d\n", filename, errno);
+        return -1;
+    }
+
+    result = contact_sheet_write_vtt(sheet, f, image_uri);
+    if (fclose(f) != 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+void
+contact_sheet_free(struct ContactSheet* sheet)
+{
+    return_if(sheet == NULL,);
+
+    free(sheet->times);
+    recycle_buffer_put(sheet->rgb_buffer,
+            (size_t)sheet->linesize * sheet->rows * sheet->tile_height);
+    free(sheet);
+}
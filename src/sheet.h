@@ -0,0 +1,118 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SHEET_H
+#define __SHEET_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "image.h"
+
+/**
+ * A contact sheet: all snapshots of a file tiled into one RGB canvas, row by
+ * row from the top left.
+ */
+struct ContactSheet
+{
+    int columns;
+    int rows;
+    int tile_width;
+    int tile_height;
+
+    /** RGB canvas of columns * tile_width x rows * tile_height pixels */
+    uint8_t* rgb_buffer;
+    int linesize;
+
+    /** start time of every tile in seconds */
+    double* times;
+
+    /** length of the video in seconds, end of the last tile */
+    double duration;
+};
+
+/**
+ * Create a contact sheet with a black canvas.
+ *
+ * @param columns number of tiles per row
+ * @param rows number of tile rows
+ * @param tile_width width of a snapshot
+ * @param tile_height height of a snapshot
+ * @return a new #ContactSheet or NULL on error
+ * \ingroup image
+ */
+struct ContactSheet*
+contact_sheet_new(int columns, int rows, int tile_width, int tile_height);
+
+/**
+ * Get the position of a tile inside the canvas. Tiles can be written from
+ * different threads at the same time.
+ *
+ * @param sheet a #ContactSheet
+ * @param index number of the tile
+ * @param time start time of the tile in seconds, used for the sidecar
+ * @return pointer to the top left pixel of the tile; lines are
+ * ContactSheet::linesize bytes apart
+ * \ingroup image
+ */
+uint8_t*
+contact_sheet_get_tile(struct ContactSheet* sheet, int index, double time);
+
+/**
+ * Encode the canvas once using #image_save.
+ *
+ * @param sheet a #ContactSheet
+ * @param filename name of the image file
+ * @param format a member of #ImageFormat
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+contact_sheet_save(struct ContactSheet* sheet, const char* filename,
+        enum ImageFormat format);
+
+/**
+ * Write a WebVTT file mapping time ranges to tiles using media fragment
+ * URIs (<tt>image#xywh=x,y,w,h</tt>), as used for scrub previews.
+ *
+ * @param sheet a #ContactSheet
+ * @param filename name of the WebVTT file
+ * @param image_uri name of the contact sheet image as seen by the player
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+contact_sheet_save_vtt(struct ContactSheet* sheet, const char* filename,
+        const char* image_uri);
+
+/**
+ * Same as #contact_sheet_save_vtt, writing to an open stream.
+ *
+ * @param sheet a #ContactSheet
+ * @param f stream to write to
+ * @param image_uri name of the contact sheet image as seen by the player
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+contact_sheet_write_vtt(struct ContactSheet* sheet, FILE* f,
+        const char* image_uri);
+
+void
+contact_sheet_free(struct ContactSheet* sheet);
+#endif /* __SHEET_H */
@@ -0,0 +1,123 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <string.h>
+
+#include "shots.h"
+#include "util.h"
+
+/** A cut is at least this far from the previous frame */
+#define SHOT_MIN_DISTANCE 0.15
+
+/** ... and this many standard deviations above the mean of the shot */
+#define SHOT_DEVIATIONS 4.0
+
+/** Frames closer than this to their predecessor are always stable */
+#define SHOT_STABLE_DISTANCE 0.05
+
+/** Consecutive stable frames after which a new shot has settled */
+#define SHOT_STABLE_FRAMES 3
+
+/** A shot that never settles is taken after this many frames */
+#define SHOT_MAX_SETTLE 50
+
+/** Shortest shot in frames; flashes do not start shots of their own */
+#define SHOT_MIN_LENGTH 12
+
+/** Weight of the latest distance in the running statistics */
+#define SHOT_RATE 0.05
+
+void
+shot_detector_init(struct ShotDetector* detector)
+{
+    memset(detector, 0, sizeof(struct ShotDetector));
+    detector->settling = 1;
+}
+
+int
+shot_detector_push(struct ShotDetector* detector,
+        const struct Histogram* histogram)
+{
+    double distance;
+    double deviation;
+
+    return_if(detector == NULL, 0);
+    return_if(histogram == NULL, 0);
+
+    if (!detector->previous_valid)
+    {
+        detector->previous = *histogram;
+        detector->previous_valid = 1;
+        return 0;
+    }
+
+    distance = histogram_get_chi_square(&(detector->previous), histogram);
+    detector->shot_length++;
+
+    deviation = sqrt(detector->variance);
+    if (detector->shot_length >= SHOT_MIN_LENGTH &&
+            distance > MAX(SHOT_MIN_DISTANCE,
+                detector->mean + SHOT_DEVIATIONS * deviation))
+    {
+        /* cut; the statistics of the old shot are kept as a start */
+        detector->before_cut = detector->previous;
+        detector->before_cut_valid = 1;
+        detector->previous = *histogram;
+        detector->shot_length = 0;
+        detector->settling = 1;
+        detector->settle_length = 0;
+        detector->stable_length = 0;
+        return 0;
+    }
+
+    detector->previous = *histogram;
+
+    if (detector->settling)
+    {
+        detector->settle_length++;
+        if (distance <= MAX(SHOT_STABLE_DISTANCE, detector->mean + deviation))
+        {
+            detector->stable_length++;
+        }
+        else
+        {
+            detector->stable_length = 0;
+        }
+    }
+
+    /* exponentially weighted mean and variance */
+    distance -= detector->mean;
+    detector->mean += SHOT_RATE * distance;
+    detector->variance = (1.0 - SHOT_RATE) *
+        (detector->variance + SHOT_RATE * distance * distance);
+
+    if (detector->settling &&
+            (detector->stable_length >= SHOT_STABLE_FRAMES ||
+             detector->settle_length >= SHOT_MAX_SETTLE))
+    {
+        detector->settling = 0;
+
+        /* the old picture is back after a flash or an occlusion */
+        return !detector->before_cut_valid ||
+            histogram_get_chi_square(&(detector->before_cut), histogram) >
+            SHOT_MIN_DISTANCE;
+    }
+
+    return 0;
+}
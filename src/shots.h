@@ -0,0 +1,76 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SHOTS_H
+#define __SHOTS_H
+
+#include "histogram.h"
+
+/**
+ * Shot boundary detection on a stream of frames. Consecutive luma
+ * histograms are compared by chi-square distance; a cut is a distance far
+ * above the running mean of the shot, so the threshold adapts to the amount
+ * of motion. Memory use is constant.
+ */
+struct ShotDetector
+{
+    /** histogram of the previous frame */
+    struct Histogram previous;
+    int previous_valid;
+
+    /** histogram of the last frame before the cut */
+    struct Histogram before_cut;
+    int before_cut_valid;
+
+    /** running mean and variance of the distances within the shot */
+    double mean;
+    double variance;
+
+    /** frames since the last cut */
+    int shot_length;
+
+    /** a shot has started but not settled yet */
+    int settling;
+    /** frames since the last cut while settling */
+    int settle_length;
+    /** consecutive frames close to their predecessor while settling */
+    int stable_length;
+};
+
+/**
+ * Reset a detector. The first frame pushed starts a shot.
+ *
+ * @param detector a #ShotDetector
+ * \ingroup analysis
+ */
+void
+shot_detector_init(struct ShotDetector* detector);
+
+/**
+ * Feed the histogram of the next frame.
+ *
+ * @param detector a #ShotDetector
+ * @param histogram pointer to a #Histogram of the frame
+ * @return 1 if the frame is the first one after a cut on which the picture
+ * has settled, 0 otherwise
+ * \ingroup analysis
+ */
+int
+shot_detector_push(struct ShotDetector* detector,
+        const struct Histogram* histogram);
+#endif /* __SHOTS_H */
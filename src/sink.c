@@ -0,0 +1,325 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "sink.h"
+#include "stats.h"
+#include "util.h"
+
+#define TAR_BLOCK 512
+
+/** Stream buffer size; output is written in large sequential chunks */
+#define SINK_BUFFER_SIZE (1024 * 1024)
+
+#define MULTIPART_BOUNDARY "tn-snapshot-boundary"
+
+struct OutputSink
+{
+    enum SinkType type;
+    FILE* stream;
+    char* buffer;
+    pthread_mutex_t lock;
+    int failed;
+};
+
+/**
+ * ustar header, see POSIX pax(1)
+ */
+struct TarHeader
+{
+    char name[100];
+    char mode[8];
+    char uid[8];
+    char gid[8];
+    char size[12];
+    char mtime[12];
+    char checksum[8];
+    char typeflag;
+    char linkname[100];
+    char magic[6];
+    char version[2];
+    char uname[32];
+    char gname[32];
+    char devmajor[8];
+    char devminor[8];
+    char prefix[155];
+    char padding[12];
+};
+
+static int
+write_tar_entry(struct OutputSink* sink, const char* name,
+        const uint8_t* data, size_t size)
+{
+    static const char zeros[TAR_BLOCK] = { 0 };
+    struct TarHeader header;
+    const unsigned char* bytes = (const unsigned char *)&header;
+    size_t name_length = strlen(name);
+    unsigned int checksum = 0;
+    size_t i;
+
+    memset(&header, 0, sizeof(header));
+
+    if (name_length < sizeof(header.name))
+    {
+        memcpy(header.name, name, name_length);
+    }
+    else
+    {
+        /* split long names at a "/" into prefix and name */
+        const char* split = name + name_length - sizeof(header.name);
+
+        split = strchr(split, '/');
+        return_if(split == NULL, -1);
+        return_if((size_t)(split - name) >= sizeof(header.prefix), -1);
+        memcpy(header.prefix, name, split - name);
+        strcpy(header.name, split + 1);
+    }
+
+    snprintf(header.mode, sizeof(header.mode), "%07o", 0644);
+    snprintf(header.uid, sizeof(header.uid), "%07o", 0);
+    snprintf(header.gid, sizeof(header.gid), "%07o", 0);
+    snprintf(header.size, sizeof(header.size), "%011llo",
+            (unsigned long long)size);
+    snprintf(header.mtime, sizeof(header.mtime), "%011llo",
+            (unsigned long long)time(NULL));
+    header.typeflag = '0';
+    memcpy(header.magic, "ustar", 6);
+    memcpy(header.version, "00", 2);
+
+    memset(header.checksum, ' ', sizeof(header.checksum));
+    for (i = 0; i < sizeof(header); i++)
+    {
+        checksum += bytes[i];
+    }
+    snprintf(header.checksum, sizeof(header.checksum), "%06o", checksum);
+
+    return_if(fwrite(&header, sizeof(header), 1, sink->stream) != 1, -1);
+    return_if(size > 0 && fwrite(data, size, 1, sink->stream) != 1, -1);
+    if (size % TAR_BLOCK)
+    {
+        return_if(fwrite(zeros, TAR_BLOCK - size % TAR_BLOCK, 1,
+                    sink->stream) != 1, -1);
+    }
+
+    return 0;
+}
+
+static int
+write_multipart_entry(struct OutputSink* sink, const char* name,
+        const char* mime_type, const uint8_t* data, size_t size)
+{
+    return_if(fprintf(sink->stream,
+                "--" MULTIPART_BOUNDARY "\r\n"
+                "Content-Type: %s\r\n"
+                "Content-Disposition: attachment; filename=\"%s\"\r\n"
+                "Content-Length: %llu\r\n"
+                "\r\n",
+                mime_type, name, (unsigned long long)size) < 0, -1);
+    return_if(size > 0 && fwrite(data, size, 1, sink->stream) != 1, -1);
+    return_if(fputs("\r\n", sink->stream) < 0, -1);
+
+    return 0;
+}
+
+struct OutputSink*
+output_sink_open(const char* spec)
+{
+    struct OutputSink* sink;
+    const char* filename;
+
+    return_if(spec == NULL, NULL);
+
+    sink = (struct OutputSink *)calloc(1, sizeof(struct OutputSink));
+    return_if(sink == NULL, NULL);
+
+    if (!strncmp(spec, "tar", 3))
+    {
+        sink->type = SINK_TYPE_TAR;
+        filename = spec + 3;
+    }
+    else if (!strncmp(spec, "multipart", 9))
+    {
+        sink->type = SINK_TYPE_MULTIPART;
+        filename = spec + 9;
+    }
+    else
+    {
+        free(sink);
+        return NULL;
+    }
+
+    if (*filename == ':')
+    {
+        filename++;
+    }
+    else if (*filename != '\0')
+    {
+        free(sink);
+        return NULL;
+    }
+
+    if (*filename == '\0' || !strcmp(filename, "-"))
+    {
+        /* keep the stream for ourselves and send stray output to stderr */
+        int fd = dup(STDOUT_FILENO);
+
+        fflush(stdout);
+        if (fd >= 0 && dup2(STDERR_FILENO, STDOUT_FILENO) >= 0)
+        {
+            sink->stream = fdopen(fd, "wb");
+        }
+    }
+    else
+    {
+        sink->stream = fopen(filename, "wb");
+    }
+
+    if (!sink->stream)
+    {
+        LOG(ERROR, "Failed to open output stream %s: %s", spec,
+                strerror(errno));
+        free(sink);
+        return NULL;
+    }
+
+    sink->buffer = (char *)malloc(SINK_BUFFER_SIZE);
+    if (sink->buffer)
+    {
+        setvbuf(sink->stream, sink->buffer, _IOFBF, SINK_BUFFER_SIZE);
+    }
+    pthread_mutex_init(&(sink->lock), NULL);
+
+    return sink;
+}
+
+int
+output_sink_write(struct OutputSink* sink, const char* name,
+        const char* mime_type, const uint8_t* data, size_t size)
+{
+    uint64_t start;
+    int result;
+
+    return_if(sink == NULL, -1);
+    return_if(name == NULL, -1);
+    return_if(data == NULL && size > 0, -1);
+
+    /* includes waiting for other writers */
+    start = STATS_START();
+    pthread_mutex_lock(&(sink->lock));
+    switch (sink->type)
+    {
+        case SINK_TYPE_TAR:
+            result = write_tar_entry(sink, name, data, size);
+            break;
+        case SINK_TYPE_MULTIPART:
+            result = write_multipart_entry(sink, name,
+                    mime_type ? mime_type : "application/octet-stream",
+                    data, size);
+            break;
+        default:
+            result = -1;
+            break;
+    }
+    if (result < 0)
+    {
+        sink->failed = 1;
+    }
+    pthread_mutex_unlock(&(sink->lock));
+    STATS_STOP(STATS_PHASE_WRITE, start);
+    STATS_COUNT(STATS_BYTES_WRITTEN, size);
+
+    return result;
+}
+
+int
+output_sink_write_image(struct OutputSink* sink, const char* name,
+        uint8_t* rgb_buffer, int width, int height, enum ImageFormat format)
+{
+    uint8_t* data;
+    size_t size;
+    int result;
+
+    return_if(image_encode(rgb_buffer, width, height, format, &data,
+                &size) < 0, -1);
+    result = output_sink_write(sink, name, image_get_mime_type(format), data,
+            size);
+    free(data);
+
+    return result;
+}
+
+int
+output_sink_write_yuv420(struct OutputSink* sink, const char* name,
+        const struct YuvImage* image, enum ImageFormat format)
+{
+    uint8_t* data;
+    size_t size;
+    int result;
+
+    return_if(image_encode_yuv420(image, format, &data, &size) < 0, -1);
+    result = output_sink_write(sink, name, image_get_mime_type(format), data,
+            size);
+    free(data);
+
+    return result;
+}
+
+int
+output_sink_close(struct OutputSink* sink)
+{
+    static const char zeros[2 * TAR_BLOCK] = { 0 };
+    int failed;
+
+    return_if(sink == NULL, -1);
+
+    switch (sink->type)
+    {
+        case SINK_TYPE_TAR:
+            /* end of archive marker */
+            if (fwrite(zeros, sizeof(zeros), 1, sink->stream) != 1)
+            {
+                sink->failed = 1;
+            }
+            break;
+        case SINK_TYPE_MULTIPART:
+            if (fputs("--" MULTIPART_BOUNDARY "--\r\n", sink->stream) < 0)
+            {
+                sink->failed = 1;
+            }
+            break;
+    }
+
+    if (fclose(sink->stream) != 0)
+    {
+        sink->failed = 1;
+    }
+    failed = sink->failed;
+
+    pthread_mutex_destroy(&(sink->lock));
+    free(sink->buffer);
+    free(sink);
+
+    return failed ? -1 : 0;
+}
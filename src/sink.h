@@ -0,0 +1,110 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __SINK_H
+#define __SINK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "image.h"
+
+enum SinkType
+{
+    /** POSIX ustar archive; text representation is <tt>tar:FILE</tt> */
+    SINK_TYPE_TAR,
+    /**
+     * MIME multipart/mixed stream with a Content-Length per part; text
+     * representation is <tt>multipart:FILE</tt>
+     */
+    SINK_TYPE_MULTIPART
+};
+
+struct OutputSink;
+
+/**
+ * Open a single output stream taking all images of a run. The
+ * specification is <tt>tar:FILE</tt> or <tt>multipart:FILE</tt>; a FILE of
+ * <tt>-</tt> or no FILE at all means standard output. Everything else
+ * printed to standard output is redirected to standard error in that case,
+ * so the stream stays intact.
+ *
+ * @param spec output specification
+ * @return a new #OutputSink or NULL on error
+ * \ingroup image
+ */
+struct OutputSink*
+output_sink_open(const char* spec);
+
+/**
+ * Append a file to the stream. Calls from several threads are serialized;
+ * every file is written as a whole.
+ *
+ * @param sink an #OutputSink
+ * @param name file name inside the stream
+ * @param mime_type type of the data, used by multipart streams
+ * @param data contents of the file
+ * @param size number of bytes in data
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+output_sink_write(struct OutputSink* sink, const char* name,
+        const char* mime_type, const uint8_t* data, size_t size);
+
+/**
+ * Encode an RGB picture in memory and append it to the stream.
+ *
+ * @param sink an #OutputSink
+ * @param name file name inside the stream
+ * @param rgb_buffer width * height * 3 bytes of RGB data
+ * @param width of picture
+ * @param height of picture
+ * @param format a member of #ImageFormat
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+output_sink_write_image(struct OutputSink* sink, const char* name,
+        uint8_t* rgb_buffer, int width, int height, enum ImageFormat format);
+
+/**
+ * Same as #output_sink_write_image for a YCbCr 4:2:0 picture, see
+ * #image_save_yuv420.
+ *
+ * @param sink an #OutputSink
+ * @param name file name inside the stream
+ * @param image the picture
+ * @param format a member of #ImageFormat
+ * @return 0 on success
+ * \ingroup image
+ */
+int
+output_sink_write_yuv420(struct OutputSink* sink, const char* name,
+        const struct YuvImage* image, enum ImageFormat format);
+
+/**
+ * Terminate the stream and close it.
+ *
+ * @param sink an #OutputSink
+ * @return 0 if all data has been written successfully
+ * \ingroup image
+ */
+int
+output_sink_close(struct OutputSink* sink);
+#endif /* __SINK_H */
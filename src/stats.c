@@ -0,0 +1,112 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <inttypes.h>
+#include <time.h>
+
+#include "stats.h"
+
+__thread struct Stats* stats_current = NULL;
+
+static const char* phase_names[STATS_PHASE_COUNT] =
+{
+    "open",
+    "demux",
+    "seek",
+    "seek_decode",
+    "decode",
+    "scale",
+    "histogram",
+    "encode",
+    "write"
+};
+
+static const char* counter_names[STATS_COUNTER_COUNT] =
+{
+    "packets_read",
+    "frames_decoded",
+    "frames_used",
+    "frames_black",
+    "frames_duplicate",
+    "bytes_written",
+    "allocations"
+};
+
+uint64_t
+stats_clock(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return (uint64_t)ts.tv_sec * 1000000000 + ts.tv_nsec;
+}
+
+void
+stats_add_time(struct Stats* stats, enum StatsPhase phase, uint64_t start)
+{
+    stats->time[phase] += stats_clock() - start;
+    stats->calls[phase]++;
+}
+
+struct Stats*
+stats_set_current(struct Stats* stats)
+{
+    struct Stats* previous = stats_current;
+
+    stats_current = stats;
+
+    return previous;
+}
+
+void
+stats_merge(struct Stats* stats, const struct Stats* other)
+{
+    int i;
+
+    for (i = 0; i < STATS_PHASE_COUNT; i++)
+    {
+        stats->time[i] += other->time[i];
+        stats->calls[i] += other->calls[i];
+    }
+    for (i = 0; i < STATS_COUNTER_COUNT; i++)
+    {
+        stats->counters[i] += other->counters[i];
+    }
+}
+
+void
+stats_write_json(FILE* f, const struct Stats* stats)
+{
+    int i;
+
+    fprintf(f, "\"phases\": {");
+    for (i = 0; i < STATS_PHASE_COUNT; i++)
+    {
+        fprintf(f, "%s\"%s\": {\"ms\": %.3f, \"calls\": %"PRIu64"}",
+                i > 0 ? ", " : "", phase_names[i], stats->time[i] / 1e6,
+                stats->calls[i]);
+    }
+    fprintf(f, "}, \"counters\": {");
+    for (i = 0; i < STATS_COUNTER_COUNT; i++)
+    {
+        fprintf(f, "%s\"%s\": %"PRIu64, i > 0 ? ", " : "", counter_names[i],
+                stats->counters[i]);
+    }
+    fprintf(f, "}");
+}
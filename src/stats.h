@@ -0,0 +1,150 @@
+/*  Copyright (c) 2008 Jens Georg.
+
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __STATS_H
+#define __STATS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+/**
+ * Phases of snapshot generation. The phases do not overlap, so their times
+ * add up to the time spent working on a file.
+ */
+enum StatsPhase
+{
+    /** opening the file and probing the streams */
+    STATS_PHASE_OPEN = 0,
+    /** reading packets from the container */
+    STATS_PHASE_DEMUX,
+    /** container seeks */
+    STATS_PHASE_SEEK,
+    /** decoding from the keyframe up to a seek target */
+    STATS_PHASE_SEEK_DECODE,
+    /** all other decoding */
+    STATS_PHASE_DECODE,
+    /** colorspace conversion and scaling */
+    STATS_PHASE_SCALE,
+    /** histograms and black frame checks */
+    STATS_PHASE_HISTOGRAM,
+    /** image encoding */
+    STATS_PHASE_ENCODE,
+    /** writing images to files or the output stream */
+    STATS_PHASE_WRITE,
+    STATS_PHASE_COUNT
+};
+
+enum StatsCounter
+{
+    STATS_PACKETS_READ = 0,
+    STATS_FRAMES_DECODED,
+    /** frames that ended up in an image */
+    STATS_FRAMES_USED,
+    /** frames skipped by black frame detection */
+    STATS_FRAMES_BLACK,
+    /** frames dropped as near-duplicates of the previous snapshot */
+    STATS_FRAMES_DUPLICATE,
+    STATS_BYTES_WRITTEN,
+    /** picture buffers, frames and scalers that could not be reused */
+    STATS_ALLOCATIONS,
+    STATS_COUNTER_COUNT
+};
+
+/**
+ * Times and counters collected while working on a file or a single
+ * snapshot. A record is updated without locking; the decoding thread and an
+ * encoder thread may share one as they touch different phases.
+ */
+struct Stats
+{
+    /** nanoseconds spent in each phase */
+    uint64_t time[STATS_PHASE_COUNT];
+    /** number of times each phase was entered */
+    uint64_t calls[STATS_PHASE_COUNT];
+    uint64_t counters[STATS_COUNTER_COUNT];
+};
+
+/** record of the calling thread, NULL while statistics are off */
+extern __thread struct Stats* stats_current;
+
+/**
+ * Start timing a phase; 0 without a current record, so the clock is never
+ * read while statistics are off.
+ */
+#define STATS_START() (stats_current ? stats_clock() : 0)
+
+/** Add the time since start to a phase of the current record */
+#define STATS_STOP(phase, start) \
+    do { if (stats_current) stats_add_time(stats_current, phase, start); } \
+    while (0)
+
+/** Add n to a counter of the current record */
+#define STATS_COUNT(counter, n) \
+    do { if (stats_current) stats_current->counters[counter] += (n); } \
+    while (0)
+
+/**
+ * @return monotonic clock in nanoseconds
+ * \ingroup util
+ */
+uint64_t
+stats_clock(void);
+
+/**
+ * Add the time elapsed since start to a phase.
+ *
+ * @param stats a #Stats record
+ * @param phase a member of #StatsPhase
+ * @param start value of #stats_clock when the phase was entered
+ * \ingroup util
+ */
+void
+stats_add_time(struct Stats* stats, enum StatsPhase phase, uint64_t start);
+
+/**
+ * Make stats the record updated by the calling thread.
+ *
+ * @param stats a #Stats record or NULL to stop collecting
+ * @return the previous record of the thread
+ * \ingroup util
+ */
+struct Stats*
+stats_set_current(struct Stats* stats);
+
+/**
+ * Add all times and counters of one record to another.
+ *
+ * @param stats record to add to
+ * @param other record to add
+ * \ingroup util
+ */
+void
+stats_merge(struct Stats* stats, const struct Stats* other);
+
+/**
+ * Write the members of a JSON object describing a record: "phases" maps
+ * phase names to milliseconds and calls, "counters" holds the counters. The
+ * caller writes the braces, so further members can be added.
+ *
+ * @param f stream to write to
+ * @param stats a #Stats record
+ * \ingroup util
+ */
+void
+stats_write_json(FILE* f, const struct Stats* stats);
+#endif /* __STATS_H */
@@ -0,0 +1,352 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <pthread.h>
+#include <sched.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "threadpool.h"
+#include "util.h"
+
+struct Task
+{
+    ThreadPoolFunc func;
+    void* data;
+};
+
+/**
+ * Double ended task queue of one worker. The owner works on the tail,
+ * thieves take from the head.
+ */
+struct TaskQueue
+{
+    pthread_mutex_t lock;
+    struct Task* tasks;
+    int capacity;
+    int head;
+    int count;
+};
+
+struct PoolWorker
+{
+    pthread_t thread;
+    struct ThreadPool* pool;
+    struct TaskQueue queue;
+    int index;
+};
+
+struct ThreadPool
+{
+    struct PoolWorker* workers;
+    int num_threads;
+
+    /** protects the counters below */
+    pthread_mutex_t lock;
+    /** signalled when new tasks arrive or on shutdown */
+    pthread_cond_t work_available;
+    /** signalled when outstanding drops to zero */
+    pthread_cond_t all_done;
+    /** tasks queued or running */
+    int outstanding;
+    /** tasks queued but not yet taken */
+    int queued;
+    int idle;
+    int next_queue;
+    int shutdown;
+};
+
+static __thread struct PoolWorker* current_worker = NULL;
+
+static int
+task_queue_push(struct TaskQueue* queue, struct Task* task)
+{
+    pthread_mutex_lock(&(queue->lock));
+    if (queue->count == queue->capacity)
+    {
+        int capacity = queue->capacity ? queue->capacity * 2 : 16;
+        struct Task* tasks = (struct Task *)malloc(capacity * sizeof(struct Task));
+        int i;
+
+        if (!tasks)
+        {
+            pthread_mutex_unlock(&(queue->lock));
+            return -1;
+        }
+        for (i = 0; i < queue->count; ++i)
+        {
+            tasks[i] = queue->tasks[(queue->head + i) % queue->capacity];
+        }
+        free(queue->tasks);
+        queue->tasks = tasks;
+        queue->capacity = capacity;
+        queue->head = 0;
+    }
+    queue->tasks[(queue->head + queue->count) % queue->capacity] = *task;
+    queue->count++;
+    pthread_mutex_unlock(&(queue->lock));
+
+    return 0;
+}
+
+static int
+task_queue_pop_tail(struct TaskQueue* queue, struct Task* task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&(queue->lock));
+    if (queue->count > 0)
+    {
+        queue->count--;
+        *task = queue->tasks[(queue->head + queue->count) % queue->capacity];
+        found = 1;
+    }
+    pthread_mutex_unlock(&(queue->lock));
+
+    return found;
+}
+
+static int
+task_queue_pop_head(struct TaskQueue* queue, struct Task* task)
+{
+    int found = 0;
+
+    pthread_mutex_lock(&(queue->lock));
+    if (queue->count > 0)
+    {
+        *task = queue->tasks[queue->head];
+        queue->head = (queue->head + 1) % queue->capacity;
+        queue->count--;
+        found = 1;
+    }
+    pthread_mutex_unlock(&(queue->lock));
+
+    return found;
+}
+
+static int
+find_task(struct PoolWorker* worker, struct Task* task)
+{
+    struct ThreadPool* pool = worker->pool;
+    int i;
+
+    if (task_queue_pop_tail(&(worker->queue), task))
+    {
+        return 1;
+    }
+
+    for (i = 1; i < pool->num_threads; ++i)
+    {
+        struct PoolWorker* victim =
+            &(pool->workers[(worker->index + i) % pool->num_threads]);
+        if (task_queue_pop_head(&(victim->queue), task))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+static void*
+pool_worker_run(void* data)
+{
+    struct PoolWorker* worker = (struct PoolWorker *)data;
+    struct ThreadPool* pool = worker->pool;
+    struct Task task;
+
+    current_worker = worker;
+
+    pthread_mutex_lock(&(pool->lock));
+    while (1)
+    {
+        while (pool->queued == 0 && !pool->shutdown)
+        {
+            pool->idle++;
+            pthread_cond_wait(&(pool->work_available), &(pool->lock));
+            pool->idle--;
+        }
+
+        if (pool->queued == 0 && pool->shutdown)
+        {
+            break;
+        }
+
+        /* the counter is claimed before searching, so a task exists */
+        pool->queued--;
+        pthread_mutex_unlock(&(pool->lock));
+
+        while (!find_task(worker, &task))
+        {
+            sched_yield();
+        }
+        task.func(task.data);
+
+        pthread_mutex_lock(&(pool->lock));
+        if (--pool->outstanding == 0)
+        {
+            pthread_cond_broadcast(&(pool->all_done));
+        }
+    }
+    pthread_mutex_unlock(&(pool->lock));
+
+    return NULL;
+}
+
+struct ThreadPool*
+thread_pool_new(int num_threads)
+{
+    struct ThreadPool* pool;
+    int i;
+
+    return_if(num_threads < 1, NULL);
+
+    pool = (struct ThreadPool *)calloc(1, sizeof(struct ThreadPool));
+    return_if(pool == NULL, NULL);
+
+    pool->workers = (struct PoolWorker *)calloc(num_threads,
+            sizeof(struct PoolWorker));
+    if (!pool->workers)
+    {
+        free(pool);
+        return NULL;
+    }
+
+    pthread_mutex_init(&(pool->lock), NULL);
+    pthread_cond_init(&(pool->work_available), NULL);
+    pthread_cond_init(&(pool->all_done), NULL);
+
+    for (i = 0; i < num_threads; ++i)
+    {
+        pool->workers[i].pool = pool;
+        pool->workers[i].index = i;
+        pthread_mutex_init(&(pool->workers[i].queue.lock), NULL);
+    }
+
+    for (i = 0; i < num_threads; ++i)
+    {
+        if (pthread_create(&(pool->workers[i].thread), NULL,
+                    pool_worker_run, &(pool->workers[i])) != 0)
+        {
+            LOG(WARNING, "Could only start %d of %d threads", i, num_threads);
+            break;
+        }
+        pool->num_threads = i + 1;
+    }
+
+    if (pool->num_threads == 0)
+    {
+        thread_pool_free(pool);
+        return NULL;
+    }
+
+    return pool;
+}
+
+int
+thread_pool_push(struct ThreadPool* pool, ThreadPoolFunc func, void* data)
+{
+    struct TaskQueue* queue;
+    struct Task task;
+
+    return_if(pool == NULL, -1);
+    return_if(func == NULL, -1);
+
+    task.func = func;
+    task.data = data;
+
+    if (current_worker && current_worker->pool == pool)
+    {
+        queue = &(current_worker->queue);
+    }
+    else
+    {
+        pthread_mutex_lock(&(pool->lock));
+        queue = &(pool->workers[pool->next_queue].queue);
+        pool->next_queue = (pool->next_queue + 1) % pool->num_threads;
+        pthread_mutex_unlock(&(pool->lock));
+    }
+
+    return_if(task_queue_push(queue, &task) < 0, -1);
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->outstanding++;
+    pool->queued++;
+    pthread_cond_signal(&(pool->work_available));
+    pthread_mutex_unlock(&(pool->lock));
+
+    return 0;
+}
+
+int
+thread_pool_idle(struct ThreadPool* pool)
+{
+    int idle;
+
+    return_if(pool == NULL, 0);
+
+    pthread_mutex_lock(&(pool->lock));
+    idle = pool->idle - pool->queued;
+    pthread_mutex_unlock(&(pool->lock));
+
+    return MAX(idle, 0);
+}
+
+void
+thread_pool_wait(struct ThreadPool* pool)
+{
+    return_if(pool == NULL,);
+
+    pthread_mutex_lock(&(pool->lock));
+    while (pool->outstanding > 0)
+    {
+        pthread_cond_wait(&(pool->all_done), &(pool->lock));
+    }
+    pthread_mutex_unlock(&(pool->lock));
+}
+
+void
+thread_pool_free(struct ThreadPool* pool)
+{
+    int i;
+
+    return_if(pool == NULL,);
+
+    thread_pool_wait(pool);
+
+    pthread_mutex_lock(&(pool->lock));
+    pool->shutdown = 1;
+    pthread_cond_broadcast(&(pool->work_available));
+    pthread_mutex_unlock(&(pool->lock));
+
+    for (i = 0; i < pool->num_threads; ++i)
+    {
+        pthread_join(pool->workers[i].thread, NULL);
+    }
+
+    for (i = 0; i < pool->num_threads; ++i)
+    {
+        pthread_mutex_destroy(&(pool->workers[i].queue.lock));
+        free(pool->workers[i].queue.tasks);
+    }
+    pthread_cond_destroy(&(pool->all_done));
+    pthread_cond_destroy(&(pool->work_available));
+    pthread_mutex_destroy(&(pool->lock));
+    free(pool->workers);
+    free(pool);
+}
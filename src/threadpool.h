@@ -0,0 +1,82 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __THREADPOOL_H
+#define __THREADPOOL_H
+
+/**
+ * Function executed by a #ThreadPool worker
+ */
+typedef void (*ThreadPoolFunc)(void* data);
+
+struct ThreadPool;
+
+/**
+ * Create a pool of worker threads. Every worker owns a queue of tasks; it
+ * takes its own tasks newest first and steals the oldest tasks of the other
+ * workers once its queue runs empty.
+ *
+ * @param num_threads number of worker threads
+ * @return a new #ThreadPool or NULL on error
+ * \ingroup util
+ */
+struct ThreadPool*
+thread_pool_new(int num_threads);
+
+/**
+ * Queue a task. Called from a worker thread, the task is added to the
+ * worker's own queue, otherwise the queues are filled round-robin.
+ *
+ * @param pool a #ThreadPool
+ * @param func function to run
+ * @param data argument passed to func
+ * @return 0 on success
+ * \ingroup util
+ */
+int
+thread_pool_push(struct ThreadPool* pool, ThreadPoolFunc func, void* data);
+
+/**
+ * Get the number of workers currently waiting for a task. Tasks can use
+ * this to decide whether splitting off part of their work pays off.
+ *
+ * @param pool a #ThreadPool
+ * @return number of idle workers
+ * \ingroup util
+ */
+int
+thread_pool_idle(struct ThreadPool* pool);
+
+/**
+ * Block until all queued and running tasks have finished.
+ *
+ * @param pool a #ThreadPool
+ * \ingroup util
+ */
+void
+thread_pool_wait(struct ThreadPool* pool);
+
+/**
+ * Wait for all tasks, stop the workers and release the pool.
+ *
+ * @param pool a #ThreadPool
+ * \ingroup util
+ */
+void
+thread_pool_free(struct ThreadPool* pool);
+#endif /* __THREADPOOL_H */
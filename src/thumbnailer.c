@@ -0,0 +1,1471 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#include <math.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "histogram.h"
+#include "reservoir.h"
+#include "sheet.h"
+#include "shots.h"
+#include "stats.h"
+#include "threadpool.h"
+#include "thumbnailer.h"
+#include "util.h"
+#include "video.h"
+
+/** Width of the pictures compared in shot detection */
+#define SHOT_ANALYSIS_WIDTH 320
+
+/** Frames after a near-duplicate position tried before it is dropped */
+#define DEDUP_TRIES 12
+
+/** Memory for the pictures kept while reading a stream that cannot be
+ * seeked, see #stream_fit_reservoir */
+#define STREAM_RESERVOIR_BYTES (128 * 1024 * 1024)
+
+/**
+ * Hash of the last snapshot written, to suppress near-duplicates
+ */
+struct Dedup
+{
+    uint64_t hash;
+    int valid;
+};
+
+/**
+ * Part of a #ThumbnailJob: the snapshots [first, last) decoded with its own
+ * #VideoFile
+ */
+struct Range
+{
+    struct ThumbnailJob* job;
+    struct VideoFile* video_file;
+    int first;
+    int last;
+    /** the first snapshot of a range is always written */
+    struct Dedup dedup;
+    /** work of this range not belonging to a snapshot */
+    struct Stats stats;
+};
+
+static int
+lock_manager(void** mutex, enum AVLockOp op)
+{
+    switch (op)
+    {
+        case AV_LOCK_CREATE:
+            *mutex = malloc(sizeof(pthread_mutex_t));
+            return_if(*mutex == NULL, 1);
+            return pthread_mutex_init((pthread_mutex_t *)*mutex, NULL) != 0;
+        case AV_LOCK_OBTAIN:
+            return pthread_mutex_lock((pthread_mutex_t *)*mutex) != 0;
+        case AV_LOCK_RELEASE:
+            return pthread_mutex_unlock((pthread_mutex_t *)*mutex) != 0;
+        case AV_LOCK_DESTROY:
+            pthread_mutex_destroy((pthread_mutex_t *)*mutex);
+            free(*mutex);
+            *mutex = NULL;
+            return 0;
+    }
+
+    return 1;
+}
+
+/**
+ * Account the work of the calling thread to stats if the job collects
+ * statistics
+ */
+static void
+job_track(struct ThumbnailJob* job, struct Stats* stats)
+{
+    stats_set_current(job->options->collect_stats ? stats : NULL);
+}
+
+static void
+job_fail(struct ThumbnailJob* job)
+{
+    pthread_mutex_lock(&(job->lock));
+    job->result = -1;
+    pthread_mutex_unlock(&(job->lock));
+}
+
+static int
+save_sheet(struct ThumbnailJob* job, const char* filename)
+{
+    struct ContactSheet* sheet = job->sheet;
+
+    if (job->sink)
+    {
+        return output_sink_write_image(job->sink, filename,
+                sheet->rgb_buffer,
+                sheet->columns * sheet->tile_width,
+                sheet->rows * sheet->tile_height,
+                job->options->image_format);
+    }
+
+    return contact_sheet_save(sheet, filename, job->options->image_format);
+}
+
+static int
+save_sheet_vtt(struct ThumbnailJob* job, const char* filename,
+        const char* image_uri)
+{
+    FILE* f;
+    char* data = NULL;
+    size_t size = 0;
+    int result;
+
+    if (!job->sink)
+    {
+        return contact_sheet_save_vtt(job->sheet, filename, image_uri);
+    }
+
+    f = open_memstream(&data, &size);
+    return_if(f == NULL, -1);
+    result = contact_sheet_write_vtt(job->sheet, f, image_uri);
+    if (fclose(f) != 0)
+    {
+        result = -1;
+    }
+    if (result == 0)
+    {
+        result = output_sink_write(job->sink, filename, "text/vtt",
+                (const uint8_t *)data, size);
+    }
+    free(data);
+
+    return result;
+}
+
+/**
+ * Called once the last task of a job is done
+ */
+static void
+job_finish(struct ThumbnailJob* job)
+{
+    const struct ThumbnailOptions* options = job->options;
+
+    job_track(job, &(job->stats));
+
+    if (job->sheet)
+    {
+        char filename[1024];
+        char vtt_filename[1024];
+        const char* image_uri;
+
+        snprintf(filename, sizeof(filename), "%ssheet.%s",
+                job->output_prefix, image_get_suffix(options->image_format));
+        if (save_sheet(job, filename) < 0)
+        {
+            LOG(ERROR, "Failed to write %s", filename);
+            job->result = -1;
+        }
+
+        if (options->write_vtt)
+        {
+            /* the sidecar lives next to the image */
+            image_uri = strrchr(filename, '/');
+            image_uri = image_uri ? image_uri + 1 : filename;
+            snprintf(vtt_filename, sizeof(vtt_filename), "%ssheet.vtt",
+                    job->output_prefix);
+            if (save_sheet_vtt(job, vtt_filename, image_uri) < 0)
+            {
+                LOG(ERROR, "Failed to write %s", vtt_filename);
+                job->result = -1;
+            }
+        }
+
+        contact_sheet_free(job->sheet);
+        job->sheet = NULL;
+    }
+
+    seek_index_free(job->index);
+    job->index = NULL;
+
+    if (job->snapshot_stats)
+    {
+        int i;
+
+        for (i = 0; i < options->num_pics; ++i)
+        {
+            stats_merge(&(job->stats), &(job->snapshot_stats[i]));
+        }
+    }
+    if (options->collect_stats)
+    {
+        job->elapsed = stats_clock() - job->started;
+    }
+    stats_set_current(NULL);
+
+    pthread_mutex_destroy(&(job->lock));
+
+    if (job->done)
+    {
+        job->done(job, job->done_data);
+    }
+}
+
+static void
+job_retain(struct ThumbnailJob* job)
+{
+    pthread_mutex_lock(&(job->lock));
+    job->pending++;
+    pthread_mutex_unlock(&(job->lock));
+}
+
+static void
+job_release(struct ThumbnailJob* job)
+{
+    int pending;
+
+    pthread_mutex_lock(&(job->lock));
+    pending = --job->pending;
+    pthread_mutex_unlock(&(job->lock));
+
+    if (pending == 0)
+    {
+        job_finish(job);
+    }
+}
+
+/**
+ * Apply the job settings to a freshly opened #VideoFile
+ */
+static void
+prepare_video_file(struct ThumbnailJob* job, struct VideoFile* video_file)
+{
+    const struct ThumbnailOptions* options = job->options;
+
+    video_file->sample_step = options->sample_step;
+    video_file_set_candidate_window(video_file, options->candidate_window);
+    video_file_set_seek_decode(video_file, options->seek_decode);
+    /* the ranges split off later share the index of the first one, which
+     * matters when it could not be saved */
+    if (job->index)
+    {
+        video_file_share_index(video_file, job->index);
+    }
+    /* building an index would consume a pipe */
+    else if (options->use_index && video_file_is_seekable(video_file))
+    {
+        if (video_file_use_index(video_file, job->filename,
+                    options->index_dir) < 0)
+        {
+            LOG(WARNING, "No keyframe index for %s", job->filename);
+        }
+        else
+        {
+            job->index = seek_index_ref(video_file->index);
+        }
+    }
+    video_file_set_keyframes_only(video_file, options->keyframes_only);
+    if (options->num_sizes > 0)
+    {
+        struct VideoSize sizes[MAX_SNAPSHOT_SIZES];
+        int i;
+
+        for (i = 0; i < options->num_sizes; i++)
+        {
+            sizes[i].width = options->sizes[i].width;
+            sizes[i].height = options->sizes[i].height;
+        }
+        video_file_set_output_sizes(video_file, sizes, options->num_sizes,
+                options->scale_flags);
+    }
+    else
+    {
+        video_file_set_output_size(video_file, options->width,
+                options->height, options->scale_flags);
+    }
+}
+
+/**
+ * Name the image of a snapshot in one of the sizes
+ *
+ * @param stem output prefix and name of the snapshot without suffix
+ * @param index position in ThumbnailOptions::sizes
+ */
+static void
+snapshot_filename(struct ThumbnailJob* job, char* filename, size_t size,
+        const char* stem, int index)
+{
+    const struct ThumbnailOptions* options = job->options;
+    const char* suffix = image_get_suffix(options->image_format);
+
+    if (options->num_sizes > 0)
+    {
+        snprintf(filename, size, "%s_%s.%s", stem,
+                options->sizes[index].label, suffix);
+    }
+    else
+    {
+        snprintf(filename, size, "%s.%s", stem, suffix);
+    }
+}
+
+static void range_run(void* data);
+
+/**
+ * @return record of a snapshot position, or of the range itself if the job
+ * does not keep per-snapshot records
+ */
+static struct Stats*
+range_stats(struct Range* range, int position)
+{
+    struct ThumbnailJob* job = range->job;
+
+    return job->snapshot_stats ? &(job->snapshot_stats[position]) :
+        &(range->stats);
+}
+
+static void
+encode_done(void* data, int result)
+{
+    struct ThumbnailJob* job = (struct ThumbnailJob *)data;
+
+    if (result < 0)
+    {
+        job_fail(job);
+    }
+    job_release(job);
+}
+
+/**
+ * Queue a filled pipeline buffer for encoding
+ */
+static int
+submit_snapshot(struct ThumbnailJob* job, struct EncodeBuffer* buffer,
+        const char* filename)
+{
+    job_retain(job);
+    return encode_pipeline_submit(job->pipeline, buffer, filename,
+            job->options->image_format, job->sink, encode_done, job);
+}
+
+/**
+ * Convert the current frame into a pipeline buffer and queue it for
+ * encoding, so decoding continues while the image is written
+ */
+static int
+save_frame_async(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const char* filename)
+{
+    struct EncodeBuffer* buffer = NULL;
+
+    if (image_supports_yuv420(job->options->image_format))
+    {
+        buffer = encode_pipeline_acquire_yuv420(job->pipeline,
+                video_file->output_width, video_file->output_height);
+        return_if(buffer == NULL, -1);
+
+        if (video_file_convert_frame_yuv420(video_file, &(buffer->yuv)) < 0)
+        {
+            /* not 4:2:0, go through RGB */
+            encode_pipeline_release(job->pipeline, buffer);
+            buffer = NULL;
+        }
+    }
+
+    if (!buffer)
+    {
+        buffer = encode_pipeline_acquire(job->pipeline,
+                video_file->output_width, video_file->output_height);
+        return_if(buffer == NULL, -1);
+
+        if (video_file_convert_frame(video_file, buffer->data,
+                    video_file->output_width * 3) < 0)
+        {
+            encode_pipeline_release(job->pipeline, buffer);
+            return -1;
+        }
+    }
+
+    return submit_snapshot(job, buffer, filename);
+}
+
+/**
+ * Convert the current frame into pipeline buffers of all sizes, each
+ * scaled from the one before, and queue them for encoding
+ */
+static int
+save_sizes_async(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const char* stem)
+{
+    struct EncodeBuffer* previous;
+    char filename[1024];
+    int result = 0;
+    int n;
+
+    previous = encode_pipeline_acquire(job->pipeline,
+            video_file->output_width, video_file->output_height);
+    return_if(previous == NULL, -1);
+
+    if (video_file_convert_frame(video_file, previous->data,
+                video_file->output_width * 3) < 0)
+    {
+        encode_pipeline_release(job->pipeline, previous);
+        return -1;
+    }
+    snapshot_filename(job, filename, sizeof(filename), stem,
+            video_file->output_index);
+
+    for (n = 0; n < video_file->num_outputs; n++)
+    {
+        struct VideoOutput* output = &(video_file->outputs[n]);
+        struct EncodeBuffer* buffer;
+
+        /* the larger picture is only queued once it has been scaled down */
+        buffer = encode_pipeline_acquire(job->pipeline, output->width,
+                output->height);
+        if (buffer && video_file_scale_output(video_file, n, previous->data,
+                    buffer->data) < 0)
+        {
+            encode_pipeline_release(job->pipeline, buffer);
+            buffer = NULL;
+        }
+        if (!buffer)
+        {
+            encode_pipeline_release(job->pipeline, previous);
+            return -1;
+        }
+
+        if (submit_snapshot(job, previous, filename) < 0)
+        {
+            result = -1;
+        }
+        snapshot_filename(job, filename, sizeof(filename), stem,
+                output->index);
+        previous = buffer;
+    }
+
+    if (submit_snapshot(job, previous, filename) < 0)
+    {
+        result = -1;
+    }
+
+    return result;
+}
+
+/**
+ * Write the current frame from the decoding thread
+ */
+static int
+save_frame(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const char* filename)
+{
+    enum ImageFormat format = job->options->image_format;
+    struct YuvImage image;
+    uint8_t* data;
+    size_t size;
+    int result;
+
+    /* large frames are converted while they are encoded, a few lines at a
+     * time */
+    if (video_file_wants_bands(video_file, format))
+    {
+        if (!job->sink)
+        {
+            return video_file_save_frame_bands(video_file, filename, format);
+        }
+
+        return_if(video_file_encode_frame_bands(video_file, format, &data,
+                    &size) < 0, -1);
+        result = output_sink_write(job->sink, filename,
+                image_get_mime_type(format), data, size);
+        free(data);
+
+        return result;
+    }
+
+    /* skip the RGB conversion if the planes can be stored as they are */
+    if (image_supports_yuv420(job->options->image_format) &&
+            video_file_get_yuv420(video_file, &image) == 0)
+    {
+        if (job->sink)
+        {
+            return output_sink_write_yuv420(job->sink, filename, &image,
+                    job->options->image_format);
+        }
+        return image_save_yuv420(filename, &image,
+                job->options->image_format);
+    }
+
+    if (!job->sink)
+    {
+        return video_file_save_frame(video_file, filename,
+                job->options->image_format);
+    }
+
+    return_if(video_file_materialize_frame(video_file) < 0, -1);
+
+    return output_sink_write_image(job->sink, filename,
+            video_file->frame_rgb->data[0],
+            video_file->output_width, video_file->output_height,
+            job->options->image_format);
+}
+
+static int
+save_rgb(struct ThumbnailJob* job, const char* filename, uint8_t* buffer,
+        int width, int height)
+{
+    if (job->sink)
+    {
+        return output_sink_write_image(job->sink, filename, buffer, width,
+                height, job->options->image_format);
+    }
+
+    return image_save(filename, buffer, width, height,
+            job->options->image_format);
+}
+
+/**
+ * Write the current frame in all sizes from the decoding thread
+ */
+static int
+save_sizes(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const char* stem)
+{
+    char filename[1024];
+    int result = 0;
+    int n;
+
+    if (video_file_materialize_outputs(video_file) < 0)
+    {
+        LOG(ERROR, "Failed to convert snapshot %s", stem);
+        return -1;
+    }
+
+    snapshot_filename(job, filename, sizeof(filename), stem,
+            video_file->output_index);
+    if (save_rgb(job, filename, video_file->rgb_buffer,
+                video_file->output_width, video_file->output_height) < 0)
+    {
+        LOG(ERROR, "Failed to write %s", filename);
+        result = -1;
+    }
+
+    for (n = 0; n < video_file->num_outputs; n++)
+    {
+        struct VideoOutput* output = &(video_file->outputs[n]);
+
+        snapshot_filename(job, filename, sizeof(filename), stem,
+                output->index);
+        if (save_rgb(job, filename, output->rgb_buffer, output->width,
+                    output->height) < 0)
+        {
+            LOG(ERROR, "Failed to write %s", filename);
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+/**
+ * Write the current frame in all sizes, through the pipeline if there is
+ * one
+ *
+ * @param stem output prefix and name of the snapshot, see
+ * #snapshot_filename
+ */
+static void
+write_snapshot(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const char* stem)
+{
+    char filename[1024];
+
+    if (video_file->num_outputs > 0)
+    {
+        /* smaller sizes are scaled from the larger RGB pictures */
+        if (job->pipeline ? save_sizes_async(job, video_file, stem) < 0 :
+                save_sizes(job, video_file, stem) < 0)
+        {
+            LOG(ERROR, "Failed to write snapshot %s", stem);
+            job_fail(job);
+        }
+        return;
+    }
+
+    snapshot_filename(job, filename, sizeof(filename), stem,
+            video_file->output_index);
+    if (job->pipeline)
+    {
+        if (save_frame_async(job, video_file, filename) < 0)
+        {
+            LOG(ERROR, "Failed to queue %s", filename);
+            job_fail(job);
+        }
+    }
+    else if (save_frame(job, video_file, filename) < 0)
+    {
+        LOG(ERROR, "Failed to write %s", filename);
+        job_fail(job);
+    }
+}
+
+/**
+ * Write a picture of the output size converted earlier, in all sizes
+ */
+static void
+write_picture(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const char* stem, const uint8_t* picture)
+{
+    char filename[1024];
+    struct EncodeBuffer* buffer;
+
+    if (video_file_load_rgb(video_file, picture) < 0)
+    {
+        LOG(ERROR, "Failed to write snapshot %s", stem);
+        job_fail(job);
+        return;
+    }
+
+    if (!job->pipeline || video_file->num_outputs > 0)
+    {
+        if (save_sizes(job, video_file, stem) < 0)
+        {
+            job_fail(job);
+        }
+        return;
+    }
+
+    snapshot_filename(job, filename, sizeof(filename), stem,
+            video_file->output_index);
+    buffer = encode_pipeline_acquire(job->pipeline,
+            video_file->output_width, video_file->output_height);
+    if (!buffer)
+    {
+        LOG(ERROR, "Failed to queue %s", filename);
+        job_fail(job);
+        return;
+    }
+    memcpy(buffer->data, picture,
+            (size_t)video_file->output_width * video_file->output_height * 3);
+    if (submit_snapshot(job, buffer, filename) < 0)
+    {
+        LOG(ERROR, "Failed to queue %s", filename);
+        job_fail(job);
+    }
+}
+
+/**
+ * Hash the current frame for --dedup. Without it the hash is left out, as
+ * it may cost a scaling pass; the position report shows 0 then.
+ */
+static uint64_t
+dedup_hash(const struct ThumbnailOptions* options,
+        struct VideoFile* video_file)
+{
+    return options->dedup_distance >= 0 ?
+        video_file_get_dhash(video_file) : 0;
+}
+
+/**
+ * Check whether a picture looks like the last snapshot written
+ */
+static int
+dedup_match(const struct ThumbnailOptions* options,
+        const struct Dedup* dedup, uint64_t hash)
+{
+    return options->dedup_distance >= 0 && dedup->valid &&
+        histogram_dhash_distance(dedup->hash, hash) <=
+        options->dedup_distance;
+}
+
+static void
+dedup_remember(struct Dedup* dedup, uint64_t hash)
+{
+    dedup->hash = hash;
+    dedup->valid = 1;
+}
+
+/**
+ * Decode the frames following a near-duplicate until one differs from the
+ * last snapshot, staying clear of the next position
+ *
+ * @return 0 if such a frame is current, -1 otherwise
+ */
+static int
+dedup_find_alternative(struct ThumbnailJob* job, struct VideoFile* video_file,
+        const struct Dedup* dedup, uint64_t* hash)
+{
+    const struct ThumbnailOptions* options = job->options;
+    uint64_t tries = job->step > 1 ? MIN(DEDUP_TRIES, job->step - 1) : 0;
+    uint64_t i;
+
+    for (i = 0; i < tries; ++i)
+    {
+        return_if(video_file_decode_frame(video_file) < 0, -1);
+        if (options->skip_black_frames && video_file_is_black(video_file))
+        {
+            STATS_COUNT(STATS_FRAMES_BLACK, 1);
+            continue;
+        }
+
+        *hash = dedup_hash(options, video_file);
+        return_if(!dedup_match(options, dedup, *hash), 0);
+    }
+
+    return -1;
+}
+
+static void
+range_seek(struct Range* range, int target)
+{
+    struct ThumbnailJob* job = range->job;
+    uint64_t frame = target * job->step;
+
+    if (job->options->keyframes_only && !job->options->slow_seek)
+    {
+        video_file_seek_keyframe(range->video_file, frame);
+    }
+    else
+    {
+        video_file_seek_frame(range->video_file, frame,
+                job->options->slow_seek);
+    }
+}
+
+/**
+ * Find a position in (next, last) to split a range at. With a keyframe
+ * index the split is moved to the start of a GOP, so no GOP is decoded by
+ * two tasks.
+ *
+ * @return the first position of the new range or -1 if it cannot be split
+ */
+static int
+range_find_split(struct Range* range, int next)
+{
+    struct ThumbnailJob* job = range->job;
+    int middle = next + (range->last - next) / 2;
+    int i;
+
+    return_if(range->last - next < 2, -1);
+    return_if(range->video_file->index == NULL, middle);
+
+    for (i = middle; i < range->last; ++i)
+    {
+        if (video_file_get_gop(range->video_file, i * job->step) !=
+            video_file_get_gop(range->video_file, (i - 1) * job->step))
+        {
+            return i;
+        }
+    }
+    for (i = middle - 1; i > next; --i)
+    {
+        if (video_file_get_gop(range->video_file, i * job->step) !=
+            video_file_get_gop(range->video_file, (i - 1) * job->step))
+        {
+            return i;
+        }
+    }
+
+    return -1;
+}
+
+static void
+range_split(struct Range* range, int next)
+{
+    struct Range* split;
+    struct ThumbnailJob* job = range->job;
+    int first;
+
+    if (range->last - next < 2 || thread_pool_idle(job->pool) == 0)
+    {
+        return;
+    }
+
+    /* without an index, a slow seek decodes everything from the start of
+     * the file, so a split would repeat the work done here */
+    if (job->options->slow_seek && !range->video_file->index)
+    {
+        return;
+    }
+
+    first = range_find_split(range, next);
+    return_if(first < 0,);
+
+    split = (struct Range *)calloc(1, sizeof(struct Range));
+    return_if(split == NULL,);
+
+    split->job = job;
+    split->first = first;
+    split->last = range->last;
+
+    job_retain(job);
+
+    if (thread_pool_push(job->pool, range_run, split) < 0)
+    {
+        job_release(job);
+        free(split);
+        return;
+    }
+
+    range->last = split->first;
+}
+
+/**
+ * Write the frame decoded for position i of a range, or fill its tile of
+ * the contact sheet, and report it
+ *
+ * @param stem output prefix and name of the snapshot without suffix
+ * @param filename name of the image or tile in the report
+ */
+static void
+range_use_frame(struct Range* range, int i, const char* stem,
+        const char* filename)
+{
+    struct ThumbnailJob* job = range->job;
+    const struct ThumbnailOptions* options = job->options;
+    struct VideoFile* video_file = range->video_file;
+    char histogram_filename[1024];
+    uint64_t hash;
+
+    /* every tile of a contact sheet is needed */
+    hash = dedup_hash(options, video_file);
+    if (!job->sheet && dedup_match(options, &(range->dedup), hash) &&
+            dedup_find_alternative(job, video_file, &(range->dedup),
+                &hash) < 0)
+    {
+        STATS_COUNT(STATS_FRAMES_DUPLICATE, 1);
+        LOG(INFO, "Skipping %s, it looks like the previous snapshot",
+                filename);
+        return;
+    }
+
+    if (job->sheet)
+    {
+        uint8_t* tile = contact_sheet_get_tile(job->sheet, i,
+                video_file_get_time(video_file));
+
+        if (video_file_convert_frame(video_file, tile,
+                    job->sheet->linesize) < 0)
+        {
+            job_fail(job);
+        }
+    }
+    else
+    {
+        write_snapshot(job, video_file, stem);
+    }
+    STATS_COUNT(STATS_FRAMES_USED, 1);
+    dedup_remember(&(range->dedup), hash);
+
+    /* report the frame actually used, it may differ from the target */
+    printf("%s\t%"PRId64"\t%.3f\t%016"PRIx64"\n", filename,
+            video_file->pts, video_file_get_time(video_file), hash);
+
+    if (options->write_histogram)
+    {
+        snprintf(histogram_filename, sizeof(histogram_filename),
+                "%shistogram_%05d.dat", job->output_prefix, i);
+        histogram_save(video_file_get_histogram(video_file),
+                histogram_filename);
+        snprintf(histogram_filename, sizeof(histogram_filename),
+                "%shistogram_%05d.png", job->output_prefix, i);
+        histogram_render(video_file_get_histogram(video_file),
+                histogram_filename);
+    }
+}
+
+static void
+range_run(void* data)
+{
+    struct Range* range = (struct Range *)data;
+    struct ThumbnailJob* job = range->job;
+    const struct ThumbnailOptions* options = job->options;
+    struct VideoFile* video_file;
+    int i;
+
+    job_track(job, &(range->stats));
+
+    if (!range->video_file)
+    {
+        range->video_file = video_file_open_input(job->filename,
+                job->options->input_mode);
+        if (!range->video_file)
+        {
+            LOG(ERROR, "Error opening file %s", job->filename);
+            stats_set_current(NULL);
+            job_fail(job);
+            job_release(job);
+            free(range);
+            return;
+        }
+    }
+    video_file = range->video_file;
+    prepare_video_file(job, video_file);
+
+    if (range->first > 0)
+    {
+        job_track(job, range_stats(range, range->first));
+        range_seek(range, range->first);
+    }
+
+    for (i = range->first; i < range->last; ++i)
+    {
+        char stem[1024];
+        char filename[1024];
+        int decoded;
+
+        job_track(job, range_stats(range, i));
+        range_split(range, i);
+
+        if (job->sheet)
+        {
+            /* name the tile for the position report below */
+            snprintf(filename, sizeof(filename), "%ssheet.%s#%d",
+                    job->output_prefix,
+                    image_get_suffix(options->image_format), i);
+        }
+        else
+        {
+            snprintf(stem, sizeof(stem), "%sframe_%05d",
+                    job->output_prefix, i + options->offset);
+            /* the position report names the first size */
+            snapshot_filename(job, filename, sizeof(filename), stem, 0);
+        }
+
+        /* overlap the disk access of the next seek with decoding */
+        if (i + 1 < range->last)
+        {
+            video_file_prefetch(video_file, (i + 1) * job->step);
+        }
+
+        if (options->candidate_window > 0)
+        {
+            decoded = video_file_decode_representative(video_file);
+            if (decoded == 0 && options->skip_black_frames &&
+                    video_file_is_black(video_file))
+            {
+                STATS_COUNT(STATS_FRAMES_BLACK, 1);
+                decoded = video_file_decode_until_non_black(video_file);
+            }
+        }
+        else if (options->skip_black_frames)
+        {
+            decoded = video_file_decode_until_non_black(video_file);
+        }
+        else
+        {
+            decoded = video_file_decode_frame(video_file);
+        }
+
+        /* at the end of the stream or after a decoding error, the picture
+         * is the one of an earlier position */
+        if (decoded < 0)
+        {
+            LOG(WARNING, "No frame for %s in %s", filename, job->filename);
+        }
+        else
+        {
+            range_use_frame(range, i, stem, filename);
+        }
+
+        if (i + 1 < range->last)
+        {
+            job_track(job, range_stats(range, i + 1));
+            range_seek(range, i + 1);
+        }
+    }
+
+    job_track(job, &(range->stats));
+    video_file_close(video_file);
+    stats_set_current(NULL);
+
+    pthread_mutex_lock(&(job->lock));
+    stats_merge(&(job->stats), &(range->stats));
+    pthread_mutex_unlock(&(job->lock));
+
+    free(range);
+    job_release(job);
+}
+
+/**
+ * Pick the reduction for decoding in shots mode. The frames written are the
+ * ones analysed, so they are decoded large enough for the analysis and for
+ * the output sizes given explicitly; without one, the snapshots come out at
+ * the reduced size.
+ */
+static int
+shots_lowres(struct ThumbnailJob* job, struct VideoFile* video_file)
+{
+    const struct ThumbnailOptions* options = job->options;
+    int width = MAX(SHOT_ANALYSIS_WIDTH, options->width);
+    int height = options->height;
+    int lowres = 0;
+    int i;
+
+    for (i = 0; i < options->num_sizes; i++)
+    {
+        /* --size=full */
+        return_if(options->sizes[i].width == 0 &&
+                options->sizes[i].height == 0, 0);
+        width = MAX(width, options->sizes[i].width);
+        height = MAX(height, options->sizes[i].height);
+    }
+
+    while (lowres < 3 &&
+            (video_file->width >> (lowres + 1)) >= width &&
+            (video_file->height >> (lowres + 1)) >= height)
+    {
+        lowres++;
+    }
+
+    return lowres;
+}
+
+/**
+ * Decode the whole file once and write the first settled frame of every
+ * shot. Decoding runs at reduced resolution where the codec supports it, see
+ * #shots_lowres, and the histograms only sample a few hundred columns.
+ */
+static void
+shots_run(struct ThumbnailJob* job, struct VideoFile* video_file)
+{
+    const struct ThumbnailOptions* options = job->options;
+    struct ShotDetector detector;
+    struct Histogram histogram;
+    struct Dedup dedup = { 0, 0 };
+    int sample_step;
+    int shots = 0;
+
+    sample_step = MAX(options->sample_step,
+            video_file->width / SHOT_ANALYSIS_WIDTH);
+    shot_detector_init(&detector);
+
+    while (video_file_decode_frame(video_file) == 0)
+    {
+        char stem[1024];
+        char filename[1024];
+        uint64_t hash;
+
+        if (video_file_sample_histogram(video_file, sample_step,
+                    &histogram) < 0 ||
+                !shot_detector_push(&detector, &histogram))
+        {
+            continue;
+        }
+
+        if (options->skip_black_frames && video_file_is_black(video_file))
+        {
+            STATS_COUNT(STATS_FRAMES_BLACK, 1);
+            continue;
+        }
+
+        /* a cut back to an earlier scene */
+        hash = dedup_hash(options, video_file);
+        if (dedup_match(options, &dedup, hash))
+        {
+            STATS_COUNT(STATS_FRAMES_DUPLICATE, 1);
+            continue;
+        }
+        dedup_remember(&dedup, hash);
+
+        snprintf(stem, sizeof(stem), "%sshot_%05d", job->output_prefix,
+                shots + options->offset);
+        snapshot_filename(job, filename, sizeof(filename), stem, 0);
+        write_snapshot(job, video_file, stem);
+        STATS_COUNT(STATS_FRAMES_USED, 1);
+        printf("%s\t%"PRId64"\t%.3f\t%016"PRIx64"\n", filename,
+                video_file->pts, video_file_get_time(video_file), hash);
+        shots++;
+    }
+    LOG(INFO, "%d shots in %s", shots, job->filename);
+
+    video_file_close(video_file);
+    stats_set_current(NULL);
+    job_release(job);
+}
+
+/**
+ * Shrink the output sizes of a stream so that the pictures kept by
+ * #stream_run fit into #STREAM_RESERVOIR_BYTES. A stream cannot be read
+ * again, so the pictures are kept at the size they are written in.
+ *
+ * @return 0 on success
+ */
+static int
+stream_fit_reservoir(struct ThumbnailJob* job, struct VideoFile* video_file)
+{
+    const struct ThumbnailOptions* options = job->options;
+    struct VideoSize sizes[MAX_SNAPSHOT_SIZES];
+    double bytes;
+    double scale;
+    int count;
+    int i;
+
+    bytes = 2.0 * options->num_pics * video_file->output_width *
+        video_file->output_height * 3;
+    if (bytes <= STREAM_RESERVOIR_BYTES)
+    {
+        return 0;
+    }
+    scale = sqrt(STREAM_RESERVOIR_BYTES / bytes);
+
+    /* all sizes shrink alike, so they keep their order */
+    count = options->num_sizes > 0 ? options->num_sizes : 1;
+    sizes[video_file->output_index].width = video_file->output_width;
+    sizes[video_file->output_index].height = video_file->output_height;
+    for (i = 0; i < video_file->num_outputs; i++)
+    {
+        sizes[video_file->outputs[i].index].width =
+            video_file->outputs[i].width;
+        sizes[video_file->outputs[i].index].height =
+            video_file->outputs[i].height;
+    }
+    for (i = 0; i < count; i++)
+    {
+        /* a bound of 0 would mean the size of the video */
+        sizes[i].width = MAX(2, (int)(sizes[i].width * scale));
+        sizes[i].height = MAX(2, (int)(sizes[i].height * scale));
+    }
+
+    LOG(WARNING, "Reducing the snapshots of %s to %dx%d, %d pictures of a "
+            "stream that cannot be seeked are kept in memory", job->filename,
+            sizes[video_file->output_index].width,
+            sizes[video_file->output_index].height, 2 * options->num_pics);
+
+    if (options->num_sizes > 0)
+    {
+        return video_file_set_output_sizes(video_file, sizes, count,
+                options->scale_flags);
+    }
+    return video_file_set_output_size(video_file, sizes[0].width,
+            sizes[0].height, options->scale_flags);
+}
+
+/**
+ * Decode a file that cannot be seeked, e.g. a pipe, in a single pass. The
+ * output size pictures of evenly spaced frames are kept in a #Reservoir
+ * whose spacing grows with the stream, and the final selection is written
+ * once the stream ends. #stream_fit_reservoir bounds the memory this takes.
+ */
+static void
+stream_run(struct ThumbnailJob* job, struct VideoFile* video_file)
+{
+    const struct ThumbnailOptions* options = job->options;
+    struct Reservoir reservoir;
+    struct Dedup dedup = { 0, 0 };
+    int64_t frame;
+    double duration = 0.0;
+    int i;
+
+    LOG(INFO, "%s cannot be seeked, reading it in one pass", job->filename);
+
+    if (reservoir_init(&reservoir, options->num_pics,
+                (size_t)video_file->output_width *
+                video_file->output_height * 3) < 0)
+    {
+        LOG(ERROR, "%s", "Failed to set up frame reservoir");
+        video_file_close(video_file);
+        stats_set_current(NULL);
+        job_fail(job);
+        job_release(job);
+        return;
+    }
+
+    for (frame = 0; video_file_decode_frame(video_file) == 0; frame++)
+    {
+        struct ReservoirSample* sample;
+
+        duration = video_file_get_time(video_file);
+        if (!reservoir_wants(&reservoir, frame))
+        {
+            continue;
+        }
+
+        /* a black frame leaves the sample due for the next one */
+        if (options->skip_black_frames && video_file_is_black(video_file))
+        {
+            STATS_COUNT(STATS_FRAMES_BLACK, 1);
+            continue;
+        }
+
+        sample = reservoir_add(&reservoir, frame, video_file->pts, duration);
+        if (!sample)
+        {
+            continue;
+        }
+        sample->hash = dedup_hash(options, video_file);
+        if (video_file_convert_frame(video_file, sample->picture,
+                    video_file->output_width * 3) < 0)
+        {
+            reservoir_drop_last(&reservoir);
+        }
+    }
+
+    if (job->sheet)
+    {
+        job->sheet->duration = duration;
+    }
+
+    for (i = 0; i < options->num_pics; ++i)
+    {
+        const struct ReservoirSample* sample;
+        const struct ReservoirSample* end;
+        char stem[1024];
+        char filename[1024];
+
+        sample = reservoir_select(&reservoir, options->num_pics, i);
+        if (!sample)
+        {
+            LOG(WARNING, "Only %d frames in %s", i, job->filename);
+            break;
+        }
+
+        if (job->sheet)
+        {
+            uint8_t* tile = contact_sheet_get_tile(job->sheet, i,
+                    sample->time);
+            int line_size = video_file->output_width * 3;
+            int y;
+
+            for (y = 0; y < video_file->output_height; y++)
+            {
+                memcpy(tile + (size_t)y * job->sheet->linesize,
+                        sample->picture + (size_t)y * line_size, line_size);
+            }
+            snprintf(filename, sizeof(filename), "%ssheet.%s#%d",
+                    job->output_prefix,
+                    image_get_suffix(options->image_format), i);
+        }
+        else
+        {
+            snprintf(stem, sizeof(stem), "%sframe_%05d",
+                    job->output_prefix, i + options->offset);
+            snapshot_filename(job, filename, sizeof(filename), stem, 0);
+
+            /* the samples up to the next selection are the alternatives */
+            end = reservoir_select(&reservoir, options->num_pics, i + 1);
+            if (!end)
+            {
+                end = reservoir.samples + reservoir.count;
+            }
+            while (sample < end && dedup_match(options, &dedup, sample->hash))
+            {
+                sample++;
+            }
+            if (sample == end)
+            {
+                STATS_COUNT(STATS_FRAMES_DUPLICATE, 1);
+                LOG(INFO, "Skipping %s, it looks like the previous snapshot",
+                        filename);
+                continue;
+            }
+            dedup_remember(&dedup, sample->hash);
+            write_picture(job, video_file, stem, sample->picture);
+        }
+        STATS_COUNT(STATS_FRAMES_USED, 1);
+
+        printf("%s\t%"PRId64"\t%.3f\t%016"PRIx64"\n", filename,
+                sample->pts, sample->time, sample->hash);
+    }
+
+    reservoir_free(&reservoir);
+    video_file_close(video_file);
+    stats_set_current(NULL);
+    job_release(job);
+}
+
+/**
+ * Create the contact sheet of a job for the output size of video_file
+ *
+ * @return 0 on success
+ */
+static int
+job_create_sheet(struct ThumbnailJob* job, struct VideoFile* video_file)
+{
+    job->sheet = contact_sheet_new(job->options->columns,
+            job->options->rows,
+            video_file->output_width,
+            video_file->output_height);
+    if (!job->sheet)
+    {
+        LOG(ERROR, "%s", "Failed to create contact sheet");
+        return -1;
+    }
+    job->sheet->duration = video_file->video_stream->duration *
+        av_q2d(video_file->video_stream->time_base);
+
+    return 0;
+}
+
+static void
+job_start(void* data)
+{
+    struct ThumbnailJob* job = (struct ThumbnailJob *)data;
+    struct Range* range;
+    struct VideoFile* video_file;
+
+    job->started = stats_clock();
+
+    /* streamed images need no directories, histograms are still files */
+    if ((!job->sink || job->options->write_histogram) &&
+            make_prefix_directories(job->output_prefix) < 0)
+    {
+        LOG(ERROR, "Failed to create output directory for %s",
+                job->output_prefix);
+        job_fail(job);
+        job_release(job);
+        return;
+    }
+
+    /* the first range takes over from here */
+    job_track(job, &(job->stats));
+
+    video_file = video_file_open_input(job->filename,
+            job->options->input_mode);
+    if (!video_file)
+    {
+        LOG(ERROR, "Error opening file %s", job->filename);
+        stats_set_current(NULL);
+        job_fail(job);
+        job_release(job);
+        return;
+    }
+
+    /* Dump information about file onto standard error */
+    av_dump_format(video_file->format_ctx, 0, job->filename, 0);
+
+    if (job->options->shots)
+    {
+        video_file_set_lowres(video_file, shots_lowres(job, video_file));
+        prepare_video_file(job, video_file);
+        shots_run(job, video_file);
+        return;
+    }
+
+    if (!video_file_is_seekable(video_file))
+    {
+        prepare_video_file(job, video_file);
+        if (stream_fit_reservoir(job, video_file) < 0 ||
+                (job->options->columns > 0 &&
+                 job_create_sheet(job, video_file) < 0))
+        {
+            video_file_close(video_file);
+            stats_set_current(NULL);
+            job_fail(job);
+            job_release(job);
+            return;
+        }
+        stream_run(job, video_file);
+        return;
+    }
+
+    job->step = video_file->video_stream->duration / job->options->num_pics;
+
+    prepare_video_file(job, video_file);
+    if (video_file->index)
+    {
+        int gops = 0;
+        int64_t last_gop = AV_NOPTS_VALUE;
+        int i;
+
+        for (i = 0; i < job->options->num_pics; ++i)
+        {
+            int64_t gop = video_file_get_gop(video_file, i * job->step);
+            if (gop != last_gop)
+            {
+                gops++;
+                last_gop = gop;
+            }
+        }
+        LOG(INFO, "%d positions fall into %d GOPs", job->options->num_pics,
+                gops);
+    }
+
+    if (job->options->columns > 0 && job_create_sheet(job, video_file) < 0)
+    {
+        video_file_close(video_file);
+        stats_set_current(NULL);
+        job_fail(job);
+        job_release(job);
+        return;
+    }
+
+    range = (struct Range *)calloc(1, sizeof(struct Range));
+    if (!range)
+    {
+        video_file_close(video_file);
+        stats_set_current(NULL);
+        job_fail(job);
+        job_release(job);
+        return;
+    }
+
+    /* the first range reuses the file that has been opened above */
+    range->job = job;
+    range->video_file = video_file;
+    range->first = 0;
+    range->last = job->options->num_pics;
+    range_run(range);
+}
+
+void
+thumbnailer_init(void)
+{
+    /* Register all formats and codecs */
+    av_register_all();
+
+    /* codec opening is not thread-safe without a lock manager */
+    av_lockmgr_register(lock_manager);
+}
+
+int
+thumbnailer_submit(struct ThreadPool* pool, struct ThumbnailJob* job)
+{
+    return_if(pool == NULL, -1);
+    return_if(job == NULL, -1);
+    return_if(job->filename == NULL, -1);
+    return_if(job->options == NULL, -1);
+    return_if(job->options->num_pics == 0, -1);
+
+    if (job->output_prefix == NULL)
+    {
+        job->output_prefix = "";
+    }
+    job->result = 0;
+    job->sheet = NULL;
+    job->index = NULL;
+    job->pool = pool;
+    job->pending = 1;
+    memset(&(job->stats), 0, sizeof(job->stats));
+    job->snapshot_stats = NULL;
+    job->elapsed = 0;
+    if (job->options->collect_stats && !job->options->shots)
+    {
+        job->snapshot_stats = (struct Stats *)calloc(job->options->num_pics,
+                sizeof(struct Stats));
+        return_if(job->snapshot_stats == NULL, -1);
+    }
+    pthread_mutex_init(&(job->lock), NULL);
+
+    if (thread_pool_push(pool, job_start, job) < 0)
+    {
+        pthread_mutex_destroy(&(job->lock));
+        job->result = -1;
+        return -1;
+    }
+
+    return 0;
+}
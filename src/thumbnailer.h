@@ -0,0 +1,224 @@
+/*  Copyright (c) 2008 Jens Georg.
+ 
+    This file is part of tn.
+
+    tn is free software: you can redistribute it and/or modify
+    it under the terms of the GNU General Public License as published by
+    the Free Software Foundation, either version 3 of the License, or
+    (at your option) any later version.
+
+    tn is distributed in the hope that it will be useful,
+    but WITHOUT ANY WARRANTY; without even the implied warranty of
+    MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+    GNU General Public License for more details.
+
+    You should have received a copy of the GNU General Public License
+    along with tn.  If not, see <http://www.gnu.org/licenses/>.
+*/
+
+#ifndef __THUMBNAILER_H
+#define __THUMBNAILER_H
+
+#include <pthread.h>
+#include <stdint.h>
+
+#include "image.h"
+#include "index.h"
+#include "input.h"
+#include "pipeline.h"
+#include "sheet.h"
+#include "sink.h"
+#include "stats.h"
+#include "threadpool.h"
+
+/** Maximum number of sizes a snapshot can be written in */
+#define MAX_SNAPSHOT_SIZES 8
+
+/**
+ * One of several sizes every snapshot is written in
+ */
+struct SnapshotSize
+{
+    /** bounds like ThumbnailOptions::width and height */
+    int width;
+    int height;
+    /** appended to the file names of this size */
+    char label[16];
+};
+
+/**
+ * Settings for generating the snapshots of one video file.
+ */
+struct ThumbnailOptions
+{
+    /** Flag to enable black frame detection heuristics */
+    int skip_black_frames;
+
+    /** Only every sample_step-th line and column is checked for black
+     * frames */
+    int sample_step;
+
+    /** Number of frames before each position to pick the most
+     * representative one from, 0 to take the frame at the position */
+    int candidate_window;
+
+    /** Snapshots within this Hamming distance of the perceptual hash of
+     * the previous one are replaced by a nearby frame or dropped, -1 to
+     * keep all */
+    int dedup_distance;
+
+    /** Flag to write histogram data to disk */
+    int write_histogram;
+
+    /** Flag to use decoding instead of seeking */
+    int slow_seek;
+
+    /** Flag to take the keyframe before each position instead of seeking
+     * exactly */
+    int keyframes_only;
+
+    /** Quality of the frames decoded on the way to each position, a
+     * member of #SeekDecode */
+    int seek_decode;
+
+    /** Flag to seek using a persistent keyframe index */
+    int use_index;
+
+    /** Directory for keyframe indexes, NULL to put them next to the video */
+    const char* index_dir;
+
+    /** I/O backend for reading the video files */
+    enum InputMode input_mode;
+
+    /** Target image format for snapshots */
+    enum ImageFormat image_format;
+
+    /** Maximum snapshot width, 0 to derive it from height */
+    int width;
+
+    /** Maximum snapshot height, 0 to derive it from width */
+    int height;
+
+    /** swscale algorithm for the RGB conversion */
+    int scale_flags;
+
+    /** Sizes every snapshot is written in, each to files of its own. All
+     * sizes come from one decode; if there are none, width and height give
+     * the only size. */
+    struct SnapshotSize sizes[MAX_SNAPSHOT_SIZES];
+    int num_sizes;
+
+    /** Number of tile columns of a contact sheet, 0 to write single
+     * snapshots */
+    int columns;
+
+    /** Number of tile rows of a contact sheet */
+    int rows;
+
+    /** Flag to write a WebVTT sidecar for the contact sheet */
+    int write_vtt;
+
+    /** Flag to write the first settled frame of every shot instead of
+     * evenly spaced snapshots */
+    int shots;
+
+    /** Number of snapshots to create */
+    uint8_t num_pics;
+
+    /** Number of the first output file */
+    uint32_t offset;
+
+    /** Number of worker threads */
+    int num_threads;
+
+    /** Number of encoder threads, 0 to encode on the worker threads */
+    int num_encoders;
+
+    /** Flag to collect timings and counters in ThumbnailJob::stats */
+    int collect_stats;
+};
+
+struct ThumbnailJob;
+
+/**
+ * Called when a #ThumbnailJob is done; the job may be released from here
+ */
+typedef void (*ThumbnailDoneFunc)(struct ThumbnailJob* job, void* data);
+
+/**
+ * Snapshot generation of one video file, processed by a #ThreadPool
+ */
+struct ThumbnailJob
+{
+    /** name of the video file */
+    const char* filename;
+
+    /** prepended to all output file names, may contain directories */
+    const char* output_prefix;
+
+    /** settings for this file */
+    const struct ThumbnailOptions* options;
+
+    /** encoder threads writing the snapshots, NULL to write them from the
+     * decoding thread */
+    struct EncodePipeline* pipeline;
+
+    /** stream taking all images, NULL to write one file per image. File
+     * names are used as names inside the stream. */
+    struct OutputSink* sink;
+
+    /** function called once result is set, may be NULL */
+    ThumbnailDoneFunc done;
+    void* done_data;
+
+    /** 0 once all snapshots have been written, -1 on failure */
+    int result;
+
+    /** totals of the file if ThumbnailOptions::collect_stats is set */
+    struct Stats stats;
+
+    /** the part of stats spent on each snapshot position, NULL in shots
+     * mode or without ThumbnailOptions::collect_stats */
+    struct Stats* snapshot_stats;
+
+    /** wall clock time from start to finish in nanoseconds */
+    uint64_t elapsed;
+
+    /* private */
+    struct ThreadPool* pool;
+    struct ContactSheet* sheet;
+    /** keyframe index shared by the decoders of all ranges */
+    struct SeekIndex* index;
+    pthread_mutex_t lock;
+    int pending;
+    uint64_t step;
+    uint64_t started;
+};
+
+/**
+ * Prepare libav for use from several threads. Has to be called once before
+ * any other function of this module.
+ *
+ * \ingroup video
+ */
+void
+thumbnailer_init(void);
+
+/**
+ * Queue the snapshot generation of a video file. The snapshot positions are
+ * processed in order by a single task. Whenever a worker of the pool runs
+ * out of work, the task hands the second half of its remaining positions
+ * over to a new task with a decoder of its own, so long files end up spread
+ * across all threads while short files are not split needlessly.
+ *
+ * job has to stay valid until the pool is done or its done function has
+ * been called; its result is set when the last of its tasks has finished.
+ *
+ * @param pool a #ThreadPool
+ * @param job a #ThumbnailJob with filename, output_prefix and options set
+ * @return 0 on success; otherwise the done function of job is not called
+ * \ingroup video
+ */
+int
+thumbnailer_submit(struct ThreadPool* pool, struct ThumbnailJob* job);
+#endif /* __THUMBNAILER_H */
@@ -25,6 +25,7 @@
  * \li Seeking for fast snapshot generation
  * \li Black frame detection
  * \li Output to multiple image formats
+ * \li Streaming all images as one tar or multipart archive
  * \section sec_install Installation
  */
 
@@ -49,137 +50,711 @@
 #   include <avformat.h>
 #endif
 
+#include <getopt.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <unistd.h>
 
-#include "histogram.h"
+#include "recycle.h"
+#include "server.h"
+#include "thumbnailer.h"
 #include "util.h"
 #include "video.h"
 
-/** Flag to enable black frame detection heuristics; can be changed by
- * commandline parameter <tt>-b</tt>. Default is off */
-int skip_black_frames = 0;
+/**
+ * Snapshot settings, changed by commandline parameters:
+ * \li <tt>-b</tt> enables black frame detection heuristics
+ * \li <tt>-S</tt> only checks every n-th line and column for black frames
+ * \li <tt>-r</tt> picks the most representative of the last n frames before
+ * each position, avoiding fades and transitions
+ * \li <tt>--dedup</tt> replaces a snapshot that looks like the previous one,
+ * by its perceptual hash, with a frame shortly after it or drops it
+ * \li <tt>-t</tt> writes histogram data to disk
+ * \li <tt>-s</tt> uses decoding instead of seeking. This is necessary for
+ * packed bitstream files, MPEG1 and MPEG2
+ * \li <tt>-k</tt> uses the keyframe before each position, one intra frame
+ * decode per snapshot
+ * \li <tt>--seek-decode</tt> decodes the frames on the way to each position
+ * at lower quality
+ * \li <tt>-I</tt> seeks using a keyframe index kept next to the video or, with
+ * <tt>-c</tt>, in a cache directory
+ * \li <tt>-i</tt> selects the target image format. Default is PPM because it
+ * does not depend on additional libraries
+ * \li <tt>-W</tt> and <tt>-H</tt> limit the snapshot size, <tt>-a</tt>
+ * selects the scaling algorithm
+ * \li <tt>--size</tt> writes every snapshot in several sizes from a single
+ * decode, smaller sizes being scaled from larger ones
+ * \li <tt>-g</tt> tiles all snapshots into one contact sheet, <tt>-V</tt>
+ * adds a WebVTT file mapping time ranges to tiles
+ * \li <tt>-j</tt> sets the number of decoding threads
+ * \li <tt>-e</tt> sets the number of encoder threads working in parallel to
+ * decoding
+ * \li <tt>-O</tt> writes all images into one tar or multipart stream
+ * \li <tt>--shots</tt> writes one snapshot per shot instead of evenly spaced
+ * ones, decoded at reduced size unless <tt>-W</tt>, <tt>-H</tt> or
+ * <tt>--size</tt> ask for more
+ * \li <tt>--io</tt> reads the video through a memory map or large buffered
+ * reads, prefetching the data of the next seek while decoding
+ * \li <tt>--stats=json</tt> reports where the time went, per file and per
+ * snapshot, to stderr or the file given with <tt>--stats-file</tt>
+ * \li a file name of <tt>-</tt> reads the video from stdin; pipes and files
+ * of unknown duration are decoded in a single pass, with the snapshots
+ * shrunk where needed to keep twice their number within 128 MiB
+ * \li <tt>--serve</tt> keeps running and takes requests from a Unix domain
+ * socket or stdin, see #server_run
+ */
+struct ThumbnailOptions options = {
+    .skip_black_frames = 0,
+    .sample_step = 1,
+    .candidate_window = 0,
+    .dedup_distance = -1,
+    .write_histogram = 0,
+    .slow_seek = 0,
+    .keyframes_only = 0,
+    .seek_decode = SEEK_DECODE_EXACT,
+    .use_index = 0,
+    .index_dir = NULL,
+    .input_mode = INPUT_MODE_DEFAULT,
+    .image_format = IMAGE_FORMAT_PPM,
+    .width = 0,
+    .height = 0,
+    .scale_flags = SWS_BICUBIC,
+    .num_sizes = 0,
+    .columns = 0,
+    .rows = 0,
+    .write_vtt = 0,
+    .shots = 0,
+    .num_pics = 32,
+    .offset = 0,
+    .num_threads = 1,
+    .num_encoders = 0,
+    .collect_stats = 0
+};
+
+/** Prefix for output file names; can be changed by commandline parameter
+ * <tt>-p</tt>. In batch mode, every file gets its own directory below it */
+const char* output_prefix = "";
+
+/** List of files to process, from the commandline and the manifest given
+ * with <tt>-f</tt> */
+struct ThumbnailJob* jobs = NULL;
+int num_jobs = 0;
 
-/** Flag to write histogram data to disk; can be changed by commandline
- * parameter <tt>-t</tt>. Default is off */
-int write_histogram = 0;
+static int
+add_job(const char* filename, const char* prefix)
+{
+    struct ThumbnailJob* new_jobs;
 
-/** Flag to use decoding instead of seeking. This is necessary for packed
- * bitstream files, MPEG1 and MPEG2. Can be changed by commandline parameter
- * <tt>-s</tt>. Default is off */
-int slow_seek = 0;
+    new_jobs = (struct ThumbnailJob *)realloc(jobs,
+            (num_jobs + 1) * sizeof(struct ThumbnailJob));
+    return_if(new_jobs == NULL, -1);
+
+    jobs = new_jobs;
+    memset(&(jobs[num_jobs]), 0, sizeof(struct ThumbnailJob));
+    jobs[num_jobs].filename = strdup(filename);
+    jobs[num_jobs].output_prefix = prefix ? strdup(prefix) : NULL;
+    jobs[num_jobs].options = &options;
+    num_jobs++;
+
+    return 0;
+}
 
 /**
- * Target image format for snapshots. can be changed by using commandline
- * parameter <tt>-i</tt>. Default is PPM because it does not depend on
- * additional libraries
+ * Check whether another job writes to an output prefix already
  */
-enum ImageFormat image_format = IMAGE_FORMAT_PPM;
-uint8_t num_pics = 32;
-uint32_t offset = 0;
+static int
+prefix_taken(const char* prefix, int except)
+{
+    int i;
+
+    for (i = 0; i < num_jobs; ++i)
+    {
+        if (i != except && jobs[i].output_prefix &&
+                !strcmp(jobs[i].output_prefix, prefix))
+        {
+            return 1;
+        }
+    }
+
+    return 0;
+}
+
+/**
+ * Read a manifest of files to process. Every line holds a file name,
+ * optionally followed by a tab and the output prefix for this file.
+ */
+static int
+read_manifest(const char* manifest)
+{
+    FILE* f;
+    char line[2048];
+
+    if (!strcmp(manifest, "-"))
+    {
+        f = stdin;
+    }
+    else
+    {
+        f = fopen(manifest, "r");
+    }
+    return_if(f == NULL, -1);
+
+    while (fgets(line, sizeof(line), f))
+    {
+        char* prefix;
+
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#')
+        {
+            continue;
+        }
+
+        prefix = strchr(line, '\t');
+        if (prefix)
+        {
+            *prefix++ = '\0';
+        }
+        add_job(line, prefix);
+    }
+
+    if (f != stdin)
+    {
+        fclose(f);
+    }
+
+    return 0;
+}
+
+/** Values of options without a short form */
+enum LongOption
+{
+    OPTION_SHOTS = 256,
+    OPTION_IO,
+    OPTION_STATS,
+    OPTION_STATS_FILE,
+    OPTION_SERVE,
+    OPTION_SIZE,
+    OPTION_SEEK_DECODE,
+    OPTION_DEDUP
+};
+
+static const struct option long_options[] = {
+    { "shots", no_argument, NULL, OPTION_SHOTS },
+    { "io", required_argument, NULL, OPTION_IO },
+    { "stats", required_argument, NULL, OPTION_STATS },
+    { "stats-file", required_argument, NULL, OPTION_STATS_FILE },
+    { "serve", required_argument, NULL, OPTION_SERVE },
+    { "size", required_argument, NULL, OPTION_SIZE },
+    { "seek-decode", required_argument, NULL, OPTION_SEEK_DECODE },
+    { "dedup", required_argument, NULL, OPTION_DEDUP },
+    { "help", no_argument, NULL, 'h' },
+    { NULL, 0, NULL, 0 }
+};
+
+/**
+ * Parse the argument of --size: "full", "W", "xH" or "WxH"
+ *
+ * @return 0 on success
+ */
+static int
+parse_size(const char* spec, struct SnapshotSize* size)
+{
+    const char* c = spec;
+    char* end;
+
+    return_if(*spec == '\0' || strlen(spec) >= sizeof(size->label), -1);
+
+    size->width = 0;
+    size->height = 0;
+    if (strcmp(spec, "full"))
+    {
+        if (*c != 'x')
+        {
+            size->width = strtol(c, &end, 10);
+            return_if(end == c || size->width < 1, -1);
+            c = end;
+        }
+        if (*c == 'x')
+        {
+            size->height = strtol(c + 1, &end, 10);
+            return_if(end == c + 1 || size->height < 1, -1);
+            c = end;
+        }
+        return_if(*c != '\0', -1);
+    }
+    /* the spelling becomes part of the file names */
+    strcpy(size->label, spec);
+
+    return 0;
+}
+
+static void
+write_json_string(FILE* f, const char* string)
+{
+    const unsigned char* c;
+
+    fputc('"', f);
+    for (c = (const unsigned char *)string; *c; c++)
+    {
+        if (*c == '"' || *c == '\\')
+        {
+            fprintf(f, "\\%c", *c);
+        }
+        else if (*c < 0x20)
+        {
+            fprintf(f, "\\u%04x", *c);
+        }
+        else
+        {
+            fputc(*c, f);
+        }
+    }
+    fputc('"', f);
+}
+
+/**
+ * Dump the statistics of all jobs as one JSON document
+ */
+static int
+write_stats(const char* filename)
+{
+    FILE* f = stderr;
+    int i, j;
+
+    if (filename)
+    {
+        f = fopen(filename, "w");
+        return_if(f == NULL, -1);
+    }
+
+    fprintf(f, "{\"version\": ");
+    write_json_string(f, VERSION);
+    fprintf(f, ", \"files\": [");
+    for (i = 0; i < num_jobs; ++i)
+    {
+        fprintf(f, "%s\n  {\"file\": ", i > 0 ? "," : "");
+        write_json_string(f, jobs[i].filename);
+        fprintf(f, ", \"result\": %d, \"elapsed_ms\": %.3f, ",
+                jobs[i].result, jobs[i].elapsed / 1e6);
+        stats_write_json(f, &(jobs[i].stats));
+        fprintf(f, ",\n   \"snapshots\": [");
+        for (j = 0; jobs[i].snapshot_stats && j < options.num_pics; ++j)
+        {
+            fprintf(f, "%s\n    {\"index\": %d, ", j > 0 ? "," : "", j);
+            stats_write_json(f, &(jobs[i].snapshot_stats[j]));
+            fprintf(f, "}");
+        }
+        fprintf(f, "]}");
+    }
+    fprintf(f, "\n]}\n");
+
+    if (f != stderr)
+    {
+        return_if(fclose(f) != 0, -1);
+    }
+
+    return 0;
+}
 
 int main(int argc, char *argv[]) {
-    int             i;
     int opt;
-    uint64_t        step;
-    struct VideoFile* video_file;
+    int i;
+    int failed = 0;
+    int readers;
+    struct ThreadPool* pool;
+    struct EncodePipeline* pipeline = NULL;
+    struct OutputSink* sink = NULL;
+    const char* sink_spec = NULL;
+    const char* manifest = NULL;
+    const char* stats_file = NULL;
+    const char* serve_address = NULL;
 
-    /* Register all formats and codecs */
-    av_register_all();
+    thumbnailer_init();
 
     LOG(INFO, "Tn version %s", VERSION);
 
-    while ((opt = getopt(argc, argv, "bthso:i:n:")) != -1)
+    while ((opt = getopt_long(argc, argv,
+                    "bthskIc:o:i:n:j:e:p:f:O:r:S:W:H:a:g:V",
+                    long_options, NULL)) != -1)
     {
         switch (opt)
         {
             case 't':
-                write_histogram = 1;
+                options.write_histogram = 1;
                 break;
             case 'i':
-                image_format = image_get_format (optarg);
+                options.image_format = image_get_format (optarg);
                 break;
             case 'n':
-                num_pics = atoi(optarg);
-                if (num_pics == 0)
+                options.num_pics = atoi(optarg);
+                if (options.num_pics == 0)
                 {
                     LOG(WARNING, "%s", "Cannot create zero pictures");
                     exit(EXIT_FAILURE);
                 }
                 break;
             case 'b':
-                skip_black_frames = 1;
+                options.skip_black_frames = 1;
+                break;
+            case 'S':
+                options.sample_step = atoi(optarg);
+                if (options.sample_step < 1)
+                {
+                    LOG(WARNING, "%s", "Sample step has to be at least 1");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'r':
+                options.candidate_window = atoi(optarg);
+                if (options.candidate_window < 0)
+                {
+                    LOG(WARNING, "%s", "Invalid candidate window");
+                    exit(EXIT_FAILURE);
+                }
                 break;
             case 'o':
-                offset = atol(optarg);
+                options.offset = atol(optarg);
                 break;
             case 's':
                 LOG(INFO, "%s", "Will use slow decoding mode, please be patient");
-                slow_seek = 1;
+                options.slow_seek = 1;
+                break;
+            case 'k':
+                options.keyframes_only = 1;
+                break;
+            case 'e':
+                options.num_encoders = atoi(optarg);
+                if (options.num_encoders < 0)
+                {
+                    LOG(WARNING, "%s", "Invalid number of encoder threads");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'I':
+                options.use_index = 1;
+                break;
+            case 'c':
+                options.use_index = 1;
+                options.index_dir = optarg;
+                break;
+            case 'j':
+                options.num_threads = atoi(optarg);
+                if (options.num_threads < 1)
+                {
+                    LOG(WARNING, "%s", "Need at least one thread");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'W':
+                options.width = atoi(optarg);
+                break;
+            case 'H':
+                options.height = atoi(optarg);
+                break;
+            case 'a':
+                options.scale_flags = video_scale_flags_from_string(optarg);
+                if (options.scale_flags < 0)
+                {
+                    LOG(WARNING, "Unknown scaling algorithm %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'g':
+                if (sscanf(optarg, "%dx%d", &(options.columns),
+                            &(options.rows)) != 2 ||
+                    options.columns < 1 || options.rows < 1 ||
+                    options.columns * options.rows > UINT8_MAX)
+                {
+                    LOG(WARNING, "Invalid contact sheet layout %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case 'V':
+                options.write_vtt = 1;
+                break;
+            case 'p':
+                output_prefix = optarg;
+                break;
+            case 'f':
+                manifest = optarg;
+                break;
+            case 'O':
+                sink_spec = optarg;
+                break;
+            case OPTION_SHOTS:
+                options.shots = 1;
+                break;
+            case OPTION_IO:
+                options.input_mode = input_mode_from_string(optarg);
+                if ((int)options.input_mode < 0)
+                {
+                    LOG(WARNING, "Unknown I/O mode %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_STATS:
+                if (strcmp(optarg, "json"))
+                {
+                    LOG(WARNING, "Unknown statistics format %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                options.collect_stats = 1;
+                break;
+            case OPTION_STATS_FILE:
+                stats_file = optarg;
+                break;
+            case OPTION_SERVE:
+                serve_address = optarg;
+                break;
+            case OPTION_SEEK_DECODE:
+                options.seek_decode = video_seek_decode_from_string(optarg);
+                if (options.seek_decode < 0)
+                {
+                    LOG(WARNING, "Unknown seek decode setting %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_DEDUP:
+                options.dedup_distance = atoi(optarg);
+                if (options.dedup_distance < 0 || options.dedup_distance > 64)
+                {
+                    LOG(WARNING, "%s", "Dedup distance has to be in [0, 64]");
+                    exit(EXIT_FAILURE);
+                }
+                break;
+            case OPTION_SIZE:
+                if (options.num_sizes == MAX_SNAPSHOT_SIZES ||
+                    parse_size(optarg,
+                        &(options.sizes[options.num_sizes])) < 0)
+                {
+                    LOG(WARNING, "Invalid or too many sizes at %s", optarg);
+                    exit(EXIT_FAILURE);
+                }
+                for (i = 0; i < options.num_sizes; ++i)
+                {
+                    if (!strcmp(options.sizes[i].label, optarg))
+                    {
+                        LOG(WARNING, "Size %s given twice", optarg);
+                        exit(EXIT_FAILURE);
+                    }
+                }
+                options.num_sizes++;
                 break;
             case 'h':
             default:
-                fprintf(stderr, "Usage: %s [options] file\n\n", argv[0]);
+                fprintf(stderr, "Usage: %s [options] file...\n\n", argv[0]);
+                fprintf(stderr, "A file named - is read from stdin in a single pass.\n");
+                fprintf(stderr, "Twice as many snapshots as wanted are kept meanwhile, shrunk to fit 128 MiB.\n\n");
                 fprintf(stderr, "With options:\n");
                 fprintf(stderr, "\t-h : This help\n");
                 fprintf(stderr, "\t-b : Write histogram data files\n");
                 fprintf(stderr, "\t-i %s: Select output image format\n", image_get_supported_string());
                 fprintf(stderr, "\t-n <count>: Create count snapshots\n");
+                fprintf(stderr, "\t-W <NUM>: Scale snapshots to at most NUM pixels wide\n");
+                fprintf(stderr, "\t-H <NUM>: Scale snapshots to at most NUM pixels high\n");
+                fprintf(stderr, "\t-a fast|bilinear|bicubic|area: Select scaling algorithm\n");
+                fprintf(stderr, "\t--size=full|<W>|x<H>|<W>x<H>: Write every snapshot in this size, repeatable\n");
                 fprintf(stderr, "\t-b Skip very dark frames\n");
+                fprintf(stderr, "\t-S <NUM>: Check only every NUM-th line and column for dark frames\n");
+                fprintf(stderr, "\t-r <NUM>: Pick the most representative of up to NUM frames before each position\n");
+                fprintf(stderr, "\t--dedup=<NUM>: Replace or drop snapshots within NUM of 64 hash bits of the previous one\n");
                 fprintf(stderr, "\t-o <NUM>: Start output file numbering at NUM\n");
                 fprintf(stderr, "\t-s : Use slow seeking (for MPEG and packed bitstream files)\n");
+                fprintf(stderr, "\t-k : Use the nearest keyframe (fast, not frame accurate)\n");
+                fprintf(stderr, "\t--seek-decode=exact|fast|fastest : Decode frames passed while seeking without loop filter (fast) or residuals (fastest)\n");
+                fprintf(stderr, "\t-I : Seek using a keyframe index, built on first use\n");
+                fprintf(stderr, "\t-c <DIR>: Keep keyframe indexes in DIR (implies -I)\n");
+                fprintf(stderr, "\t-j <NUM>: Decode with NUM threads in parallel\n");
+                fprintf(stderr, "\t-g <COLS>x<ROWS>: Tile all snapshots into one contact sheet\n");
+                fprintf(stderr, "\t-V : Write a WebVTT file for the contact sheet\n");
+                fprintf(stderr, "\t-e <NUM>: Encode images with NUM threads while decoding\n");
+                fprintf(stderr, "\t-p <PREFIX>: Prepend PREFIX to output file names\n");
+                fprintf(stderr, "\t-f <FILE>: Read files to process from FILE, - for stdin\n");
+                fprintf(stderr, "\t--shots : Write the first settled frame of every shot, decoding at reduced size unless -W, -H or --size ask for more\n");
+                fprintf(stderr, "\t--io default|buffered|mmap : Select how video files are read\n");
+                fprintf(stderr, "\t--stats=json : Report time per processing phase and counters\n");
+                fprintf(stderr, "\t--stats-file=<FILE>: Write the report to FILE instead of stderr\n");
+                fprintf(stderr, "\t--serve=<SOCKET>|-: Take requests from a Unix socket or stdin\n");
+                fprintf(stderr, "\t-O tar|multipart[:FILE]: Write all images into one stream, stdout by default\n");
                 exit(EXIT_FAILURE);
         }
     }
 
-    if (optind >= argc) 
+    if (options.shots && options.columns > 0)
     {
-        LOG(ERROR, "%s", "Please provide a movie file");
+        LOG(WARNING, "%s", "Contact sheets cannot be combined with --shots");
+        exit(EXIT_FAILURE);
+    }
+
+    if (options.dedup_distance >= 0 && options.columns > 0)
+    {
+        LOG(WARNING, "%s", "Contact sheets cannot be combined with --dedup");
         exit(EXIT_FAILURE);
     }
 
-    video_file = video_file_open(argv[optind]);
-    if (!video_file)
+    if (options.num_sizes > 0 &&
+        (options.columns > 0 || options.width > 0 || options.height > 0))
     {
-        LOG(ERROR, "Error opening file %s", argv[optind]);
+        LOG(WARNING, "%s", "--size cannot be combined with -g, -W or -H");
         exit(EXIT_FAILURE);
     }
 
-    step = video_file->video_stream->duration / num_pics;
+    if (serve_address && (optind < argc || manifest || sink_spec ||
+                options.collect_stats))
+    {
+        LOG(WARNING, "%s", "--serve takes files from requests and cannot be "
+                "combined with -f, -O or --stats");
+        exit(EXIT_FAILURE);
+    }
 
-    /* Dump information about file onto standard error */
-    av_dump_format(video_file->format_ctx, 0, argv[optind], 0);
+    if (options.columns > 0)
+    {
+        /* one snapshot per tile */
+        options.num_pics = options.columns * options.rows;
+    }
+
+    for (i = optind; i < argc; ++i)
+    {
+        add_job(argv[i], NULL);
+    }
 
-    for (i = 0; i < num_pics; ++i)
+    if (manifest && read_manifest(manifest) < 0)
     {
-        char filename[64];
-        sprintf(filename, "frame_%05d.%s", i + offset, image_get_suffix(image_format));
+        LOG(ERROR, "Error reading manifest %s", manifest);
+        exit(EXIT_FAILURE);
+    }
 
-        if (skip_black_frames)
+    /* stdin holds either the manifest or a single video */
+    readers = manifest && !strcmp(manifest, "-");
+    for (i = 0; i < num_jobs; ++i)
+    {
+        readers += !strcmp(jobs[i].filename, "-");
+    }
+    if (readers > 1)
+    {
+        LOG(WARNING, "%s", "stdin can only be read once");
+        exit(EXIT_FAILURE);
+    }
+
+    if (num_jobs == 0 && !serve_address)
+    {
+        LOG(ERROR, "%s", "Please provide a movie file");
+        exit(EXIT_FAILURE);
+    }
+
+    /* give every file of a batch its own output directory; files of the
+     * same name in different directories are numbered */
+    for (i = 0; i < num_jobs; ++i)
+    {
+        char prefix[1024];
+        char numbered[1024];
+        int number;
+
+        if (jobs[i].output_prefix)
         {
-            video_file_decode_until_non_black(video_file);
+            continue;
         }
-        else
+
+        if (num_jobs == 1 && !manifest)
         {
-            video_file_decode_frame(video_file);
+            jobs[i].output_prefix = strdup(output_prefix);
+            continue;
         }
-        video_file_save_frame(video_file, filename, image_format);
 
-        if (write_histogram)
+        make_file_prefix(prefix, sizeof(prefix), output_prefix,
+                jobs[i].filename);
+        /* without the trailing slash */
+        prefix[strlen(prefix) - 1] = '\0';
+        snprintf(numbered, sizeof(numbered), "%s/", prefix);
+        for (number = 2; prefix_taken(numbered, i); number++)
+        {
+            snprintf(numbered, sizeof(numbered), "%s-%d/", prefix, number);
+        }
+        if (number > 2)
         {
-            sprintf(filename, "histogram_%05d.dat", i);
-            histogram_save(&(video_file->histogram), filename);
-            sprintf(filename, "histogram_%05d.png", i);
-            histogram_render(&(video_file->histogram), filename);
+            LOG(INFO, "Writing %s to %s, another file has the same name",
+                    jobs[i].filename, numbered);
         }
+        jobs[i].output_prefix = strdup(numbered);
+    }
 
-        video_file_seek_frame(video_file, (i + 1) * step, slow_seek);
+    if (sink_spec)
+    {
+        sink = output_sink_open(sink_spec);
+        if (!sink)
+        {
+            LOG(ERROR, "Invalid output stream %s", sink_spec);
+            exit(EXIT_FAILURE);
+        }
     }
 
-    video_file_close(video_file);
+    pool = thread_pool_new(options.num_threads);
+    if (!pool)
+    {
+        LOG(ERROR, "%s", "Failed to create worker threads");
+        exit(EXIT_FAILURE);
+    }
 
-    return 0;
-}
+    if (options.num_encoders > 0)
+    {
+        /* two buffers per encoder keep them busy, one per decoder for the
+         * frame being converted */
+        pipeline = encode_pipeline_new(options.num_encoders,
+                2 * options.num_encoders + options.num_threads);
+        if (!pipeline)
+        {
+            LOG(ERROR, "%s", "Failed to create encoder threads");
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (serve_address)
+    {
+        /* codecs, threads and encoder buffers stay set up for all
+         * requests */
+        if (server_run(serve_address, pool, pipeline, &options,
+                    output_prefix) < 0)
+        {
+            LOG(ERROR, "Failed to serve on %s", serve_address);
+            failed++;
+        }
+    }
+
+    for (i = 0; i < num_jobs; ++i)
+    {
+        jobs[i].pipeline = pipeline;
+        jobs[i].sink = sink;
+        thumbnailer_submit(pool, &(jobs[i]));
+    }
+    thread_pool_free(pool);
+    encode_pipeline_free(pipeline);
+    recycle_clear();
+
+    if (sink && output_sink_close(sink) < 0)
+    {
+        LOG(ERROR, "%s", "Failed to write output stream");
+        failed++;
+    }
 
+    if (options.collect_stats && write_stats(stats_file) < 0)
+    {
+        LOG(ERROR, "Failed to write statistics to %s", stats_file);
+        failed++;
+    }
+
+    for (i = 0; i < num_jobs; ++i)
+    {
+        if (jobs[i].result < 0)
+        {
+            failed++;
+        }
+        if (num_jobs > 1 || manifest)
+        {
+            printf("%s\t%s\t%s\n", jobs[i].result < 0 ? "FAILED" : "OK",
+                    jobs[i].filename, jobs[i].output_prefix);
+        }
+    }
+
+    return failed ? EXIT_FAILURE : 0;
+}
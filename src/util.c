@@ -17,9 +17,13 @@
 */
 
 #include "util.h"
+#include <errno.h>
 #include <unistd.h>
 #include <stdio.h>
 #include <stdarg.h>
+#include <string.h>
+#include <sys/stat.h>
+#include <sys/types.h>
 
 void 
 logging(enum LogLevel level, 
@@ -65,3 +69,52 @@ logging(enum LogLevel level,
     }
 }
 
+int
+make_prefix_directories(const char* prefix)
+{
+    char path[1024];
+    char* p;
+
+    return_if(prefix == NULL, -1);
+    return_if(strlen(prefix) >= sizeof(path), -1);
+
+    strcpy(path, prefix);
+    p = strrchr(path, '/');
+    return_if(p == NULL, 0);
+    *p = '\0';
+
+    for (p = path + 1; *p; ++p)
+    {
+        if (*p == '/')
+        {
+            *p = '\0';
+            if (mkdir(path, 0777) < 0 && errno != EEXIST)
+            {
+                return -1;
+            }
+            *p = '/';
+        }
+    }
+
+    if (path[0] != '\0' && mkdir(path, 0777) < 0 && errno != EEXIST)
+    {
+        return -1;
+    }
+
+    return 0;
+}
+
+void
+make_file_prefix(char* buffer, size_t size, const char* prefix,
+        const char* filename)
+{
+    const char* base;
+    const char* dot;
+
+    base = strrchr(filename, '/');
+    base = base ? base + 1 : filename;
+    dot = strrchr(base, '.');
+    snprintf(buffer, size, "%s%.*s/", prefix,
+            dot && dot != base ? (int)(dot - base) : (int)strlen(base),
+            base);
+}
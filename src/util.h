@@ -20,10 +20,15 @@
 #ifndef __UTIL_H
 #define __UTIL_H
 
+#include <stddef.h>
+
 #define return_if(arg, retval) do {if (arg) return retval; } while (0);
 #ifndef MAX
 #   define MAX(a,b) ((a) > (b) ? (a) : (b))
 #endif
+#ifndef MIN
+#   define MIN(a,b) ((a) < (b) ? (a) : (b))
+#endif
 
 enum LogLevel
 {
@@ -39,4 +44,28 @@ enum LogLevel
 void 
 logging(enum LogLevel level, const char* file, int line, const char* format, ...);
 
+/**
+ * Create the directories of an output file name prefix. Everything up to the
+ * last "/" of prefix is treated as a directory path.
+ *
+ * @param prefix prefix of output file names, e.g. "thumbs/movie_"
+ * @return 0 on success or if no directory is needed, -1 on error
+ */
+int
+make_prefix_directories(const char* prefix);
+
+/**
+ * Build the output prefix giving a video file a directory of its own below
+ * prefix, named after the file without its suffix.
+ *
+ * @param buffer receives the prefix, e.g. "thumbs/movie/" for "thumbs/" and
+ * "/videos/movie.mkv"
+ * @param size size of buffer
+ * @param prefix common prefix of all output files
+ * @param filename name of the video file
+ */
+void
+make_file_prefix(char* buffer, size_t size, const char* prefix,
+        const char* filename);
+
 #endif /* __UTIL_H */
@@ -23,9 +23,50 @@
 
 #include <libavcodec/avcodec.h>
 
+#include "recycle.h"
+#include "stats.h"
 #include "util.h"
 #include "video.h"
 
+/** Bounds of the byte range read ahead for the next seek */
+#define PREFETCH_MIN (1024 * 1024)
+#define PREFETCH_MAX (16 * 1024 * 1024)
+
+/** Frames with a larger RGB picture are converted and written in bands */
+#define BAND_MIN_BYTES (16 * 1024 * 1024)
+
+/** Lines of the decoded frame handed to the scaler at once */
+#define BAND_INPUT_LINES 16
+
+/** Output lines a scaler may hold back at the top of a picture and release
+ * at its bottom; generous for the filters tn offers */
+#define BAND_FILTER_LINES 16
+
+/**
+ * Conversion of the current frame a band of lines at a time, the state
+ * behind an #ImageBands
+ */
+struct FrameBands
+{
+    struct VideoFile* video_file;
+    struct SwsContext* scale_ctx;
+    int yuv420;
+    /** vertical chroma subsampling of the decoded frame */
+    int chroma_shift;
+    uint8_t* buffer;
+    size_t buffer_size;
+    /** planes of buffer, holding capacity output lines */
+    struct YuvImage planes;
+    int capacity;
+    /** output lines first to end - 1 are in buffer */
+    int first;
+    int end;
+    /** next line of the decoded frame to scale */
+    int input;
+    /** flag to build the histogram from the RGB lines on the way */
+    int histogram;
+};
+
 static int
 find_video_stream(AVFormatContext* ctx)
 {
@@ -43,17 +84,256 @@ find_video_stream(AVFormatContext* ctx)
 }
 
 static struct SwsContext*
-make_scale_context(AVCodecContext* ctx)
+make_scale_context(struct VideoFile* video_file, int width, int height,
+        enum PixelFormat pix_fmt, int flags, struct ScalerKey* key)
+{
+    /* source parameters */
+    key->src_width = video_file->width;
+    key->src_height = video_file->height;
+    key->src_format = video_file->codec_ctx->pix_fmt;
+    /* target parameters */
+    key->dst_width = width;
+    key->dst_height = height;
+    key->dst_format = pix_fmt;
+    /* scale parameters */
+    key->flags = flags;
+
+    return recycle_scaler_get(key);
+}
+
+/**
+ * Create the scaler for the current output size
+ */
+static int
+setup_scaler(struct VideoFile* video_file)
+{
+    if (!video_file->scale_ctx)
+    {
+        video_file->scale_ctx = make_scale_context(video_file,
+                video_file->output_width,
+                video_file->output_height,
+                PIX_FMT_RGB24,
+                video_file->scale_flags,
+                &(video_file->scale_key));
+    }
+
+    return video_file->scale_ctx ? 0 : -1;
+}
+
+/**
+ * Check whether frames can be written as YCbCr 4:2:0 without an RGB
+ * conversion
+ */
+static int
+is_yuv420(enum PixelFormat pix_fmt)
+{
+    return pix_fmt == PIX_FMT_YUV420P || pix_fmt == PIX_FMT_YUVJ420P;
+}
+
+/**
+ * Check whether the decoder's planes can be written as they are
+ */
+static int
+is_passthrough_yuv420(struct VideoFile* video_file)
+{
+    return video_file->codec_ctx->pix_fmt == PIX_FMT_YUVJ420P &&
+        video_file->output_width == video_file->width &&
+        video_file->output_height == video_file->height;
+}
+
+/**
+ * Create the scaler to JPEG range YCbCr 4:2:0 for the current output size
+ */
+static int
+setup_yuv_scaler(struct VideoFile* video_file)
+{
+    return_if(!is_yuv420(video_file->codec_ctx->pix_fmt), -1);
+
+    if (!video_file->yuv_scale_ctx)
+    {
+        video_file->yuv_scale_ctx = make_scale_context(video_file,
+                video_file->output_width,
+                video_file->output_height,
+                PIX_FMT_YUVJ420P,
+                video_file->scale_flags,
+                &(video_file->yuv_scale_key));
+    }
+
+    return video_file->yuv_scale_ctx ? 0 : -1;
+}
+
+static size_t
+rgb_buffer_size(struct VideoFile* video_file)
+{
+    return avpicture_get_size(PIX_FMT_RGB24,
+            video_file->output_width,
+            video_file->output_height);
+}
+
+/**
+ * Create the RGB buffer for the current output size
+ */
+static int
+setup_rgb_buffer(struct VideoFile* video_file)
+{
+    return_if(video_file->rgb_buffer != NULL, 0);
+
+    video_file->rgb_buffer = recycle_buffer_get(rgb_buffer_size(video_file));
+    return_if(video_file->rgb_buffer == NULL, -1);
+
+    avpicture_fill((AVPicture *)video_file->frame_rgb,
+            video_file->rgb_buffer,
+            PIX_FMT_RGB24,
+            video_file->output_width,
+            video_file->output_height);
+
+    return 0;
+}
+
+static size_t
+candidate_buffer_size(struct VideoFile* video_file)
+{
+    return avpicture_get_size(video_file->codec_ctx->pix_fmt,
+            video_file->width, video_file->height);
+}
+
+static void
+free_candidate_buffer(struct VideoFile* video_file)
+{
+    if (video_file->candidate_buffer != NULL)
+    {
+        recycle_buffer_put(video_file->candidate_buffer,
+                candidate_buffer_size(video_file));
+        video_file->candidate_buffer = NULL;
+    }
+}
+
+/**
+ * Give the scalers and buffers of the further output sizes back, keeping
+ * the sizes
+ */
+static void
+free_output_sizes(struct VideoFile* video_file)
+{
+    int i;
+
+    for (i = 0; i < video_file->num_outputs; i++)
+    {
+        struct VideoOutput* output = &(video_file->outputs[i]);
+
+        if (output->rgb_buffer != NULL)
+        {
+            recycle_buffer_put(output->rgb_buffer,
+                    (size_t)output->width * output->height * 3);
+            output->rgb_buffer = NULL;
+        }
+        if (output->scale_ctx != NULL)
+        {
+            recycle_scaler_put(output->scale_ctx, &(output->scale_key));
+            output->scale_ctx = NULL;
+        }
+    }
+}
+
+static void
+free_output(struct VideoFile* video_file)
+{
+    /* the sizes below cascade from the RGB frame */
+    free_output_sizes(video_file);
+
+    /* everything goes back to the pool for the next file of this size */
+    if (video_file->rgb_buffer != NULL)
+    {
+        recycle_buffer_put(video_file->rgb_buffer,
+                rgb_buffer_size(video_file));
+        video_file->rgb_buffer = NULL;
+    }
+
+    if (video_file->scale_ctx != NULL)
+    {
+        recycle_scaler_put(video_file->scale_ctx, &(video_file->scale_key));
+        video_file->scale_ctx = NULL;
+    }
+
+    video_file->rgb_valid = 0;
+
+    if (video_file->yuv_buffer != NULL)
+    {
+        struct YuvImage layout;
+
+        recycle_buffer_put(video_file->yuv_buffer,
+                image_yuv420_layout(&layout, NULL, video_file->output_width,
+                    video_file->output_height));
+        video_file->yuv_buffer = NULL;
+    }
+
+    if (video_file->hash_scale_ctx != NULL)
+    {
+        recycle_scaler_put(video_file->hash_scale_ctx,
+                &(video_file->hash_scale_key));
+        video_file->hash_scale_ctx = NULL;
+    }
+
+    if (video_file->yuv_scale_ctx != NULL)
+    {
+        recycle_scaler_put(video_file->yuv_scale_ctx,
+                &(video_file->yuv_scale_key));
+        video_file->yuv_scale_ctx = NULL;
+    }
+
+    video_file->yuv_valid = 0;
+}
+
+/**
+ * Check whether frames of the given pixel format carry an 8 bit luma plane
+ * in data[0] that can be analysed directly.
+ *
+ * @return 1 for full range luma, 0 for limited range luma or -1 if the
+ * format has no usable luma plane
+ */
+static int
+luma_plane_range(enum PixelFormat pix_fmt)
+{
+    switch (pix_fmt)
+    {
+        case PIX_FMT_YUVJ420P:
+        case PIX_FMT_YUVJ422P:
+        case PIX_FMT_YUVJ444P:
+        case PIX_FMT_YUVJ440P:
+            return 1;
+        case PIX_FMT_YUV420P:
+        case PIX_FMT_YUV422P:
+        case PIX_FMT_YUV444P:
+        case PIX_FMT_YUV440P:
+        case PIX_FMT_YUV410P:
+        case PIX_FMT_YUV411P:
+        case PIX_FMT_NV12:
+        case PIX_FMT_NV21:
+            return 0;
+        default:
+            return -1;
+    }
+}
+
+/**
+ * Check whether frames of the given pixel format carry a palette in
+ * data[1] instead of a plane
+ */
+static int
+has_palette(enum PixelFormat pix_fmt)
 {
-    return sws_getContext(
-            /* source parameters */
-            ctx->width, ctx->height, ctx->pix_fmt,
-            /* target parameters */
-            ctx->width, ctx->height, PIX_FMT_RGB24,
-            /* scale parameters */
-            SWS_BICUBIC,
-            /* dunno. need to look up */
-            NULL, NULL, NULL);
+    switch (pix_fmt)
+    {
+        case PIX_FMT_PAL8:
+        case PIX_FMT_RGB8:
+        case PIX_FMT_BGR8:
+        case PIX_FMT_RGB4_BYTE:
+        case PIX_FMT_BGR4_BYTE:
+        case PIX_FMT_GRAY8:
+            return 1;
+        default:
+            return 0;
+    }
 }
 
 static AVCodec*
@@ -75,17 +355,53 @@ create_codec(AVCodecContext* ctx)
 
 struct VideoFile*
 video_file_open(const char* filename)
+{
+    return video_file_open_input(filename, INPUT_MODE_DEFAULT);
+}
+
+/**
+ * Create a format context reading through a custom I/O backend
+ */
+static int
+setup_input(struct VideoFile* video_file, const char* filename,
+        enum InputMode mode)
+{
+    return_if(mode == INPUT_MODE_DEFAULT, 0);
+
+    video_file->input = file_input_open(filename, mode);
+    return_if(video_file->input == NULL, -1);
+
+    video_file->format_ctx = avformat_alloc_context();
+    return_if(video_file->format_ctx == NULL, -1);
+    video_file->format_ctx->pb = file_input_get_context(video_file->input);
+    video_file->format_ctx->flags |= AVFMT_FLAG_CUSTOM_IO;
+
+    return 0;
+}
+
+struct VideoFile*
+video_file_open_input(const char* filename, enum InputMode mode)
 {
     struct VideoFile* video_file = NULL;
+    uint64_t start = STATS_START();
 
     return_if(NULL == filename, NULL);
 
+    if (!strcmp(filename, "-"))
+    {
+        /* a pipe can neither be mapped nor read ahead of time */
+        filename = "pipe:0";
+        mode = INPUT_MODE_DEFAULT;
+    }
+
     video_file = (struct VideoFile*)malloc(sizeof(struct VideoFile));
 
     if (video_file)
     {
         memset(video_file, 0, sizeof(struct VideoFile));
-        if (avformat_open_input(&(video_file->format_ctx), filename, NULL, NULL) == 0)
+        video_file->sample_step = 1;
+        if (setup_input(video_file, filename, mode) == 0 &&
+            avformat_open_input(&(video_file->format_ctx), filename, NULL, NULL) == 0)
         {
             if (avformat_find_stream_info(video_file->format_ctx, NULL) >= 0)
             {   
@@ -104,41 +420,27 @@ video_file_open(const char* filename)
                     video_file->codec = create_codec(video_file->codec_ctx);
                     if (video_file->codec)
                     {
-                        /* 
-                         * create software scaler context for colorspace
-                         * conversion
-                         */
-                        video_file->scale_ctx =
-                            make_scale_context(video_file->codec_ctx);
-                        if (video_file->scale_ctx)
+                        video_file->width = 
+                            video_file->codec_ctx->width;
+                        video_file->height = 
+                            video_file->codec_ctx->height;
+                        video_file->output_width = video_file->width;
+                        video_file->output_height = video_file->height;
+                        video_file->scale_flags = SWS_BICUBIC;
+                        video_file->frame = recycle_frame_get();
+                        video_file->picture = video_file->frame;
+                        if (video_file->frame)
                         {
-                            video_file->width = 
-                                video_file->codec_ctx->width;
-                            video_file->height = 
-                                video_file->codec_ctx->height;
-                            video_file->frame = avcodec_alloc_frame();
-                            if (video_file->frame)
+                            /* 
+                             * the software scaler context for colorspace
+                             * conversion and the RGB buffer are created
+                             * with the first conversion
+                             */
+                            video_file->frame_rgb = recycle_frame_get();
+                            if (video_file->frame_rgb)
                             {
-                                video_file->frame_rgb = avcodec_alloc_frame();
-                                if (video_file->frame_rgb)
-                                {
-                                    int bytes = avpicture_get_size(
-                                            PIX_FMT_RGB24,
-                                            video_file->width,
-                                            video_file->height);
-                                    video_file->rgb_buffer =
-                                        (uint8_t *)av_malloc(bytes * sizeof(uint8_t));
-                                    if (video_file->rgb_buffer)
-                                    {
-                                        avpicture_fill(
-                                                (AVPicture *)video_file->frame_rgb, 
-                                                video_file->rgb_buffer, 
-                                                PIX_FMT_RGB24,
-                                                video_file->width, 
-                                                video_file->height);
-                                        return video_file;
-                                    }
-                                }
+                                STATS_STOP(STATS_PHASE_OPEN, start);
+                                return video_file;
                             }
                         }
                     }
@@ -153,138 +455,1559 @@ video_file_open(const char* filename)
     return video_file;
 }
 
-int 
-video_file_close(struct VideoFile* video_file)
+/**
+ * Turn requested bounds into the output size, see
+ * #video_file_set_output_size
+ */
+static void
+fit_output_size(struct VideoFile* video_file, int* width_out, int* height_out)
 {
-    return_if (NULL == video_file, -1);
+    int width = *width_out;
+    int height = *height_out;
+    int display_width;
 
-    if (video_file->rgb_buffer != NULL)
+    /* take non-square pixels into account when keeping the aspect ratio */
+    display_width = video_file->width;
+    if (video_file->codec_ctx->sample_aspect_ratio.num > 0 &&
+        video_file->codec_ctx->sample_aspect_ratio.den > 0)
+    {
+        display_width = (int)av_rescale(video_file->width,
+                video_file->codec_ctx->sample_aspect_ratio.num,
+                video_file->codec_ctx->sample_aspect_ratio.den);
+    }
+
+    if (width == 0 && height == 0)
+    {
+        width = video_file->width;
+        height = video_file->height;
+    }
+    else
+    {
+        int fit_width = width ? width : display_width;
+        int fit_height = height ? height : video_file->height;
+
+        if (fit_width > display_width && fit_height > video_file->height)
+        {
+            /* never scale up */
+            fit_width = display_width;
+            fit_height = video_file->height;
+        }
+
+        /* largest size with the display aspect ratio fitting the box */
+        if ((int64_t)fit_width * video_file->height <=
+            (int64_t)fit_height * display_width)
+        {
+            width = fit_width;
+            height = (int)av_rescale(fit_width, video_file->height,
+                    display_width);
+        }
+        else
+        {
+            height = fit_height;
+            width = (int)av_rescale(fit_height, display_width,
+                    video_file->height);
+        }
+        width = MAX(width & ~1, 2);
+        height = MAX(height & ~1, 2);
+    }
+
+    *width_out = width;
+    *height_out = height;
+}
+
+/**
+ * Forget the further output sizes
+ */
+static void
+clear_outputs(struct VideoFile* video_file)
+{
+    free(video_file->outputs);
+    video_file->outputs = NULL;
+    video_file->num_outputs = 0;
+    video_file->output_index = 0;
+}
+
+int
+video_file_is_seekable(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, 0);
+
+    return video_file->format_ctx->pb != NULL &&
+        video_file->format_ctx->pb->seekable &&
+        video_file->video_stream->duration > 0 &&
+        video_file->video_stream->duration != AV_NOPTS_VALUE;
+}
+
+int
+video_file_set_output_size(struct VideoFile* video_file,
+        int width, int height, int scale_flags)
+{
+    return_if(video_file == NULL, -1);
+    return_if(width < 0 || height < 0, -1);
+
+    fit_output_size(video_file, &width, &height);
+
+    if (width != video_file->output_width ||
+        height != video_file->output_height ||
+        scale_flags != video_file->scale_flags)
+    {
+        free_output(video_file);
+        video_file->output_width = width;
+        video_file->output_height = height;
+        video_file->scale_flags = scale_flags;
+    }
+    else
     {
-        av_free(video_file->rgb_buffer);
+        free_output_sizes(video_file);
     }
+    clear_outputs(video_file);
+
+    return 0;
+}
+
+static int64_t
+output_area(const struct VideoOutput* output)
+{
+    return (int64_t)output->width * output->height;
+}
+
+int
+video_file_set_output_sizes(struct VideoFile* video_file,
+        const struct VideoSize* sizes, int count, int scale_flags)
+{
+    struct VideoOutput* outputs;
+    int largest = 0;
+    int num_outputs = 0;
+    int i, j;
 
-    if (video_file->frame_rgb != NULL)
+    return_if(video_file == NULL, -1);
+    return_if(sizes == NULL || count < 1, -1);
+
+    for (i = 0; i < count; i++)
     {
-        av_free(video_file->frame_rgb);
+        return_if(sizes[i].width < 0 || sizes[i].height < 0, -1);
     }
 
-    if (video_file->frame != NULL)
+    outputs = (struct VideoOutput *)calloc(count, sizeof(struct VideoOutput));
+    return_if(outputs == NULL, -1);
+
+    for (i = 0; i < count; i++)
     {
-        av_free(video_file->frame);
+        outputs[i].width = sizes[i].width;
+        outputs[i].height = sizes[i].height;
+        outputs[i].index = i;
+        fit_output_size(video_file, &(outputs[i].width),
+                &(outputs[i].height));
+        if (output_area(&(outputs[i])) > output_area(&(outputs[largest])))
+        {
+            largest = i;
+        }
     }
 
-    if (video_file->scale_ctx != NULL)
+    /* the largest size is converted from the decoded frame */
+    if (video_file_set_output_size(video_file, sizes[largest].width,
+                sizes[largest].height, scale_flags) < 0)
     {
-        sws_freeContext(video_file->scale_ctx);
+        free(outputs);
+        return -1;
     }
+    video_file->output_index = largest;
 
-    if (video_file->codec_ctx != NULL)
+    /* all others cascade from it, largest first; entries are only moved to
+     * positions that have been read already */
+    for (i = 0; i < count; i++)
     {
-        avcodec_close(video_file->codec_ctx);
+        struct VideoOutput output = outputs[i];
+
+        if (i == largest)
+        {
+            continue;
+        }
+        for (j = num_outputs;
+                j > 0 && output_area(&(outputs[j - 1])) < output_area(&output);
+                j--)
+        {
+            outputs[j] = outputs[j - 1];
+        }
+        outputs[j] = output;
+        num_outputs++;
     }
 
-    if (video_file->format_ctx)
+    video_file->outputs = outputs;
+    video_file->num_outputs = num_outputs;
+
+    return 0;
+}
+
+int
+video_file_scale_output(struct VideoFile* video_file, int n,
+        const uint8_t* source, uint8_t* buffer)
+{
+    struct VideoOutput* output;
+    const uint8_t* source_data[4] = { source, NULL, NULL, NULL };
+    uint8_t* data[4] = { buffer, NULL, NULL, NULL };
+    int source_linesizes[4] = { 0, 0, 0, 0 };
+    int linesizes[4] = { 0, 0, 0, 0 };
+    uint64_t start;
+
+    return_if(video_file == NULL, -1);
+    return_if(n < 0 || n >= video_file->num_outputs, -1);
+    return_if(source == NULL || buffer == NULL, -1);
+
+    output = &(video_file->outputs[n]);
+    if (!output->scale_ctx)
     {
-        avformat_close_input(&(video_file->format_ctx));
+        struct ScalerKey* key = &(output->scale_key);
+
+        key->src_width = n > 0 ? output[-1].width : video_file->output_width;
+        key->src_height = n > 0 ? output[-1].height :
+            video_file->output_height;
+        key->src_format = PIX_FMT_RGB24;
+        key->dst_width = output->width;
+        key->dst_height = output->height;
+        key->dst_format = PIX_FMT_RGB24;
+        key->flags = video_file->scale_flags;
+        output->scale_ctx = recycle_scaler_get(key);
+        return_if(output->scale_ctx == NULL, -1);
     }
 
-    free(video_file);
+    source_linesizes[0] = output->scale_key.src_width * 3;
+    linesizes[0] = output->width * 3;
+
+    start = STATS_START();
+    sws_scale(
+            output->scale_ctx,
+            source_data,
+            source_linesizes, 0,
+            output->scale_key.src_height,
+            data,
+            linesizes);
+    STATS_STOP(STATS_PHASE_SCALE, start);
 
     return 0;
 }
 
 int
-video_file_decode_frame(struct VideoFile* video_file)
+video_file_materialize_outputs(struct VideoFile* video_file)
 {
-    AVPacket packet;
-    int frame_finished;
+    int n;
 
     return_if(video_file == NULL, -1);
+    return_if(video_file_materialize_frame(video_file) < 0, -1);
 
-    while (av_read_frame(video_file->format_ctx, &packet) >= 0)
+    for (n = 0; n < video_file->num_outputs; n++)
     {
-        if (packet.stream_index == video_file->video_stream_idx)
+        struct VideoOutput* output = &(video_file->outputs[n]);
+
+        if (!output->rgb_buffer)
         {
-            avcodec_decode_video2(
-                    video_file->codec_ctx, 
-                    video_file->frame,
-                    &frame_finished,
-                    &packet);
-            if (frame_finished)
-            {
-                video_file->pts = packet.dts;
-                /* create rgb frame */
-                sws_scale(
-                        video_file->scale_ctx,
-                        (const uint8_t * const*) video_file->frame->data,
-                        video_file->frame->linesize, 0,
-                        video_file->height, 
-                        video_file->frame_rgb->data, 
-                        video_file->frame_rgb->linesize);
-                histogram_create_from_rgb(
-                        video_file->frame_rgb->data[0],
-                        video_file->width,
-                        video_file->height,
-                        &(video_file->histogram));
-                av_free_packet(&packet);
-                break;
-            }
+            output->rgb_buffer = recycle_buffer_get(
+                    (size_t)output->width * output->height * 3);
+            return_if(output->rgb_buffer == NULL, -1);
         }
-        av_free_packet(&packet);
+        return_if(video_file_scale_output(video_file, n,
+                    n > 0 ? output[-1].rgb_buffer : video_file->rgb_buffer,
+                    output->rgb_buffer) < 0, -1);
     }
 
     return 0;
 }
 
 int
-video_file_decode_until_non_black(struct VideoFile* video_file)
+video_file_set_lowres(struct VideoFile* video_file, int lowres)
 {
+    int width;
+    int height;
+
     return_if(video_file == NULL, -1);
+    return_if(lowres < 0, -1);
 
-    do
+    lowres = MIN(lowres, video_file->codec->max_lowres);
+    return_if(lowres == video_file->codec_ctx->lowres, 0);
+
+    /* full size, as frames are shifted down from it */
+    width = video_file->width << video_file->codec_ctx->lowres;
+    height = video_file->height << video_file->codec_ctx->lowres;
+
+    avcodec_close(video_file->codec_ctx);
+    video_file->codec_ctx->lowres = lowres;
+    if (avcodec_open2(video_file->codec_ctx, video_file->codec, NULL) < 0)
     {
-        video_file_decode_frame(video_file);
-    } while (histogram_heuristically_black(&(video_file->histogram)));
+        LOG(ERROR, "%s", "Failed to reopen decoder");
+        return -1;
+    }
+
+    free_output(video_file);
+    clear_outputs(video_file);
+    /* the candidate copy has the old size */
+    free_candidate_buffer(video_file);
+    video_file->candidate_valid = 0;
+    video_file->width = -((-width) >> lowres);
+    video_file->height = -((-height) >> lowres);
+    video_file->output_width = video_file->width;
+    video_file->output_height = video_file->height;
 
     return 0;
 }
 
-int 
-video_file_save_frame(struct VideoFile* video_file, 
-        const char* filename, enum ImageFormat image_format)
+void
+video_file_set_seek_decode(struct VideoFile* video_file,
+        enum SeekDecode seek_decode)
 {
-    return_if(video_file == NULL, -1);
-    return_if(filename == NULL, -1);
-    return_if(image_format < 0 || image_format >= IMAGE_FORMAT_COUNT, -1);
+    return_if(video_file == NULL,);
+    return_if(seek_decode < 0 || seek_decode >= SEEK_DECODE_COUNT,);
 
-    return image_save(filename, video_file->frame_rgb->data[0],
-            video_file->width, video_file->height,
-            image_format);
+    video_file->seek_decode = seek_decode;
 }
 
 int
-video_file_seek_frame(struct VideoFile* video_file, uint64_t frame, int slow_seek)
+video_seek_decode_from_string(const char* name)
 {
-    return_if(video_file == NULL, -1);
+    return_if(name == NULL, -1);
 
-    if (!slow_seek)
+    if (!strcmp(name, "exact"))
     {
-        av_seek_frame(video_file->format_ctx, 
+        return SEEK_DECODE_EXACT;
+    }
+    else if (!strcmp(name, "fast"))
+    {
+        return SEEK_DECODE_FAST;
+    }
+    else if (!strcmp(name, "fastest"))
+    {
+        return SEEK_DECODE_FASTEST;
+    }
+
+    return -1;
+}
+
+int
+video_scale_flags_from_string(const char* name)
+{
+    return_if(name == NULL, -1);
+
+    if (!strcmp(name, "fast"))
+    {
+        return SWS_FAST_BILINEAR;
+    }
+    else if (!strcmp(name, "bilinear"))
+    {
+        return SWS_BILINEAR;
+    }
+    else if (!strcmp(name, "bicubic"))
+    {
+        return SWS_BICUBIC;
+    }
+    else if (!strcmp(name, "area"))
+    {
+        return SWS_AREA;
+    }
+
+    return -1;
+}
+
+/**
+ * Position the demuxer on an indexed keyframe. Formats with discontinuous
+ * timestamps such as MPEG-PS/TS are positioned by byte offset, all others
+ * by the exact keyframe time stamp.
+ */
+static int
+seek_to_index_entry(struct VideoFile* video_file,
+        const struct IndexEntry* entry)
+{
+    uint64_t start = STATS_START();
+    int result;
+
+    if (video_file->format_ctx->iformat->flags & AVFMT_TS_DISCONT)
+    {
+        result = av_seek_frame(video_file->format_ctx, -1, entry->pos,
+                AVSEEK_FLAG_BYTE);
+    }
+    else
+    {
+        result = av_seek_frame(video_file->format_ctx,
                 video_file->video_stream_idx,
-                frame,
+                entry->pts,
                 AVSEEK_FLAG_BACKWARD);
     }
-    video_file->codec_ctx->skip_frame = AVDISCARD_NONREF;
-    do
-    {
-        video_file_decode_frame(video_file);
-        if (video_file->pts >= frame - 1)
-        {
-            printf("PTS: %"PRId64", frame: %"PRIu64"\n", video_file->pts, frame);
-            break;
-        }
-    } while (1);
-    video_file->codec_ctx->skip_frame = AVDISCARD_NONE;
+    avcodec_flush_buffers(video_file->codec_ctx);
+    STATS_STOP(STATS_PHASE_SEEK, start);
 
-    return 0;
+    return result < 0 ? -1 : 0;
+}
+
+/**
+ * Demux the whole file once, collecting the video keyframes
+ */
+static struct SeekIndex*
+build_index(struct VideoFile* video_file, const char* filename)
+{
+    struct SeekIndex* index;
+    AVPacket packet;
+
+    index = seek_index_new(filename);
+    return_if(index == NULL, NULL);
+
+    while (av_read_frame(video_file->format_ctx, &packet) >= 0)
+    {
+        if (packet.stream_index == video_file->video_stream_idx &&
+            (packet.flags & AV_PKT_FLAG_KEY) &&
+            packet.pos >= 0)
+        {
+            int64_t pts = packet.pts != AV_NOPTS_VALUE ?
+                packet.pts : packet.dts;
+
+            if (pts != AV_NOPTS_VALUE)
+            {
+                seek_index_add(index, pts, packet.pos);
+            }
+        }
+        av_free_packet(&packet);
+    }
+
+    index->header.stream_index = video_file->video_stream_idx;
+    index->header.codec_id = video_file->codec_ctx->codec_id;
+    index->header.width = video_file->width;
+    index->header.height = video_file->height;
+    index->header.time_base_num = video_file->video_stream->time_base.num;
+    index->header.time_base_den = video_file->video_stream->time_base.den;
+    index->header.duration = video_file->video_stream->duration;
+
+    return index;
+}
+
+int
+video_file_use_index(struct VideoFile* video_file, const char* filename,
+        const char* cache_dir)
+{
+    char path[1024];
+    struct SeekIndex* index;
+
+    return_if(video_file == NULL, -1);
+    return_if(video_file->index != NULL, 0);
+    return_if(seek_index_get_path(filename, cache_dir, path,
+                sizeof(path)) < 0, -1);
+
+    index = seek_index_load(path, filename);
+    if (index &&
+        (index->header.stream_index != video_file->video_stream_idx ||
+         index->header.codec_id != (int32_t)video_file->codec_ctx->codec_id ||
+         index->header.width != video_file->width ||
+         index->header.height != video_file->height))
+    {
+        seek_index_free(index);
+        index = NULL;
+    }
+
+    if (!index)
+    {
+        LOG(INFO, "Building keyframe index %s", path);
+        index = build_index(video_file, filename);
+        return_if(index == NULL, -1);
+
+        if (seek_index_save(index, path) < 0)
+        {
+            LOG(WARNING, "Failed to write keyframe index %s", path);
+        }
+
+        /* rewind for decoding */
+        if (index->header.count > 0)
+        {
+            seek_to_index_entry(video_file, &(index->entries[0]));
+        }
+        else
+        {
+            av_seek_frame(video_file->format_ctx, -1, 0, AVSEEK_FLAG_BYTE);
+            avcodec_flush_buffers(video_file->codec_ctx);
+        }
+    }
+
+    if (index->header.count == 0)
+    {
+        seek_index_free(index);
+        return -1;
+    }
+
+    video_file->index = index;
+
+    return 0;
+}
+
+int
+video_file_share_index(struct VideoFile* video_file, struct SeekIndex* index)
+{
+    return_if(video_file == NULL || index == NULL, -1);
+    return_if(video_file->index != NULL, 0);
+
+    video_file->index = seek_index_ref(index);
+
+    return 0;
+}
+
+int 
+video_file_close(struct VideoFile* video_file)
+{
+    return_if (NULL == video_file, -1);
+
+    free_output(video_file);
+    clear_outputs(video_file);
+
+    if (video_file->index != NULL)
+    {
+        seek_index_free(video_file->index);
+    }
+
+    recycle_frame_put(video_file->frame_rgb);
+    recycle_frame_put(video_file->candidate);
+    free_candidate_buffer(video_file);
+    recycle_frame_put(video_file->frame);
+
+    if (video_file->codec_ctx != NULL)
+    {
+        avcodec_close(video_file->codec_ctx);
+    }
+
+    if (video_file->format_ctx)
+    {
+        avformat_close_input(&(video_file->format_ctx));
+    }
+
+    /* after the format context, which does not free custom I/O */
+    file_input_close(video_file->input);
+
+    free(video_file);
+
+    return 0;
+}
+
+/**
+ * Presentation time of the frame just decoded. Frames are reordered by the
+ * decoder, so the packet fed last may belong to another frame; streams
+ * without pts fall back to the dts the frame was stored with.
+ */
+static int64_t
+frame_pts(const AVFrame* frame, const AVPacket* packet)
+{
+    if (frame->pkt_pts != AV_NOPTS_VALUE)
+    {
+        return frame->pkt_pts;
+    }
+    if (frame->pkt_dts != AV_NOPTS_VALUE)
+    {
+        return frame->pkt_dts;
+    }
+
+    return packet->dts;
+}
+
+/**
+ * Decode the next frame, accounting the decoder time to phase
+ */
+static int
+decode_frame(struct VideoFile* video_file, enum StatsPhase phase)
+{
+    AVPacket packet;
+    int frame_finished = 0;
+    uint64_t start = STATS_START();
+
+    while (av_read_frame(video_file->format_ctx, &packet) >= 0)
+    {
+        STATS_STOP(STATS_PHASE_DEMUX, start);
+        STATS_COUNT(STATS_PACKETS_READ, 1);
+        if (packet.stream_index == video_file->video_stream_idx)
+        {
+            start = STATS_START();
+            avcodec_decode_video2(
+                    video_file->codec_ctx, 
+                    video_file->frame,
+                    &frame_finished,
+                    &packet);
+            STATS_STOP(phase, start);
+            if (frame_finished)
+            {
+                STATS_COUNT(STATS_FRAMES_DECODED, 1);
+                video_file->pts = frame_pts(video_file->frame, &packet);
+                if (video_file->index && video_file->pts != AV_NOPTS_VALUE)
+                {
+                    video_file->pts = seek_index_time(video_file->index,
+                            video_file->pts, packet.pos);
+                }
+                video_file->picture = video_file->frame;
+                /* the RGB frame and histogram are created on demand */
+                video_file->rgb_valid = 0;
+                video_file->yuv_valid = 0;
+                video_file->histogram_valid = 0;
+                av_free_packet(&packet);
+                break;
+            }
+        }
+        av_free_packet(&packet);
+        start = STATS_START();
+    }
+
+    return frame_finished ? 0 : -1;
+}
+
+int
+video_file_decode_frame(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, -1);
+
+    return decode_frame(video_file, STATS_PHASE_DECODE);
+}
+
+int
+video_file_materialize_frame(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, -1);
+
+    if (setup_scaler(video_file) < 0 || setup_rgb_buffer(video_file) < 0)
+    {
+        free_output(video_file);
+        return -1;
+    }
+
+    if (!video_file->rgb_valid)
+    {
+        uint64_t start = STATS_START();
+
+        /* create rgb frame */
+        sws_scale(
+                video_file->scale_ctx,
+                (const uint8_t * const*) video_file->picture->data,
+                video_file->picture->linesize, 0,
+                video_file->height, 
+                video_file->frame_rgb->data, 
+                video_file->frame_rgb->linesize);
+        STATS_STOP(STATS_PHASE_SCALE, start);
+        video_file->rgb_valid = 1;
+    }
+
+    return 0;
+}
+
+int
+video_file_load_rgb(struct VideoFile* video_file, const uint8_t* buffer)
+{
+    return_if(video_file == NULL, -1);
+    return_if(buffer == NULL, -1);
+    return_if(setup_rgb_buffer(video_file) < 0, -1);
+
+    memcpy(video_file->rgb_buffer, buffer, rgb_buffer_size(video_file));
+    video_file->rgb_valid = 1;
+
+    return 0;
+}
+
+int
+video_file_convert_frame(struct VideoFile* video_file,
+        uint8_t* buffer, int linesize)
+{
+    uint8_t* data[4] = { buffer, NULL, NULL, NULL };
+    int linesizes[4] = { linesize, 0, 0, 0 };
+    uint64_t start;
+
+    return_if(video_file == NULL, -1);
+    return_if(buffer == NULL, -1);
+    return_if(setup_scaler(video_file) < 0, -1);
+
+    start = STATS_START();
+    sws_scale(
+            video_file->scale_ctx,
+            (const uint8_t * const*) video_file->picture->data,
+            video_file->picture->linesize, 0,
+            video_file->height,
+            data,
+            linesizes);
+    STATS_STOP(STATS_PHASE_SCALE, start);
+
+    return 0;
+}
+
+int
+video_file_get_yuv420(struct VideoFile* video_file, struct YuvImage* image)
+{
+    AVFrame* frame;
+
+    return_if(video_file == NULL, -1);
+    return_if(image == NULL, -1);
+
+    frame = video_file->picture;
+    if (is_passthrough_yuv420(video_file))
+    {
+        /* nothing to do, use the decoder's planes */
+        int i;
+
+        for (i = 0; i < 3; i++)
+        {
+            image->planes[i] = frame->data[i];
+            image->linesizes[i] = frame->linesize[i];
+        }
+        image->width = video_file->width;
+        image->height = video_file->height;
+
+        return 0;
+    }
+
+    if (!video_file->yuv_valid)
+    {
+        return_if(setup_yuv_scaler(video_file) < 0, -1);
+
+        if (!video_file->yuv_buffer)
+        {
+            video_file->yuv_buffer = recycle_buffer_get(
+                    image_yuv420_layout(&(video_file->yuv), NULL,
+                        video_file->output_width,
+                        video_file->output_height));
+            return_if(video_file->yuv_buffer == NULL, -1);
+            image_yuv420_layout(&(video_file->yuv), video_file->yuv_buffer,
+                    video_file->output_width, video_file->output_height);
+        }
+
+        return_if(video_file_convert_frame_yuv420(video_file,
+                    &(video_file->yuv)) < 0, -1);
+        video_file->yuv_valid = 1;
+    }
+
+    *image = video_file->yuv;
+
+    return 0;
+}
+
+int
+video_file_convert_frame_yuv420(struct VideoFile* video_file,
+        struct YuvImage* image)
+{
+    uint8_t* data[4];
+    int linesizes[4];
+    uint64_t start;
+    int i;
+
+    return_if(video_file == NULL, -1);
+    return_if(image == NULL, -1);
+    return_if(setup_yuv_scaler(video_file) < 0, -1);
+
+    for (i = 0; i < 3; i++)
+    {
+        data[i] = image->planes[i];
+        linesizes[i] = image->linesizes[i];
+    }
+    data[3] = NULL;
+    linesizes[3] = 0;
+
+    start = STATS_START();
+    sws_scale(
+            video_file->yuv_scale_ctx,
+            (const uint8_t * const*) video_file->picture->data,
+            video_file->picture->linesize, 0,
+            video_file->height,
+            data,
+            linesizes);
+    STATS_STOP(STATS_PHASE_SCALE, start);
+
+    return 0;
+}
+
+struct Histogram*
+video_file_get_histogram(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, NULL);
+
+    if (!video_file->histogram_valid)
+    {
+        int range = luma_plane_range(video_file->codec_ctx->pix_fmt);
+        uint64_t start;
+
+        if (range >= 0)
+        {
+            start = STATS_START();
+            histogram_create_from_luma(
+                    video_file->picture->data[0],
+                    video_file->picture->linesize[0],
+                    video_file->width,
+                    video_file->height,
+                    range,
+                    1,
+                    &(video_file->histogram));
+        }
+        else
+        {
+            /* the conversion is timed as scaling */
+            return_if(video_file_materialize_frame(video_file) < 0, NULL);
+            start = STATS_START();
+            histogram_create_from_rgb(
+                    video_file->frame_rgb->data[0],
+                    video_file->output_width,
+                    video_file->output_height,
+                    &(video_file->histogram));
+        }
+        STATS_STOP(STATS_PHASE_HISTOGRAM, start);
+        video_file->histogram_valid = 1;
+    }
+
+    return &(video_file->histogram);
+}
+
+int
+video_file_sample_histogram(struct VideoFile* video_file, int sample_step,
+        struct Histogram* histogram)
+{
+    int range;
+
+    return_if(video_file == NULL, -1);
+    return_if(histogram == NULL, -1);
+
+    range = luma_plane_range(video_file->codec_ctx->pix_fmt);
+    if (range >= 0)
+    {
+        uint64_t start = STATS_START();
+        int result;
+
+        result = histogram_create_from_luma(
+                video_file->picture->data[0],
+                video_file->picture->linesize[0],
+                video_file->width,
+                video_file->height,
+                range,
+                sample_step,
+                histogram);
+        STATS_STOP(STATS_PHASE_HISTOGRAM, start);
+
+        return result;
+    }
+
+    return_if(video_file_get_histogram(video_file) == NULL, -1);
+    *histogram = video_file->histogram;
+
+    return 0;
+}
+
+int
+video_file_is_black(struct VideoFile* video_file)
+{
+    int range;
+
+    return_if(video_file == NULL, 0);
+
+    range = luma_plane_range(video_file->codec_ctx->pix_fmt);
+    if (range >= 0 && !video_file->histogram_valid)
+    {
+        uint64_t start = STATS_START();
+        int black;
+
+        black = histogram_luma_heuristically_black(
+                video_file->picture->data[0],
+                video_file->picture->linesize[0],
+                video_file->width,
+                video_file->height,
+                range,
+                video_file->sample_step);
+        STATS_STOP(STATS_PHASE_HISTOGRAM, start);
+
+        return black;
+    }
+
+    return histogram_heuristically_black(
+            video_file_get_histogram(video_file));
+}
+
+uint64_t
+video_file_get_dhash(struct VideoFile* video_file)
+{
+    uint64_t start;
+    uint64_t hash;
+
+    return_if(video_file == NULL, 0);
+
+    if (luma_plane_range(video_file->codec_ctx->pix_fmt) >= 0)
+    {
+        start = STATS_START();
+        hash = histogram_dhash_from_luma(
+                video_file->picture->data[0],
+                video_file->picture->linesize[0],
+                video_file->width,
+                video_file->height);
+    }
+    else
+    {
+        uint8_t gray[HISTOGRAM_DHASH_WIDTH * HISTOGRAM_DHASH_HEIGHT];
+        uint8_t* data[4] = { gray, NULL, NULL, NULL };
+        int linesizes[4] = { HISTOGRAM_DHASH_WIDTH, 0, 0, 0 };
+
+        if (!video_file->hash_scale_ctx)
+        {
+            /* each output pixel is one sample, there is nothing to filter */
+            video_file->hash_scale_ctx = make_scale_context(video_file,
+                    HISTOGRAM_DHASH_WIDTH, HISTOGRAM_DHASH_HEIGHT,
+                    PIX_FMT_GRAY8, SWS_FAST_BILINEAR,
+                    &(video_file->hash_scale_key));
+            return_if(video_file->hash_scale_ctx == NULL, 0);
+        }
+
+        start = STATS_START();
+        sws_scale(
+                video_file->hash_scale_ctx,
+                (const uint8_t * const*) video_file->picture->data,
+                video_file->picture->linesize, 0,
+                video_file->height,
+                data, linesizes);
+        hash = histogram_dhash_from_luma(gray, HISTOGRAM_DHASH_WIDTH,
+                HISTOGRAM_DHASH_WIDTH, HISTOGRAM_DHASH_HEIGHT);
+    }
+    STATS_STOP(STATS_PHASE_HISTOGRAM, start);
+
+    return hash;
+}
+
+int
+video_file_decode_until_non_black(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, -1);
+
+    return_if(video_file_decode_frame(video_file) < 0, -1);
+    while (video_file_is_black(video_file))
+    {
+        STATS_COUNT(STATS_FRAMES_BLACK, 1);
+        return_if(video_file_decode_frame(video_file) < 0, -1);
+    }
+
+    return 0;
+}
+
+int
+video_file_set_candidate_window(struct VideoFile* video_file, int window)
+{
+    return_if(video_file == NULL, -1);
+    return_if(window < 0, -1);
+
+    video_file->candidate_window = window;
+    video_file->candidate_valid = 0;
+
+    return 0;
+}
+
+/**
+ * Convert a number of frames to stream time base units, guessing 25 fps if
+ * the container does not know the frame rate
+ */
+static int64_t
+frames_to_pts(struct VideoFile* video_file, int frames)
+{
+    AVRational rate = video_file->video_stream->r_frame_rate;
+    AVRational duration;
+
+    if (rate.num <= 0 || rate.den <= 0)
+    {
+        rate.num = 25;
+        rate.den = 1;
+    }
+    duration.num = rate.den;
+    duration.den = rate.num;
+
+    return av_rescale_q(frames, duration, video_file->video_stream->time_base);
+}
+
+/**
+ * Copy the current frame into the candidate picture
+ */
+static int
+store_candidate(struct VideoFile* video_file)
+{
+    enum PixelFormat pix_fmt = video_file->codec_ctx->pix_fmt;
+
+    if (!video_file->candidate)
+    {
+        video_file->candidate = recycle_frame_get();
+        return_if(video_file->candidate == NULL, -1);
+    }
+
+    if (!video_file->candidate_buffer)
+    {
+        video_file->candidate_buffer = recycle_buffer_get(
+                candidate_buffer_size(video_file));
+        return_if(video_file->candidate_buffer == NULL, -1);
+        avpicture_fill((AVPicture *)video_file->candidate,
+                video_file->candidate_buffer, pix_fmt,
+                video_file->width, video_file->height);
+    }
+
+    av_picture_copy((AVPicture *)video_file->candidate,
+            (const AVPicture *)video_file->frame, pix_fmt,
+            video_file->width, video_file->height);
+
+    return 0;
+}
+
+/**
+ * Score a frame decoded while seeking and keep it if it is the best
+ * candidate so far. Frames just before the window only serve as the
+ * previous frame of the first candidate.
+ */
+static void
+track_candidate(struct VideoFile* video_file, int is_candidate)
+{
+    struct Histogram* histogram = video_file_get_histogram(video_file);
+
+    if (!histogram)
+    {
+        return;
+    }
+
+    if (is_candidate)
+    {
+        double score = histogram_score(histogram,
+                video_file->previous_valid ?
+                &(video_file->previous_histogram) : NULL);
+
+        if ((!video_file->candidate_valid ||
+                    score > video_file->candidate_score) &&
+                store_candidate(video_file) == 0)
+        {
+            video_file->candidate_score = score;
+            video_file->candidate_pts = video_file->pts;
+            video_file->candidate_valid = 1;
+        }
+    }
+
+    video_file->previous_histogram = *histogram;
+    video_file->previous_valid = 1;
+}
+
+int
+video_file_decode_representative(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, -1);
+
+    if (video_file_decode_frame(video_file) == 0)
+    {
+        struct Histogram* histogram;
+
+        return_if(!video_file->candidate_valid, 0);
+
+        /* the target wins ties */
+        histogram = video_file_get_histogram(video_file);
+        if (histogram && histogram_score(histogram,
+                    video_file->previous_valid ?
+                    &(video_file->previous_histogram) : NULL) >=
+                video_file->candidate_score)
+        {
+            video_file->candidate_valid = 0;
+            return 0;
+        }
+    }
+    else
+    {
+        /* end of stream; an earlier frame is still better than none */
+        return_if(!video_file->candidate_valid, -1);
+    }
+
+    video_file->picture = video_file->candidate;
+    video_file->pts = video_file->candidate_pts;
+    video_file->rgb_valid = 0;
+    video_file->yuv_valid = 0;
+    video_file->histogram_valid = 0;
+    video_file->candidate_valid = 0;
+
+    return 0;
+}
+
+int 
+video_file_save_frame(struct VideoFile* video_file, 
+        const char* filename, enum ImageFormat image_format)
+{
+    return_if(video_file == NULL, -1);
+    return_if(filename == NULL, -1);
+    return_if(image_format < 0 || image_format >= IMAGE_FORMAT_COUNT, -1);
+
+    return_if(video_file_materialize_frame(video_file) < 0, -1);
+
+    return image_save(filename, video_file->frame_rgb->data[0],
+            video_file->output_width, video_file->output_height,
+            image_format);
+}
+
+/**
+ * Move the lines from first on to the start of the band buffer
+ */
+static void
+bands_drop(struct FrameBands* bands, int first)
+{
+    struct YuvImage* planes = &(bands->planes);
+    int i;
+
+    if (first == bands->first)
+    {
+        return;
+    }
+
+    memmove(planes->planes[0],
+            planes->planes[0] + (size_t)(first - bands->first) *
+            planes->linesizes[0],
+            (size_t)(bands->end - first) * planes->linesizes[0]);
+    for (i = 1; bands->yuv420 && i < 3; i++)
+    {
+        /* chroma line n is written with luma line 2n */
+        memmove(planes->planes[i],
+                planes->planes[i] + (size_t)(first / 2 - bands->first / 2) *
+                planes->linesizes[i],
+                (size_t)((bands->end + 1) / 2 - first / 2) *
+                planes->linesizes[i]);
+    }
+    bands->first = first;
+}
+
+/**
+ * Hand the next lines of the decoded frame to the scaler, appending the
+ * output lines it releases to the band buffer
+ */
+static int
+bands_scale(struct FrameBands* bands)
+{
+    struct VideoFile* video_file = bands->video_file;
+    AVFrame* picture = video_file->picture;
+    struct YuvImage* planes = &(bands->planes);
+    const uint8_t* source[4];
+    uint8_t* data[4] = { NULL, NULL, NULL, NULL };
+    int linesizes[4] = { 0, 0, 0, 0 };
+    int lines = MIN(BAND_INPUT_LINES, video_file->height - bands->input);
+    int produced;
+    int i;
+
+    return_if(lines <= 0, -1);
+
+    for (i = 0; i < 4; i++)
+    {
+        int shift = i == 1 || i == 2 ? bands->chroma_shift : 0;
+
+        source[i] = picture->data[i] ? picture->data[i] +
+            (size_t)(bands->input >> shift) * picture->linesize[i] : NULL;
+    }
+
+    /* the scaler writes output line y to data + y * linesize */
+    for (i = 0; i < (bands->yuv420 ? 3 : 1); i++)
+    {
+        int first = i ? bands->first / 2 : bands->first;
+
+        data[i] = planes->planes[i] - (ptrdiff_t)first * planes->linesizes[i];
+        linesizes[i] = planes->linesizes[i];
+    }
+
+    /* timed as part of encoding, which asks for the lines */
+    produced = sws_scale(bands->scale_ctx, source, picture->linesize,
+            bands->input, lines, data, linesizes);
+    bands->input += lines;
+    return_if(produced < 0, -1);
+
+    if (bands->histogram)
+    {
+        histogram_add_rgb(&(video_file->histogram),
+                planes->planes[0] +
+                (size_t)(bands->end - bands->first) * planes->linesizes[0],
+                video_file->output_width, produced);
+    }
+    bands->end += produced;
+
+    return 0;
+}
+
+static int
+bands_read(void* data, int first, int count, struct YuvImage* lines)
+{
+    struct FrameBands* bands = (struct FrameBands *)data;
+    int i;
+
+    return_if(first < bands->first || first > bands->end, -1);
+    return_if(count < 1 || count > IMAGE_BAND_LINES, -1);
+    return_if(first + count > bands->video_file->output_height, -1);
+    return_if(bands->yuv420 && first % 2 != 0, -1);
+
+    bands_drop(bands, first);
+    while (bands->end < first + count)
+    {
+        return_if(bands_scale(bands) < 0, -1);
+    }
+
+    *lines = bands->planes;
+    lines->height = count;
+    for (i = bands->yuv420 ? 3 : 1; i < 3; i++)
+    {
+        lines->planes[i] = NULL;
+        lines->linesizes[i] = 0;
+    }
+
+    return 0;
+}
+
+/**
+ * Set up the conversion of the current frame in bands for an image format
+ */
+static int
+bands_start(struct VideoFile* video_file, enum ImageFormat format,
+        struct FrameBands* bands, struct ImageBands* image)
+{
+    enum PixelFormat pix_fmt = video_file->codec_ctx->pix_fmt;
+    int chroma_h_shift;
+    int max_output;
+
+    memset(bands, 0, sizeof(struct FrameBands));
+    bands->video_file = video_file;
+    bands->yuv420 = image_supports_yuv420(format) && is_yuv420(pix_fmt);
+    if (bands->yuv420)
+    {
+        return_if(setup_yuv_scaler(video_file) < 0, -1);
+        bands->scale_ctx = video_file->yuv_scale_ctx;
+    }
+    else
+    {
+        return_if(setup_scaler(video_file) < 0, -1);
+        bands->scale_ctx = video_file->scale_ctx;
+    }
+    avcodec_get_chroma_sub_sample(pix_fmt, &chroma_h_shift,
+            &(bands->chroma_shift));
+
+    /* a call of the scaler releases the lines of its input slice plus
+     * those held back by the vertical filter; the caller keeps up to a
+     * band of older lines */
+    max_output = (int)(((int64_t)(BAND_INPUT_LINES + BAND_FILTER_LINES) *
+                video_file->output_height + video_file->height - 1) /
+            video_file->height) + BAND_FILTER_LINES;
+    bands->capacity = MIN(IMAGE_BAND_LINES + max_output,
+            video_file->output_height);
+
+    if (bands->yuv420)
+    {
+        bands->buffer_size = image_yuv420_layout(&(bands->planes), NULL,
+                video_file->output_width, bands->capacity);
+    }
+    else
+    {
+        bands->buffer_size = (size_t)video_file->output_width * 3 *
+            bands->capacity;
+    }
+    bands->buffer = recycle_buffer_get(bands->buffer_size);
+    return_if(bands->buffer == NULL, -1);
+
+    if (bands->yuv420)
+    {
+        image_yuv420_layout(&(bands->planes), bands->buffer,
+                video_file->output_width, bands->capacity);
+    }
+    else
+    {
+        bands->planes.planes[0] = bands->buffer;
+        bands->planes.linesizes[0] = video_file->output_width * 3;
+        bands->planes.width = video_file->output_width;
+        bands->planes.height = bands->capacity;
+    }
+
+    /* the histogram of a frame without luma plane comes from RGB anyway */
+    if (!bands->yuv420 && !video_file->histogram_valid &&
+            luma_plane_range(pix_fmt) < 0)
+    {
+        memset(&(video_file->histogram), 0, sizeof(struct Histogram));
+        bands->histogram = 1;
+    }
+
+    image->width = video_file->output_width;
+    image->height = video_file->output_height;
+    image->yuv420 = bands->yuv420;
+    image->read = bands_read;
+    image->data = bands;
+
+    return 0;
+}
+
+static void
+bands_finish(struct FrameBands* bands)
+{
+    struct VideoFile* video_file = bands->video_file;
+
+    if (bands->histogram && bands->end == video_file->output_height)
+    {
+        video_file->histogram_valid = 1;
+    }
+    recycle_buffer_put(bands->buffer, bands->buffer_size);
+    bands->buffer = NULL;
+}
+
+int
+video_file_wants_bands(struct VideoFile* video_file, enum ImageFormat format)
+{
+    enum PixelFormat pix_fmt;
+
+    return_if(video_file == NULL, 0);
+
+    pix_fmt = video_file->codec_ctx->pix_fmt;
+    /* nothing to gain if the whole picture exists already */
+    if (image_supports_yuv420(format) && is_yuv420(pix_fmt))
+    {
+        return_if(video_file->yuv_valid, 0);
+        return_if(is_passthrough_yuv420(video_file), 0);
+    }
+    else
+    {
+        return_if(video_file->rgb_valid, 0);
+    }
+
+    /* slices of palette formats would lose their palette */
+    return_if(has_palette(pix_fmt), 0);
+
+    return rgb_buffer_size(video_file) > BAND_MIN_BYTES;
+}
+
+int
+video_file_save_frame_bands(struct VideoFile* video_file,
+        const char* filename, enum ImageFormat image_format)
+{
+    struct FrameBands bands;
+    struct ImageBands image;
+    int result;
+
+    return_if(video_file == NULL, -1);
+    return_if(filename == NULL, -1);
+    return_if(image_format < 0 || image_format >= IMAGE_FORMAT_COUNT, -1);
+
+    return_if(bands_start(video_file, image_format, &bands, &image) < 0, -1);
+    result = image_save_bands(filename, &image, image_format);
+    bands_finish(&bands);
+
+    return result;
+}
+
+int
+video_file_encode_frame_bands(struct VideoFile* video_file,
+        enum ImageFormat image_format, uint8_t** data, size_t* size)
+{
+    struct FrameBands bands;
+    struct ImageBands image;
+    int result;
+
+    return_if(video_file == NULL, -1);
+    return_if(image_format < 0 || image_format >= IMAGE_FORMAT_COUNT, -1);
+
+    return_if(bands_start(video_file, image_format, &bands, &image) < 0, -1);
+    result = image_encode_bands(&image, image_format, data, size);
+    bands_finish(&bands);
+
+    return result;
+}
+
+int64_t
+video_file_get_gop(struct VideoFile* video_file, uint64_t frame)
+{
+    const struct IndexEntry* entry;
+
+    return_if(video_file == NULL, AV_NOPTS_VALUE);
+    return_if(video_file->index == NULL, AV_NOPTS_VALUE);
+
+    entry = seek_index_find(video_file->index, frame);
+    return_if(entry == NULL, AV_NOPTS_VALUE);
+
+    return entry->time;
+}
+
+void
+video_file_prefetch(struct VideoFile* video_file, uint64_t frame)
+{
+    const struct IndexEntry* entry = NULL;
+    int64_t size;
+    int64_t window;
+    int64_t start;
+    int64_t end;
+
+    if (!video_file || !video_file->input)
+    {
+        return;
+    }
+
+    size = file_input_get_size(video_file->input);
+
+    /* about two seconds of data */
+    window = video_file->format_ctx->bit_rate > 0 ?
+        video_file->format_ctx->bit_rate / 4 : PREFETCH_MAX / 4;
+    window = MIN(MAX(window, PREFETCH_MIN), PREFETCH_MAX);
+
+    if (video_file->index)
+    {
+        entry = seek_index_find(video_file->index, frame);
+    }
+
+    if (entry && entry->pos >= 0)
+    {
+        /* from the keyframe up to the next one */
+        const struct IndexEntry* last = video_file->index->entries +
+            video_file->index->header.count - 1;
+
+        start = entry->pos;
+        end = entry < last && entry[1].pos > start ? entry[1].pos :
+            start + window;
+        end = MIN(end, start + PREFETCH_MAX);
+    }
+    else if (video_file->video_stream->duration > 0)
+    {
+        /* assume a constant bit rate; the keyframe lies before the target */
+        int64_t position = av_rescale(
+                (int64_t)frame - MAX(video_file->video_stream->start_time, 0),
+                size, video_file->video_stream->duration);
+
+        start = position - window;
+        end = position + window / 2;
+    }
+    else
+    {
+        return;
+    }
+
+    file_input_prefetch(video_file->input, start, end - start);
+}
+
+/**
+ * Check whether frame lies in the GOP that is currently being decoded, so
+ * that decoding forward is cheaper than seeking back to its keyframe
+ */
+static int
+in_current_gop(struct VideoFile* video_file, uint64_t frame)
+{
+    int64_t gop = video_file_get_gop(video_file, frame);
+
+    return gop != AV_NOPTS_VALUE &&
+        gop <= video_file->pts &&
+        video_file->pts < (int64_t)frame;
+}
+
+/**
+ * Lower the decoding quality according to VideoFile::seek_decode, keeping
+ * stricter settings made elsewhere
+ */
+static void
+set_seek_quality(struct VideoFile* video_file)
+{
+    AVCodecContext* codec_ctx = video_file->codec_ctx;
+
+    if (video_file->seek_decode >= SEEK_DECODE_FAST)
+    {
+        codec_ctx->skip_loop_filter = MAX(codec_ctx->skip_loop_filter,
+                AVDISCARD_ALL);
+    }
+    if (video_file->seek_decode >= SEEK_DECODE_FASTEST)
+    {
+        codec_ctx->skip_idct = MAX(codec_ctx->skip_idct, AVDISCARD_NONKEY);
+    }
+}
+
+int
+video_file_seek_frame(struct VideoFile* video_file, uint64_t frame, int slow_seek)
+{
+    enum AVDiscard skip_frame;
+    enum AVDiscard skip_loop_filter;
+    enum AVDiscard skip_idct;
+    int64_t window_start;
+
+    return_if(video_file == NULL, -1);
+
+    if (in_current_gop(video_file, frame))
+    {
+        /* the keyframe of the target has been decoded already */
+    }
+    else if (video_file->index)
+    {
+        /* the index makes seeking reliable even where -s was needed */
+        seek_to_index_entry(video_file,
+                seek_index_find(video_file->index, frame));
+    }
+    else if (!slow_seek)
+    {
+        uint64_t start = STATS_START();
+
+        av_seek_frame(video_file->format_ctx, 
+                video_file->video_stream_idx,
+                frame,
+                AVSEEK_FLAG_BACKWARD);
+        STATS_STOP(STATS_PHASE_SEEK, start);
+    }
+    /* keep a stricter setting such as AVDISCARD_NONKEY */
+    skip_frame = video_file->codec_ctx->skip_frame;
+    video_file->codec_ctx->skip_frame = MAX(skip_frame, AVDISCARD_NONREF);
+    skip_loop_filter = video_file->codec_ctx->skip_loop_filter;
+    skip_idct = video_file->codec_ctx->skip_idct;
+    set_seek_quality(video_file);
+    video_file->candidate_valid = 0;
+    video_file->previous_valid = 0;
+    window_start = (int64_t)frame -
+        frames_to_pts(video_file, video_file->candidate_window);
+    do
+    {
+        if (decode_frame(video_file, STATS_PHASE_SEEK_DECODE) < 0)
+        {
+            break;
+        }
+        if (video_file->pts >= frame - 1)
+        {
+            LOG(DEBUG, "PTS: %"PRId64", frame: %"PRIu64, video_file->pts,
+                    frame);
+            break;
+        }
+        if (video_file->candidate_window > 0 &&
+                video_file->pts >= window_start - frames_to_pts(video_file, 1))
+        {
+            track_candidate(video_file, video_file->pts >= window_start);
+            /* candidates may end up in an image */
+            video_file->codec_ctx->skip_loop_filter = skip_loop_filter;
+            video_file->codec_ctx->skip_idct = skip_idct;
+        }
+    } while (1);
+    /* the target is decoded at full quality */
+    video_file->codec_ctx->skip_frame = skip_frame;
+    video_file->codec_ctx->skip_loop_filter = skip_loop_filter;
+    video_file->codec_ctx->skip_idct = skip_idct;
+
+    return 0;
+}
+
+int
+video_file_seek_keyframe(struct VideoFile* video_file, uint64_t frame)
+{
+    uint64_t start;
+
+    return_if(video_file == NULL, -1);
+
+    /* nothing is decoded on the way */
+    video_file->candidate_valid = 0;
+
+    /* even a target in the current GOP needs a seek: its keyframe has
+     * been decoded already, and with non-key frames skipped the next
+     * decode would return the keyframe of the following GOP */
+
+    if (video_file->index)
+    {
+        return seek_to_index_entry(video_file,
+                seek_index_find(video_file->index, frame));
+    }
+
+    start = STATS_START();
+    return_if(av_seek_frame(video_file->format_ctx,
+                video_file->video_stream_idx,
+                frame,
+                AVSEEK_FLAG_BACKWARD) < 0, -1);
+    avcodec_flush_buffers(video_file->codec_ctx);
+    STATS_STOP(STATS_PHASE_SEEK, start);
+
+    return 0;
+}
+
+void
+video_file_set_keyframes_only(struct VideoFile* video_file, int keyframes_only)
+{
+    return_if(video_file == NULL,);
+
+    video_file->codec_ctx->skip_frame =
+        keyframes_only ? AVDISCARD_NONKEY : AVDISCARD_NONE;
+}
+
+double
+video_file_get_time(struct VideoFile* video_file)
+{
+    return_if(video_file == NULL, 0.0);
+
+    return video_file->pts * av_q2d(video_file->video_stream->time_base);
 }
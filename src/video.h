@@ -31,6 +31,51 @@
 
 #include "image.h"
 #include "histogram.h"
+#include "index.h"
+#include "input.h"
+#include "recycle.h"
+
+/**
+ * Decoding quality of the frames #video_file_seek_frame decodes on its way
+ * to a target. These frames are never shown, but later frames are
+ * predicted from them, so a faster setting lowers the quality of the
+ * target frame as well.
+ */
+enum SeekDecode
+{
+    /** full quality; only frames nothing refers to are skipped */
+    SEEK_DECODE_EXACT = 0,
+    /** skip the loop filter, which H.264 spends much of its time in */
+    SEEK_DECODE_FAST,
+    /** also skip the inverse transform of all frames but keyframes, so
+     * only motion compensation runs */
+    SEEK_DECODE_FASTEST,
+    SEEK_DECODE_COUNT
+};
+
+/**
+ * Bounds of an output size, see #video_file_set_output_size
+ */
+struct VideoSize
+{
+    int width;
+    int height;
+};
+
+/**
+ * A further RGB output size, scaled from the next larger one
+ */
+struct VideoOutput
+{
+    int width;
+    int height;
+    /** position in the list given to #video_file_set_output_sizes */
+    int index;
+    struct SwsContext* scale_ctx;
+    struct ScalerKey scale_key;
+    /** filled by #video_file_materialize_outputs */
+    uint8_t* rgb_buffer;
+};
 
 struct VideoFile
 {
@@ -39,32 +84,537 @@ struct VideoFile
     AVCodec* codec;
     AVStream *video_stream;
     struct SwsContext* scale_ctx;
+    /** parameters of scale_ctx, to give it back to the pool */
+    struct ScalerKey scale_key;
     int video_stream_idx;
     int width;
     int height;
+    /** size of the RGB frame */
+    int output_width;
+    int output_height;
+    /** swscale algorithm used for the RGB conversion */
+    int scale_flags;
+    /** smaller sizes cascading from the RGB frame, largest first */
+    struct VideoOutput* outputs;
+    int num_outputs;
+    /** position of the RGB frame size in the list given to
+     * #video_file_set_output_sizes */
+    int output_index;
+    /** presentation time stamp of the current frame; with an index, its
+     * position on the timeline of IndexEntry::time */
     int64_t pts;
+    /** decoder output */
     AVFrame *frame;
+    /** current picture; frame or candidate after
+     * #video_file_decode_representative picked an earlier frame */
+    AVFrame *picture;
     AVFrame *frame_rgb;
     uint8_t* rgb_buffer;
+    /** frame_rgb holds the conversion of the current frame */
+    int rgb_valid;
+    /** scaler and buffer for JPEG range YCbCr 4:2:0 output */
+    struct SwsContext* yuv_scale_ctx;
+    struct ScalerKey yuv_scale_key;
+    uint8_t* yuv_buffer;
+    struct YuvImage yuv;
+    /** yuv holds the conversion of the current frame */
+    int yuv_valid;
+    /** scaler to the gray picture hashed by #video_file_get_dhash for
+     * formats without an 8 bit luma plane */
+    struct SwsContext* hash_scale_ctx;
+    struct ScalerKey hash_scale_key;
     struct Histogram histogram;
+    /** histogram belongs to the current frame */
+    int histogram_valid;
+    /** keyframe index used for seeking, may be NULL */
+    struct SeekIndex* index;
+    /** custom I/O backend, NULL for libav's own */
+    struct FileInput* input;
+    /** only every sample_step-th line and column is used for black frame
+     * detection */
+    int sample_step;
+    /** number of frames before a seek target considered by
+     * #video_file_decode_representative, 0 to disable */
+    int candidate_window;
+    /** quality of the frames decoded while seeking */
+    enum SeekDecode seek_decode;
+    /** copy of the best frame decoded while seeking */
+    AVFrame* candidate;
+    uint8_t* candidate_buffer;
+    int64_t candidate_pts;
+    double candidate_score;
+    int candidate_valid;
+    /** histogram of the frame decoded before the current one */
+    struct Histogram previous_histogram;
+    int previous_valid;
 };
 
+/**
+ * Open a video file; "-" reads the video from stdin.
+ *
+ * @param filename name of the video file
+ * @return a new #VideoFile or NULL on error
+ * \ingroup video
+ */
 struct VideoFile* 
 video_file_open(const char* filename);
 
+/**
+ * Open a video file like #video_file_open, reading it through the given
+ * I/O backend.
+ *
+ * @param filename name of the video file
+ * @param mode a member of #InputMode
+ * @return a new #VideoFile or NULL on error
+ * \ingroup video
+ */
+struct VideoFile*
+video_file_open_input(const char* filename, enum InputMode mode);
+
+/**
+ * Check whether positions can be reached by seeking. Pipes and streams of
+ * unknown duration can only be decoded from start to end.
+ *
+ * @param video_file a #VideoFile
+ * @return 1 if the file can be seeked and has a known duration
+ * \ingroup video
+ */
+int
+video_file_is_seekable(struct VideoFile* video_file);
+
 int 
 video_file_close(struct VideoFile* video_file);
 
+/**
+ * Seek using a persistent keyframe index. An existing index file is
+ * memory-mapped if it matches the video file; otherwise the file is demuxed
+ * once to build the index, which is then saved for later runs. With an
+ * index, all seeks go straight to the keyframe before the target, also in
+ * slow seek mode.
+ *
+ * @param video_file a #VideoFile
+ * @param filename name of the video file
+ * @param cache_dir directory for index files or NULL to store the index
+ * next to the video file
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_use_index(struct VideoFile* video_file, const char* filename,
+        const char* cache_dir);
+
+/**
+ * Seek with an index obtained by another #VideoFile of the same file, see
+ * #video_file_use_index, so it is neither loaded nor built again.
+ *
+ * @param video_file a #VideoFile
+ * @param index a #SeekIndex; video_file takes a reference of its own
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_share_index(struct VideoFile* video_file, struct SeekIndex* index);
+
+/**
+ * Set the size of the RGB frames. If only one of width and height is given,
+ * the other one follows from the display aspect ratio of the video. If both
+ * are given, the picture is fitted into a box of that size. Frames are
+ * never scaled up, and the dimensions are rounded down to even numbers.
+ * Colorspace conversion and scaling happen in a single swscale pass.
+ * Further sizes set by #video_file_set_output_sizes are dropped.
+ *
+ * @param video_file a #VideoFile
+ * @param width maximum output width or 0
+ * @param height maximum output height or 0
+ * @param scale_flags swscale algorithm, e.g. SWS_BICUBIC
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_set_output_size(struct VideoFile* video_file,
+        int width, int height, int scale_flags);
+
+/**
+ * Produce several output sizes from every frame. The largest size becomes
+ * the size of the RGB frame, see #video_file_set_output_size. The others
+ * end up in VideoFile::outputs, largest first, and each one is scaled from
+ * the RGB picture of the next larger size instead of the decoded frame.
+ *
+ * @param video_file a #VideoFile
+ * @param sizes bounds of each size, 0 for the size of the video
+ * @param count number of sizes
+ * @param scale_flags swscale algorithm, e.g. SWS_BICUBIC
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_set_output_sizes(struct VideoFile* video_file,
+        const struct VideoSize* sizes, int count, int scale_flags);
+
+/**
+ * Scale an RGB24 picture of the next larger size into output n, e.g. from
+ * one pipeline buffer into another.
+ *
+ * @param video_file a #VideoFile
+ * @param n index into VideoFile::outputs
+ * @param source picture of output n - 1, or of the RGB frame for n = 0,
+ * with lines of width * 3 bytes
+ * @param buffer target picture with lines of width * 3 bytes
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_scale_output(struct VideoFile* video_file, int n,
+        const uint8_t* source, uint8_t* buffer);
+
+/**
+ * Convert the current frame to RGB like #video_file_materialize_frame and
+ * fill the buffers of all further output sizes from it.
+ *
+ * @param video_file a #VideoFile
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_materialize_outputs(struct VideoFile* video_file);
+
+/**
+ * Let the decoder produce frames reduced by a power of two, which skips
+ * most of the work for codecs supporting it. Resets the output size, so
+ * #video_file_set_output_size has to be called afterwards.
+ *
+ * @param video_file a #VideoFile
+ * @param lowres frames are 2^lowres times smaller; limited to what the
+ * codec supports, 0 for full size
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_set_lowres(struct VideoFile* video_file, int lowres);
+
+/**
+ * Trade the quality of the frames decoded while seeking for speed. Frames
+ * considered by #video_file_set_candidate_window and the target itself are
+ * always decoded at full quality; lowres is not available here, as it
+ * cannot change between frames of the same stream.
+ *
+ * @param video_file a #VideoFile
+ * @param seek_decode a member of #SeekDecode
+ * \ingroup video
+ */
+void
+video_file_set_seek_decode(struct VideoFile* video_file,
+        enum SeekDecode seek_decode);
+
+/**
+ * Translate the name of a seek decode setting (<tt>exact</tt>,
+ * <tt>fast</tt> or <tt>fastest</tt>) to a member of #SeekDecode.
+ *
+ * @param name name of the setting
+ * @return a member of #SeekDecode or -1 if the name is unknown
+ * \ingroup video
+ */
+int
+video_seek_decode_from_string(const char* name);
+
+/**
+ * Translate the name of a scaling algorithm (<tt>fast</tt>,
+ * <tt>bilinear</tt>, <tt>bicubic</tt> or <tt>area</tt>) to swscale flags.
+ *
+ * @param name name of the algorithm
+ * @return swscale flags or -1 if the name is unknown
+ * \ingroup video
+ */
+int
+video_scale_flags_from_string(const char* name);
+
+/**
+ * Decode the next frame of the video stream. Only the decoder runs here;
+ * colorspace conversion and histogram creation are deferred until
+ * #video_file_materialize_frame or #video_file_get_histogram is called.
+ *
+ * @param video_file a #VideoFile
+ * @return 0 on success, -1 if no further frame could be decoded
+ * \ingroup video
+ */
 int
 video_file_decode_frame(struct VideoFile* video_file);
 
+/**
+ * Convert the current frame to RGB unless this has already been done since
+ * the last call to #video_file_decode_frame.
+ *
+ * @param video_file a #VideoFile
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_materialize_frame(struct VideoFile* video_file);
+
+/**
+ * Replace the RGB frame with a picture converted earlier, e.g. by
+ * #video_file_convert_frame. The picture is used until the next frame is
+ * decoded.
+ *
+ * @param video_file a #VideoFile
+ * @param buffer RGB24 picture of the output size, width * 3 bytes per line
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_load_rgb(struct VideoFile* video_file, const uint8_t* buffer);
+
+/**
+ * Scale and convert the current frame into a caller-provided RGB24 buffer
+ * of VideoFile::output_width x VideoFile::output_height pixels, e.g. a tile
+ * of a larger image.
+ *
+ * @param video_file a #VideoFile
+ * @param buffer first byte of the target picture
+ * @param linesize distance between two lines of buffer in bytes
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_convert_frame(struct VideoFile* video_file,
+        uint8_t* buffer, int linesize);
+
+/**
+ * Get the current frame as full range YCbCr 4:2:0 of the output size
+ * without any RGB conversion, for formats that store such planes (see
+ * #image_supports_yuv420). Decoded frames already in that format and size
+ * are used as they are; other 4:2:0 frames are scaled in YUV once.
+ *
+ * @param video_file a #VideoFile
+ * @param image set to planes owned by video_file, valid until the next
+ * call of #video_file_decode_frame
+ * @return 0 on success, -1 if the video is not 4:2:0
+ * \ingroup video
+ */
+int
+video_file_get_yuv420(struct VideoFile* video_file, struct YuvImage* image);
+
+/**
+ * Scale the current frame into caller-provided YCbCr 4:2:0 planes of
+ * VideoFile::output_width x VideoFile::output_height samples.
+ *
+ * @param video_file a #VideoFile
+ * @param image target planes, e.g. laid out by #image_yuv420_layout
+ * @return 0 on success, -1 if the video is not 4:2:0
+ * \ingroup video
+ */
+int
+video_file_convert_frame_yuv420(struct VideoFile* video_file,
+        struct YuvImage* image);
+
+/**
+ * Get the luma histogram of the current frame, creating it on first use.
+ * For YUV formats the histogram is taken from the decoded luma plane,
+ * other formats are converted to RGB first.
+ *
+ * @param video_file a #VideoFile
+ * @return pointer to the histogram owned by video_file
+ * \ingroup video
+ */
+struct Histogram*
+video_file_get_histogram(struct VideoFile* video_file);
+
+/**
+ * Create a luma histogram of the current frame from every sample_step-th
+ * line and column, for analysis that does not need every pixel. Formats
+ * without a luma plane use the full histogram.
+ *
+ * @param video_file a #VideoFile
+ * @param sample_step distance between sampled lines and columns
+ * @param histogram pointer to a #Histogram. Any old data will be erased.
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_sample_histogram(struct VideoFile* video_file, int sample_step,
+        struct Histogram* histogram);
+
+/**
+ * Check whether the current frame is (near-)black. For YUV formats the
+ * decoded luma plane is sampled according to VideoFile::sample_step and the
+ * check stops as soon as the result is clear.
+ *
+ * @param video_file a #VideoFile
+ * @return 1 if the frame is (near-)black, 0 otherwise
+ * \ingroup video
+ */
+int
+video_file_is_black(struct VideoFile* video_file);
+
+/**
+ * Compute the perceptual hash of the current frame with
+ * #histogram_dhash_from_luma. For YUV formats it is read from the decoded
+ * luma plane, the same data the histogram is built from, so no conversion
+ * is needed. Other formats, e.g. 10 bit video, are scaled down to the
+ * few pixels hashed; the frame itself is never converted.
+ *
+ * @param video_file a #VideoFile
+ * @return the hash, 0 on error
+ * \ingroup video
+ */
+uint64_t
+video_file_get_dhash(struct VideoFile* video_file);
+
 int
 video_file_decode_until_non_black(struct VideoFile* video_file);
 
+/**
+ * Let #video_file_seek_frame keep the best of the last frames it decodes
+ * before a target. Only frames decoded for seeking anyway are considered,
+ * so this adds histogram creation and at most one picture copy per frame
+ * to the seek.
+ *
+ * @param video_file a #VideoFile
+ * @param window maximum number of frames before the target to consider, 0
+ * to disable
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_set_candidate_window(struct VideoFile* video_file, int window);
+
+/**
+ * Decode the next frame like #video_file_decode_frame, then pick the frame
+ * with the best #histogram_score among it and the candidates collected by
+ * the last #video_file_seek_frame. This avoids fades, transitions and flat
+ * title cards near the target. VideoFile::pts is the position of the
+ * picked frame.
+ *
+ * @param video_file a #VideoFile
+ * @return 0 on success, -1 if no further frame could be decoded
+ * \ingroup video
+ */
+int
+video_file_decode_representative(struct VideoFile* video_file);
+
 int
 video_file_save_frame(struct VideoFile* video_file, 
         const char* file_name, enum ImageFormat image_format);
 
+/**
+ * Check whether the current frame is better written with
+ * #video_file_save_frame_bands: its output picture is large and has not
+ * been converted as a whole already.
+ *
+ * @param video_file a #VideoFile
+ * @param image_format format the frame is to be written in
+ * @return 1 to write in bands, 0 otherwise
+ * \ingroup video
+ */
+int
+video_file_wants_bands(struct VideoFile* video_file,
+        enum ImageFormat image_format);
+
+/**
+ * Write the current frame while converting it a band of lines at a time,
+ * so only a few rows of JPEG blocks are held instead of the whole output
+ * picture. JPEG gets YCbCr 4:2:0 lines from 4:2:0 video, RGB lines
+ * otherwise; the file is the same as written from the whole picture. For
+ * video without luma plane the histogram is collected on the way.
+ *
+ * @param video_file a #VideoFile
+ * @param filename name of the image file
+ * @param image_format a member of #ImageFormat
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_save_frame_bands(struct VideoFile* video_file,
+        const char* filename, enum ImageFormat image_format);
+
+/**
+ * Same as #video_file_save_frame_bands, encoding into memory like
+ * #image_encode.
+ *
+ * @param video_file a #VideoFile
+ * @param image_format a member of #ImageFormat
+ * @param data set to the encoded image; release it with free()
+ * @param size set to the number of bytes in data
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_encode_frame_bands(struct VideoFile* video_file,
+        enum ImageFormat image_format, uint8_t** data, size_t* size);
+
+/**
+ * Move to the frame before the given position, so that the next call of
+ * #video_file_decode_frame returns the target. With a keyframe index, a
+ * target inside the GOP currently being decoded is reached by decoding
+ * forward instead of seeking back to the same keyframe, so every GOP is
+ * decoded at most once for ascending targets.
+ *
+ * @param video_file a #VideoFile
+ * @param frame target position in stream time base units
+ * @param slow_seek 1 to decode from the current position instead of using
+ * container seeking
+ * @return 0 on success
+ * \ingroup video
+ */
 int
 video_file_seek_frame(struct VideoFile* video_file, uint64_t frame, int slow_seek);
+
+/**
+ * Start reading the data needed to seek to a position into the page cache
+ * in the background, so the seek does not stall on the disk. The byte range
+ * comes from the keyframe index or is estimated from the position in the
+ * file. Only has an effect with a custom I/O backend.
+ *
+ * @param video_file a #VideoFile
+ * @param frame upcoming target position in stream time base units
+ * \ingroup video
+ */
+void
+video_file_prefetch(struct VideoFile* video_file, uint64_t frame);
+
+/**
+ * Find the GOP containing a position.
+ *
+ * @param video_file a #VideoFile with a keyframe index
+ * @param frame position in stream time base units
+ * @return position of the keyframe starting the GOP on the timeline of
+ * IndexEntry::time or AV_NOPTS_VALUE if there is no index
+ * \ingroup video
+ */
+int64_t
+video_file_get_gop(struct VideoFile* video_file, uint64_t frame);
+
+/**
+ * Seek to the last keyframe at or before frame without decoding anything,
+ * even if it starts the GOP that was decoded last.
+ * Together with #video_file_set_keyframes_only, the next call to
+ * #video_file_decode_frame costs exactly one intra frame decode.
+ *
+ * @param video_file a #VideoFile
+ * @param frame target position in stream time base units
+ * @return 0 on success
+ * \ingroup video
+ */
+int
+video_file_seek_keyframe(struct VideoFile* video_file, uint64_t frame);
+
+/**
+ * Make the decoder skip all frames that are not keyframes.
+ *
+ * @param video_file a #VideoFile
+ * @param keyframes_only 1 to decode keyframes only, 0 to decode all frames
+ * \ingroup video
+ */
+void
+video_file_set_keyframes_only(struct VideoFile* video_file, int keyframes_only);
+
+/**
+ * Get the position of the current frame.
+ *
+ * @param video_file a #VideoFile
+ * @return presentation time of the current frame in seconds
+ * \ingroup video
+ */
+double
+video_file_get_time(struct VideoFile* video_file);
 #endif /* __VIDEO_H */